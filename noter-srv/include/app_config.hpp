@@ -21,6 +21,8 @@ const std::string CONFIG_DB_PASSWORD = "db_password";
 
 const std::string CONFIG_DELETE_NOTE_AFTER_PROCESSING = "delete_note_after_processing";
 
+const std::string CONFIG_CHECKSUM_THREADS = "checksum_threads";
+
 
 class AppConfig {
 public:
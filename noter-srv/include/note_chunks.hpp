@@ -0,0 +1,24 @@
+#ifndef NOTER_NOTE_CHUNKS
+#define NOTER_NOTE_CHUNKS
+
+#include <string>
+
+/**
+ * Large notes are sent by noter client as series of chunks (separate notes with 'pt' - id of whole note,
+ * 'pi' - chunk index and, on the last chunk only, 'pn' - chunks count in metadata) so transfer starts 
+ * while note is still being captured. Received chunks are put aside and whole note is assembled
+ * under its own id once all chunks are there, so notes consumer only ever sees complete notes.
+ * Empty chunk with 'pn' of 0 means noter aborted note - chunks received so far are dropped and chunks dir is kept
+ * as tombstone (count of 0), so chunks of the note still in flight over other connections are dropped as they come
+*/
+
+//is_chunk is false if received file is ordinary note - then it is left untouched
+int processReceivedChunk(const std::string& file_path, bool *is_chunk);
+
+//removes chunks of note noter aborted, along with abort marker itself, and leaves tombstone of the note
+int dropAbortedNote(const std::string& file_path, const std::string& chunks_dir, const std::string& note_id);
+
+//deletes chunks of notes that were never completed and expired tombstones of aborted notes
+void deleteDanglingChunks();
+
+#endif //NOTER_NOTE_CHUNKS
@@ -0,0 +1,16 @@
+#ifndef NOTER_NOTE_DECOMPRESSOR
+#define NOTER_NOTE_DECOMPRESSOR
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Notes may come compressed by noter client (codec name is in 'cz' note metadata entry).
+ * Body is stored as is and decompressed only by channels that need plain content (e.g. email)
+*/
+
+bool isSupportedCodec(std::string codec_name);
+
+int decompressNoteBody(std::string codec_name, const char* data, size_t length, size_t max_length, std::string *out_str);
+
+#endif //NOTER_NOTE_DECOMPRESSOR
@@ -0,0 +1,45 @@
+#ifndef NOTER_SRV_NOTE_PROTOCOL
+#define NOTER_SRV_NOTE_PROTOCOL
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * noterd -> noter-srv protocol. Every frame starts with 36 bytes name and 4 bytes size (network byte order).
+ * Note frame v1: note uuid | size | 32 bytes md5 hex | note.
+ * Note frame v2: note uuid | size | 1 byte checksum algorithm id | 1 byte checksum hex length | checksum hex | note.
+ * Server replies to every note with 4 bytes processing status.
+ * Control frame name starts with '!'. Client starts connection with hello frame '!hello/<protocol version>' 
+ * of size 0 - server replies with status, its protocol version and mask of checksum algorithms it supports 
+ * (bit 1 << algorithm id, bit 31 - tree variants of them; both network byte order). Server older than v2 rejects hello as note of invalid size 
+ * and closes connection, client then reconnects and uses v1.
+ * v3: connection is kept open between batches of notes - client sends ping frame '!ping' of size 0 when idle,
+ * server replies with status
+ * v4: server replies to every note with 4 bytes processing status followed by 36 bytes note name, so client
+ * doesn't wait for reply before sending next note - replies come in order notes were sent
+ * v5: note of NOTE_PROTOCOL_RESUME_MIN_NOTE_LENGTH or more is resumable. Client first sends '!resume' frame, its size 
+ * is length of payload: note uuid | 4 bytes note size | 1 byte checksum algorithm id | 1 byte checksum hex length | 
+ * checksum hex. Server replies with status, 4 bytes count of chunks it has of that very note and 4 bytes crc32 
+ * of each of them. Client then sends either note frame or '!patch' frame: payload of '!resume' | 4 bytes count 
+ * of chunks | 4 bytes index of each chunk, followed by content of those chunks. Chunks are 
+ * NOTE_PROTOCOL_RESUME_CHUNK_LENGTH bytes, the last one may be shorter. Patch is replied to as note. 
+ * Numbers are in network byte order
+*/
+
+const uint32_t NOTE_PROTOCOL_VERSION = 5;
+
+//32 bytes of uuid string + 4 dash separators
+const size_t NOTE_PROTOCOL_FRAME_NAME_LENGTH = 36;
+
+const char NOTE_PROTOCOL_CONTROL_FRAME_PREFIX = '!';
+const std::string NOTE_PROTOCOL_HELLO_FRAME_NAME = "!hello/";
+const std::string NOTE_PROTOCOL_PING_FRAME_NAME = "!ping";
+const std::string NOTE_PROTOCOL_RESUME_FRAME_NAME = "!resume";
+const std::string NOTE_PROTOCOL_PATCH_FRAME_NAME = "!patch";
+
+//4194304 = 4 meg
+const size_t NOTE_PROTOCOL_RESUME_CHUNK_LENGTH = 4194304;
+const size_t NOTE_PROTOCOL_RESUME_MIN_NOTE_LENGTH = 2 * NOTE_PROTOCOL_RESUME_CHUNK_LENGTH;
+
+#endif //NOTER_SRV_NOTE_PROTOCOL
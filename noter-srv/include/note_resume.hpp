@@ -0,0 +1,80 @@
+#ifndef NOTER_NOTE_RESUME
+#define NOTER_NOTE_RESUME
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "checksum.hpp"
+
+/**
+ * Resumable upload of large notes (protocol v5). While note is received, crc32 of every 
+ * NOTE_PROTOCOL_RESUME_CHUNK_LENGTH bytes is appended to chunk log next to temp file (temp_<note>.chunks). 
+ * First line of log is note size, checksum algorithm and checksum, so log is never taken for other content 
+ * under the same name. Temp file and log are kept if connection drops in the middle of note or checksum 
+ * of whole note doesn't match - client asks for crc list of chunks ('!resume') and sends only chunks that are 
+ * missing or differ ('!patch'). Kept files are deleted with other dangling temp files
+*/
+
+//note uuid | 4 bytes size | 1 byte checksum algorithm id | 1 byte checksum hex length | checksum hex
+struct ResumeNoteInfo {
+    std::string note_name;
+    size_t note_size = 0;
+    ChecksumAlgorithm checksum_algorithm = ChecksumAlgorithm::MD5;
+    std::string checksum_str;
+};
+
+//payload_offset is moved past note info
+int parseResumeNoteInfo(const std::string& payload, size_t *payload_offset, ResumeNoteInfo *note_info);
+
+class ChunkLog {
+public:
+    explicit ChunkLog(const std::string& tmp_file_path);
+    ~ChunkLog();
+
+    ChunkLog(const ChunkLog& other) = delete;
+    ChunkLog& operator= (const ChunkLog& other) = delete;
+
+    //temp file is locked while note is received, so connection client gave up on already doesn't write to it
+    //along with new one. False if it is locked by other process (or there is no temp file and create_note is false)
+    bool lockNote(bool create_note = true);
+
+    //log of note received from scratch
+    int create(const ResumeNoteInfo& note_info);
+
+    //log of the same note content left by broken transfer, false if there is none
+    bool load(const ResumeNoteInfo& note_info);
+
+    //note content in order it is received (and already written to temp file), crc of every complete chunk 
+    //is appended to log
+    int append(const char* data, size_t length);
+
+    //chunk received again by patch, log is rewritten with save()
+    void setChunkCrc(size_t chunk_idx, uint32_t chunk_crc);
+
+    int save();
+
+    void remove();
+
+    const std::vector<uint32_t>& chunkCrcs() const { return chunk_crcs_; };
+
+private:
+    static std::string buildHeader(const ResumeNoteInfo& note_info);
+
+    std::string tmp_file_path_;
+    std::string log_path_;
+    int lock_descr_ = -1;
+    std::string header_str_;
+    std::ofstream log_stream_;
+
+    std::vector<uint32_t> chunk_crcs_;
+    size_t note_size_ = 0;
+    size_t received_bytes_ = 0;
+    //chunk being received
+    uint32_t chunk_crc_ = 0;
+    size_t chunk_filled_ = 0;
+};
+
+#endif //NOTER_NOTE_RESUME
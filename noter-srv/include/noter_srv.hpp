@@ -1,6 +1,13 @@
 #ifndef NOTER_SRV
 #define NOTER_SRV
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "checksum.hpp"
+#include "note_resume.hpp"
+
 enum class ProcessingStatus {
     OK = 100,
     GENERIC_ERROR = 101,
@@ -10,6 +17,35 @@ enum class ProcessingStatus {
 
 void processRequest(int sock_descr);
 
+//kept alive client may stay idle between notes, child gives up on it when idle too long or server shuts down
+int waitForClientFrame(int sock_descr);
+
+//verifies checksum of received note and moves it to final name (or puts chunk aside). 
+//Note with chunk log is kept for resume if checksum doesn't match
+ProcessingStatus storeReceivedNote(const char* file_name, const std::string& out_file_path_tmp, 
+    ChecksumAlgorithm checksum_algorithm, ChecksumCalculator* checksum_calculator, const std::string& checksum_str,
+    ChunkLog* chunk_log);
+
+//control frames (hello) are not notes, client_protocol_version is set by hello
+int processControlFrame(int sock_descr, const char* frame_name, size_t frame_size, uint32_t *client_protocol_version);
+
+//payload of resume and patch frames
+int receiveControlPayload(int sock_descr, size_t frame_size, std::string *payload);
+
+//v5 client asks for crc of chunks server has of large note, before sending it
+int processResumeFrame(int sock_descr, size_t frame_size);
+
+//v5 client sends only chunks server doesn't have, note is then checked and stored as if received whole.
+//ERROR if connection can't go on
+int receiveNotePatch(int sock_descr, size_t frame_size, uint32_t client_protocol_version);
+
+//v1 client always sends md5, v2 client sends algorithm along with checksum
+int receiveNoteChecksum(int sock_descr, uint32_t client_protocol_version, ChecksumAlgorithm *algorithm, 
+    std::string *checksum_str);
+
 int sendProcessedResponse(int s_descr, ProcessingStatus status);
 
+//v4 client gets note name along with status of every note, so it can keep several notes in flight
+int sendNoteResponse(int s_descr, uint32_t client_protocol_version, const char* note_name, ProcessingStatus status);
+
 #endif //NOTER_SRV
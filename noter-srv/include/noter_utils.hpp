@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <cstddef>
 
 enum Status {
     OK = 0,
@@ -24,7 +25,11 @@ int createOrClearDirectory(std::string dir_path);
 
 long getFileSize(std::string file_path);
 
-int calculateFileMD5(const std::string file_path, std::string *out_str);
+int preadAll(int fd, char* buf, size_t length, long offset);
+
+int pwriteAll(int fd, const char* buf, size_t length, long offset);
+
+std::string digestToHexString(const unsigned char* digest, size_t length);
 
 bool startsWith(std::string str, std::string pref);
 
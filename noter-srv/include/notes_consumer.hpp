@@ -8,6 +8,9 @@
 
 void watchTempFiles(NotesChannelRegistry& channels_registry);
 
+//reads header string from the tail of note file
+int readNoteHeader(const std::string& file_path, std::string *header_str, size_t *body_length);
+
 std::map<std::string, std::string> parseNoteMetadata(std::string header_str);
 
 #endif //NOTER_NOTES_CONSUMER
\ No newline at end of file
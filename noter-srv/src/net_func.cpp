@@ -40,6 +40,7 @@ int sendAll(int s_descr, const char* buff, size_t length) {
             }
         }
 
+        buff += res;
         length -= res;
     }
 
@@ -0,0 +1,362 @@
+#include "note_chunks.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include <ctime>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <filesystem>
+
+#include "noter_utils.hpp"
+#include "notes_consumer.hpp"
+
+using namespace std;
+
+extern const string OUT_FILES_TMP_DIR;
+extern const string OUT_FILE_CHUNKS_DIR;
+extern const string OUT_FILE_TMP_PREFIX;
+
+extern const string META_KEY_CHUNK_PARENT;
+extern const string META_KEY_CHUNK_INDEX;
+extern const string META_KEY_CHUNK_COUNT;
+
+extern const size_t MAX_OUT_FILE_SIZE;
+
+//32 bytes of uuid string + 4 dash separators
+const size_t NOTE_ID_LENGTH = 36;
+const long int MAX_CHUNK_IDLE_TIME_SEC = 86400L;
+
+//noter never splits note into more chunks than max note size / min chunk size (+ possibly empty last one)
+const long MAX_CHUNKS_COUNT = 1001;
+
+const string CHUNK_FILE_PREFIX = "chunk_";
+//chunks count is stored separately as last chunk may come before others
+const string CHUNKS_COUNT_FILE_NAME = "count";
+
+
+int parseChunkNumber(const string& str, long *number) {
+    if (str.empty() || str.size() > 4 || str.find_first_not_of("0123456789") != string::npos) {
+        return Status::ERROR;
+    }
+
+    *number = stol(str);
+
+    return Status::OK;
+}
+
+int writeChunksCount(const string& chunks_dir, long chunks_count) {
+    string count_file_tmp_path = chunks_dir + OUT_FILE_TMP_PREFIX + CHUNKS_COUNT_FILE_NAME;
+    string count_str = to_string(chunks_count);
+
+    int count_fd = open(count_file_tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (count_fd == -1) {
+        return Status::ERROR;
+    }
+
+    bool written = write(count_fd, count_str.c_str(), count_str.size()) == static_cast<ssize_t>(count_str.size());
+
+    if (close(count_fd) != 0 || !written) {
+        return Status::ERROR;
+    }
+
+    return rename(count_file_tmp_path.c_str(), (chunks_dir + CHUNKS_COUNT_FILE_NAME).c_str()) == 0 
+        ? Status::OK : Status::ERROR;
+}
+
+long readChunksCount(const string& chunks_dir) {
+    int count_fd = open((chunks_dir + CHUNKS_COUNT_FILE_NAME).c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (count_fd == -1) {
+        //last chunk is not received yet
+        return 0;
+    }
+
+    char count_buf[16] = {0};
+    ssize_t bytes_read = read(count_fd, count_buf, sizeof(count_buf) - 1);
+
+    close(count_fd);
+
+    long chunks_count;
+
+    if (bytes_read <= 0 || parseChunkNumber(string(count_buf, bytes_read), &chunks_count) != Status::OK) {
+        return -1;
+    }
+
+    return chunks_count;
+}
+
+//tombstone left by dropAbortedNote(), missing count file means last chunk is not received yet
+bool isNoteAborted(const string& chunks_dir) {
+    return fileExists(chunks_dir + CHUNKS_COUNT_FILE_NAME) && readChunksCount(chunks_dir) == 0;
+}
+
+int appendFileRange(int out_fd, const string& in_file_path, size_t length) {
+    int in_fd = open(in_file_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (in_fd == -1) {
+        return Status::ERROR;
+    }
+
+    //data stays in kernel, filesystem may even share extents instead of copying
+    while (length > 0) {
+        ssize_t res = copy_file_range(in_fd, nullptr, out_fd, nullptr, length, 0);
+
+        if (res == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (res <= 0) {
+            close(in_fd);
+
+            return Status::ERROR;
+        }
+
+        length -= res;
+    }
+
+    close(in_fd);
+
+    return Status::OK;
+}
+
+int assembleNote(const string& chunks_dir, const string& note_id, long chunks_count) {
+    string note_tmp_path = OUT_FILES_TMP_DIR + OUT_FILE_TMP_PREFIX + note_id;
+
+    int note_fd = open(note_tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (note_fd == -1) {
+        syslog(LOG_ERR, "failed to open assembled note file '%s': %s", note_tmp_path.c_str(), strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    string header_str;
+    size_t note_body_length = 0;
+
+    for (long chunk_index = 0; chunk_index < chunks_count; chunk_index++) {
+        string chunk_path = chunks_dir + CHUNK_FILE_PREFIX + to_string(chunk_index);
+        size_t chunk_body_length;
+
+        if (readNoteHeader(chunk_path, &header_str, &chunk_body_length) != Status::OK 
+                || note_body_length + chunk_body_length > MAX_OUT_FILE_SIZE
+                || appendFileRange(note_fd, chunk_path, chunk_body_length) != Status::OK) {
+            syslog(LOG_ERR, "failed to append chunk '%s' to note: %s", chunk_path.c_str(), strerror(errno));
+            close(note_fd);
+            unlink(note_tmp_path.c_str());
+
+            return Status::ERROR;
+        }
+
+        note_body_length += chunk_body_length;
+    }
+
+    //header of whole note is header of last chunk without chunk entries
+    string note_header_str;
+
+    for (auto& entry : split_string_by_delim(header_str, ";")) {
+        if (startsWith(entry, META_KEY_CHUNK_PARENT + ":") || startsWith(entry, META_KEY_CHUNK_INDEX + ":") 
+                || startsWith(entry, META_KEY_CHUNK_COUNT + ":")) {
+            continue;
+        }
+
+        note_header_str += (note_header_str.empty() ? "" : ";") + entry;
+    }
+
+    uint32_t header_length_network_byteorder = htonl(note_header_str.size());
+    note_header_str.append(reinterpret_cast<char*>(&header_length_network_byteorder), sizeof(header_length_network_byteorder));
+
+    bool header_written = write(note_fd, note_header_str.c_str(), note_header_str.size()) 
+        == static_cast<ssize_t>(note_header_str.size());
+
+    if (close(note_fd) != 0 || !header_written) {
+        syslog(LOG_ERR, "failed to write assembled note header '%s': %s", note_tmp_path.c_str(), strerror(errno));
+        unlink(note_tmp_path.c_str());
+
+        return Status::ERROR;
+    }
+
+    if (renameFile(note_tmp_path, OUT_FILES_TMP_DIR + note_id) != Status::OK) {
+        unlink(note_tmp_path.c_str());
+
+        return Status::ERROR;
+    }
+
+    syslog(LOG_INFO, "assembled note '%s' of length '%li' from %li chunks", note_id.c_str(), note_body_length, chunks_count);
+
+    return Status::OK;
+}
+
+int processReceivedChunk(const string& file_path, bool *is_chunk) {
+    *is_chunk = false;
+
+    string header_str;
+    size_t body_length;
+
+    if (readNoteHeader(file_path, &header_str, &body_length) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    map<string, string> note_metadata = parseNoteMetadata(header_str);
+
+    if (note_metadata.count(META_KEY_CHUNK_PARENT) == 0) {
+        return Status::OK;
+    }
+
+    *is_chunk = true;
+
+    string note_id = note_metadata[META_KEY_CHUNK_PARENT];
+    long chunk_index;
+    long chunks_count = 0;
+
+    if (note_id.size() != NOTE_ID_LENGTH || note_id.find('/') != string::npos
+            || parseChunkNumber(note_metadata[META_KEY_CHUNK_INDEX], &chunk_index) != Status::OK
+            || (note_metadata.count(META_KEY_CHUNK_COUNT) > 0 
+                && parseChunkNumber(note_metadata[META_KEY_CHUNK_COUNT], &chunks_count) != Status::OK)
+            || chunk_index >= MAX_CHUNKS_COUNT || chunks_count > MAX_CHUNKS_COUNT) {
+        syslog(LOG_ERR, "got chunk with bad metadata '%s': '%s'", file_path.c_str(), header_str.c_str());
+
+        return Status::ERROR;
+    }
+
+    string chunks_dir = OUT_FILE_CHUNKS_DIR + note_id + "/";
+
+    //zero count - noter gave up on note (input too large, capture error, killed), it is never completed
+    if (note_metadata.count(META_KEY_CHUNK_COUNT) > 0 && chunks_count == 0) {
+        return dropAbortedNote(file_path, chunks_dir, note_id);
+    }
+
+    if (createDirectories(chunks_dir) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    //chunks of the same note may be received by several connections at once, only one of them assembles it
+    int chunks_dir_fd = open(chunks_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (chunks_dir_fd == -1 || flock(chunks_dir_fd, LOCK_EX) != 0) {
+        syslog(LOG_ERR, "failed to lock chunks directory '%s': %s", chunks_dir.c_str(), strerror(errno));
+
+        if (chunks_dir_fd != -1) {
+            close(chunks_dir_fd);
+        }
+
+        return Status::ERROR;
+    }
+
+    //chunk was on its way while other connection got abort marker of note
+    if (isNoteAborted(chunks_dir)) {
+        deleteFile(file_path);
+        close(chunks_dir_fd);
+
+        syslog(LOG_INFO, "dropped chunk %li of aborted note '%s'", chunk_index, note_id.c_str());
+
+        return Status::OK;
+    }
+
+    int res = Status::OK;
+
+    if (renameFile(file_path, chunks_dir + CHUNK_FILE_PREFIX + to_string(chunk_index)) != Status::OK
+            || (chunks_count > 0 && writeChunksCount(chunks_dir, chunks_count) != Status::OK)) {
+        syslog(LOG_ERR, "failed to store chunk %li of note '%s'", chunk_index, note_id.c_str());
+
+        res = Status::ERROR;
+    } else {
+        chunks_count = readChunksCount(chunks_dir);
+
+        bool all_received = chunks_count > 0;
+
+        for (long i = 0; all_received && i < chunks_count; i++) {
+            all_received = fileExists(chunks_dir + CHUNK_FILE_PREFIX + to_string(i));
+        }
+
+        if (all_received) {
+            res = assembleNote(chunks_dir, note_id, chunks_count);
+
+            if (res == Status::OK) {
+                error_code err;
+                filesystem::remove_all(chunks_dir, err);
+            }
+        }
+    }
+
+    close(chunks_dir_fd);
+
+    return res;
+}
+
+int dropAbortedNote(const string& file_path, const string& chunks_dir, const string& note_id) {
+    deleteFile(file_path);
+
+    //dir is created even if no chunk of note is received yet - they may still come over other connections
+    if (createDirectories(chunks_dir) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    int chunks_dir_fd = open(chunks_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    //chunk being stored by other connection is not removed from under it
+    if (chunks_dir_fd == -1 || flock(chunks_dir_fd, LOCK_EX) != 0) {
+        syslog(LOG_ERR, "failed to lock chunks directory '%s': %s", chunks_dir.c_str(), strerror(errno));
+
+        if (chunks_dir_fd != -1) {
+            close(chunks_dir_fd);
+        }
+
+        return Status::ERROR;
+    }
+
+    //dir itself stays, connections waiting for its lock find tombstone in it
+    error_code err;
+
+    for (const auto& entry : filesystem::directory_iterator(chunks_dir, err)) {
+        filesystem::remove(entry.path(), err);
+    }
+
+    int res = writeChunksCount(chunks_dir, 0);
+
+    if (res == Status::OK) {
+        syslog(LOG_INFO, "dropped chunks of aborted note '%s'", note_id.c_str());
+    } else {
+        syslog(LOG_ERR, "failed to leave tombstone of aborted note '%s'", note_id.c_str());
+    }
+
+    close(chunks_dir_fd);
+
+    return res;
+}
+
+void deleteDanglingChunks() {
+    if (!fileExists(OUT_FILE_CHUNKS_DIR)) {
+        return;
+    }
+
+    time_t curr_time_sec = time(0);
+    struct stat dir_stats;
+
+    for (const auto& entry : filesystem::directory_iterator(OUT_FILE_CHUNKS_DIR)) {
+        string dir_path = entry.path().string();
+
+        //dir is modified every time chunk is received, tombstone is not modified after note is aborted
+        if (stat(dir_path.c_str(), &dir_stats) != 0 || curr_time_sec - dir_stats.st_mtime <= MAX_CHUNK_IDLE_TIME_SEC) {
+            continue;
+        }
+
+        bool note_aborted = isNoteAborted(dir_path + "/");
+
+        error_code err;
+        filesystem::remove_all(dir_path, err);
+
+        if (note_aborted) {
+            syslog(LOG_INFO, "deleted tombstone of aborted note '%s'", dir_path.c_str());
+        } else {
+            syslog(LOG_INFO, "deleted chunks of never completed note '%s'", dir_path.c_str());
+        }
+    }
+}
@@ -0,0 +1,216 @@
+#include "note_decompressor.hpp"
+
+#include <syslog.h>
+#include <zlib.h>
+
+#ifdef NOTER_WITH_LZ4
+    #include <lz4frame.h>
+#endif
+
+#ifdef NOTER_WITH_ZSTD
+    #include <zstd.h>
+#endif
+
+#include <cstring>
+#include <vector>
+
+#include "noter_utils.hpp"
+
+using namespace std;
+
+//262144 = 256 kb
+const size_t DECOMPRESSOR_OUT_BUFFER_LENGTH = 262144;
+
+const string CODEC_GZIP = "gzip";
+const string CODEC_LZ4 = "lz4";
+const string CODEC_ZSTD = "zstd";
+
+int decompressGzip(const char* data, size_t length, size_t max_length, string *out_str);
+int decompressLz4(const char* data, size_t length, size_t max_length, string *out_str);
+int decompressZstd(const char* data, size_t length, size_t max_length, string *out_str);
+
+
+bool isSupportedCodec(string codec_name) {
+#ifdef NOTER_WITH_LZ4
+    if (codec_name == CODEC_LZ4) {
+        return true;
+    }
+#endif
+
+#ifdef NOTER_WITH_ZSTD
+    if (codec_name == CODEC_ZSTD) {
+        return true;
+    }
+#endif
+
+    return codec_name == CODEC_GZIP;
+}
+
+int decompressNoteBody(string codec_name, const char* data, size_t length, size_t max_length, string *out_str) {
+    out_str->clear();
+
+    if (codec_name == CODEC_GZIP) {
+        return decompressGzip(data, length, max_length, out_str);
+    }
+
+#ifdef NOTER_WITH_LZ4
+    if (codec_name == CODEC_LZ4) {
+        return decompressLz4(data, length, max_length, out_str);
+    }
+#endif
+
+#ifdef NOTER_WITH_ZSTD
+    if (codec_name == CODEC_ZSTD) {
+        return decompressZstd(data, length, max_length, out_str);
+    }
+#endif
+
+    syslog(LOG_ERR, "unsupported note compression codec '%s'", codec_name.c_str());
+
+    return Status::ERROR;
+}
+
+int decompressGzip(const char* data, size_t length, size_t max_length, string *out_str) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    //15 bits window + 16 means gzip wrapper
+    if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+        return Status::ERROR;
+    }
+
+    vector<char> out_buf(DECOMPRESSOR_OUT_BUFFER_LENGTH);
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = length;
+
+    int res;
+
+    do {
+        stream.next_out = reinterpret_cast<Bytef*>(out_buf.data());
+        stream.avail_out = out_buf.size();
+
+        res = inflate(&stream, Z_NO_FLUSH);
+
+        if (res != Z_OK && res != Z_STREAM_END) {
+            syslog(LOG_ERR, "gzip decompression failed: %s", stream.msg != nullptr ? stream.msg : "unknown error");
+            inflateEnd(&stream);
+
+            return Status::ERROR;
+        }
+
+        out_str->append(out_buf.data(), out_buf.size() - stream.avail_out);
+
+        if (out_str->size() > max_length) {
+            syslog(LOG_ERR, "decompressed note is too large, max is %lu", max_length);
+            inflateEnd(&stream);
+
+            return Status::ERROR;
+        }
+
+        if (res == Z_STREAM_END) {
+            if (stream.avail_in == 0) {
+                break;
+            }
+
+            //body may consist of several gzip members (e.g. note assembled from chunks)
+            inflateReset(&stream);
+        }
+    //full output buffer means inflate may have more pending output
+    } while (stream.avail_in > 0 || stream.avail_out == 0);
+
+    inflateEnd(&stream);
+
+    return res == Z_STREAM_END ? Status::OK : Status::ERROR;
+}
+
+#ifdef NOTER_WITH_LZ4
+int decompressLz4(const char* data, size_t length, size_t max_length, string *out_str) {
+    LZ4F_dctx* dctx;
+
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+        return Status::ERROR;
+    }
+
+    vector<char> out_buf(DECOMPRESSOR_OUT_BUFFER_LENGTH);
+    size_t hint = 1;
+
+    //lz4 decoder continues with next frame by itself once previous one is over
+    while (length > 0) {
+        size_t produced_length = out_buf.size();
+        size_t consumed_length = length;
+
+        hint = LZ4F_decompress(dctx, out_buf.data(), &produced_length, data, &consumed_length, nullptr);
+
+        if (LZ4F_isError(hint)) {
+            syslog(LOG_ERR, "lz4 decompression failed: %s", LZ4F_getErrorName(hint));
+            LZ4F_freeDecompressionContext(dctx);
+
+            return Status::ERROR;
+        }
+
+        out_str->append(out_buf.data(), produced_length);
+
+        if (out_str->size() > max_length) {
+            syslog(LOG_ERR, "decompressed note is too large, max is %lu", max_length);
+            LZ4F_freeDecompressionContext(dctx);
+
+            return Status::ERROR;
+        }
+
+        data += consumed_length;
+        length -= consumed_length;
+    }
+
+    LZ4F_freeDecompressionContext(dctx);
+
+    //0 hint means frame is fully decoded
+    return hint == 0 ? Status::OK : Status::ERROR;
+}
+#endif
+
+#ifdef NOTER_WITH_ZSTD
+int decompressZstd(const char* data, size_t length, size_t max_length, string *out_str) {
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+
+    if (dctx == nullptr) {
+        return Status::ERROR;
+    }
+
+    vector<char> out_buf(ZSTD_DStreamOutSize());
+    ZSTD_inBuffer in_buf = {data, length, 0};
+    size_t res = 0;
+
+    //flushing is done once input is consumed and decoder doesnt fill whole output buffer
+    bool output_flushed = false;
+
+    while (in_buf.pos < in_buf.size || !output_flushed) {
+        ZSTD_outBuffer zstd_out_buf = {out_buf.data(), out_buf.size(), 0};
+
+        res = ZSTD_decompressStream(dctx, &zstd_out_buf, &in_buf);
+
+        if (ZSTD_isError(res)) {
+            syslog(LOG_ERR, "zstd decompression failed: %s", ZSTD_getErrorName(res));
+            ZSTD_freeDCtx(dctx);
+
+            return Status::ERROR;
+        }
+
+        out_str->append(out_buf.data(), zstd_out_buf.pos);
+
+        if (out_str->size() > max_length) {
+            syslog(LOG_ERR, "decompressed note is too large, max is %lu", max_length);
+            ZSTD_freeDCtx(dctx);
+
+            return Status::ERROR;
+        }
+
+        output_flushed = zstd_out_buf.pos < zstd_out_buf.size;
+    }
+
+    ZSTD_freeDCtx(dctx);
+
+    //0 means last frame is complete
+    return res == 0 ? Status::OK : Status::ERROR;
+}
+#endif
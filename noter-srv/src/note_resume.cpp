@@ -0,0 +1,192 @@
+#include "note_resume.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <syslog.h>
+#include <sys/file.h>
+#include <zlib.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+#include "noter_utils.hpp"
+#include "note_protocol.hpp"
+
+using namespace std;
+
+extern const size_t MAX_OUT_FILE_SIZE;
+
+const string CHUNK_LOG_SUFFIX = ".chunks";
+
+
+int parseResumeNoteInfo(const string& payload, size_t *payload_offset, ResumeNoteInfo *note_info) {
+    size_t info_offset = *payload_offset;
+    uint32_t note_size_network_byteorder;
+
+    if (payload.size() < info_offset + NOTE_PROTOCOL_FRAME_NAME_LENGTH + sizeof(note_size_network_byteorder) + 2) {
+        return Status::ERROR;
+    }
+
+    note_info->note_name = payload.substr(info_offset, NOTE_PROTOCOL_FRAME_NAME_LENGTH);
+    info_offset += NOTE_PROTOCOL_FRAME_NAME_LENGTH;
+
+    memcpy(&note_size_network_byteorder, payload.data() + info_offset, sizeof(note_size_network_byteorder));
+    note_info->note_size = ntohl(note_size_network_byteorder);
+    info_offset += sizeof(note_size_network_byteorder);
+
+    note_info->checksum_algorithm = static_cast<ChecksumAlgorithm>(static_cast<uint8_t>(payload[info_offset]));
+    size_t checksum_length = static_cast<uint8_t>(payload[info_offset + 1]);
+    info_offset += 2;
+
+    //name ends up in file path
+    if (payload.size() < info_offset + checksum_length || note_info->note_size == 0 
+            || note_info->note_size > MAX_OUT_FILE_SIZE || note_info->note_name.find('/') != string::npos
+            || note_info->note_name[0] == NOTE_PROTOCOL_CONTROL_FRAME_PREFIX) {
+        return Status::ERROR;
+    }
+
+    note_info->checksum_str = payload.substr(info_offset, checksum_length);
+    *payload_offset = info_offset + checksum_length;
+
+    return Status::OK;
+}
+
+ChunkLog::ChunkLog(const string& tmp_file_path) : tmp_file_path_(tmp_file_path), log_path_(tmp_file_path + CHUNK_LOG_SUFFIX) {
+}
+
+ChunkLog::~ChunkLog() {
+    if (lock_descr_ != -1) {
+        close(lock_descr_);
+    }
+}
+
+bool ChunkLog::lockNote(bool create_note) {
+    if (lock_descr_ == -1) {
+        lock_descr_ = open(tmp_file_path_.c_str(), O_WRONLY | O_CLOEXEC | (create_note ? O_CREAT : 0), 0644);
+    }
+
+    return lock_descr_ != -1 && flock(lock_descr_, LOCK_EX | LOCK_NB) == 0;
+}
+
+string ChunkLog::buildHeader(const ResumeNoteInfo& note_info) {
+    return to_string(note_info.note_size) + " " + to_string(static_cast<int>(note_info.checksum_algorithm)) + " " 
+        + note_info.checksum_str;
+}
+
+int ChunkLog::create(const ResumeNoteInfo& note_info) {
+    header_str_ = buildHeader(note_info);
+    note_size_ = note_info.note_size;
+    chunk_crcs_.clear();
+    received_bytes_ = 0;
+    chunk_crc_ = crc32(0L, Z_NULL, 0);
+    chunk_filled_ = 0;
+
+    log_stream_.open(log_path_, ios::out | ios::trunc | ios::binary);
+    log_stream_ << header_str_ << "\n";
+    log_stream_.flush();
+
+    return log_stream_.good() ? Status::OK : Status::ERROR;
+}
+
+bool ChunkLog::load(const ResumeNoteInfo& note_info) {
+    ifstream log_in_stream(log_path_, ios::in | ios::binary);
+    string log_line;
+
+    if (!log_in_stream.is_open() || !getline(log_in_stream, log_line) || log_line != buildHeader(note_info)) {
+        return false;
+    }
+
+    header_str_ = log_line;
+    note_size_ = note_info.note_size;
+    chunk_crcs_.clear();
+
+    size_t chunks_num = (note_size_ + NOTE_PROTOCOL_RESUME_CHUNK_LENGTH - 1) / NOTE_PROTOCOL_RESUME_CHUNK_LENGTH;
+
+    while (getline(log_in_stream, log_line) && chunk_crcs_.size() < chunks_num) {
+        unsigned int chunk_crc;
+
+        //line cut by crash is the last one
+        if (log_line.size() != 8 || sscanf(log_line.c_str(), "%08x", &chunk_crc) != 1) {
+            break;
+        }
+
+        chunk_crcs_.push_back(chunk_crc);
+    }
+
+    return true;
+}
+
+int ChunkLog::append(const char* data, size_t length) {
+    size_t data_offset = 0;
+
+    while (data_offset < length) {
+        size_t chunk_room = NOTE_PROTOCOL_RESUME_CHUNK_LENGTH - chunk_filled_;
+        size_t bytes_chunk = min(chunk_room, length - data_offset);
+
+        chunk_crc_ = crc32(chunk_crc_, reinterpret_cast<const Bytef*>(data + data_offset), bytes_chunk);
+        chunk_filled_ += bytes_chunk;
+        received_bytes_ += bytes_chunk;
+        data_offset += bytes_chunk;
+
+        //last chunk of note may be shorter
+        if (chunk_filled_ == NOTE_PROTOCOL_RESUME_CHUNK_LENGTH || received_bytes_ == note_size_) {
+            char crc_line[16];
+            snprintf(crc_line, sizeof(crc_line), "%08x\n", static_cast<unsigned int>(chunk_crc_));
+
+            chunk_crcs_.push_back(chunk_crc_);
+            log_stream_ << crc_line;
+
+            chunk_crc_ = crc32(0L, Z_NULL, 0);
+            chunk_filled_ = 0;
+        }
+    }
+
+    log_stream_.flush();
+
+    return log_stream_.good() ? Status::OK : Status::ERROR;
+}
+
+void ChunkLog::setChunkCrc(size_t chunk_idx, uint32_t chunk_crc) {
+    if (chunk_idx >= chunk_crcs_.size()) {
+        chunk_crcs_.resize(chunk_idx + 1, 0);
+    }
+
+    chunk_crcs_[chunk_idx] = chunk_crc;
+}
+
+int ChunkLog::save() {
+    string log_tmp_path = log_path_ + ".tmp";
+    ofstream log_tmp_stream(log_tmp_path, ios::out | ios::trunc | ios::binary);
+
+    log_tmp_stream << header_str_ << "\n";
+
+    for (uint32_t chunk_crc : chunk_crcs_) {
+        char crc_line[16];
+        snprintf(crc_line, sizeof(crc_line), "%08x\n", static_cast<unsigned int>(chunk_crc));
+
+        log_tmp_stream << crc_line;
+    }
+
+    log_tmp_stream.close();
+
+    if (!log_tmp_stream.good()) {
+        deleteFile(log_tmp_path);
+
+        return Status::ERROR;
+    }
+
+    return renameFile(log_tmp_path, log_path_);
+}
+
+void ChunkLog::remove() {
+    if (log_stream_.is_open()) {
+        log_stream_.close();
+    }
+
+    deleteFile(log_path_);
+}
@@ -7,18 +7,26 @@
 #include <arpa/inet.h>
 #include <syslog.h>
 #include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <zlib.h>
 
 #include <iostream>
 #include <csignal>
 #include <ctime>
 #include <memory>
+#include <vector>
 #include <fstream>
 #include <thread>
 #include <atomic>
 
 #include "noter_utils.hpp"
+#include "checksum.hpp"
+#include "note_protocol.hpp"
 #include "net_func.hpp"
 #include "notes_consumer.hpp"
+#include "note_chunks.hpp"
+#include "note_resume.hpp"
 #include "notes_channels.hpp"
 #include "app_config.hpp"
 
@@ -44,12 +52,13 @@ const int SOCKET_QUEUE_LIMIT = 1024;
 //3600 is 1hour
 const int CLIENT_REQUEST_PROCESSING_TIMEOUT_SEC = 3600;
 
-//32 bytes of uuid string + 4 dash separators
-const int TEMP_FILE_NAME_BUFFER_LENGTH = 36;
 //10485760 = 10 meg
 const long TEMP_FILE_CONTENT_BUFFER_LENGTH = 10485760;
 const int MD5_FILE_CONTENT_LENGTH = 32;
 
+//resume and patch payloads are note info and chunk list, way shorter than that
+const size_t MAX_CONTROL_PAYLOAD_LENGTH = 65536;
+
 /* Variables */
 
 atomic<bool> shutdown_requested;
@@ -209,11 +218,19 @@ void processRequest(int sock_descr) {
     time_t processing_start_time_sec = time(0);
     HeapArrayContainer<char> file_content_buf(TEMP_FILE_CONTENT_BUFFER_LENGTH);
 
-    //process all files client sends untill client closes socket. Global timeout just in case
+    //v1 until client says hello
+    uint32_t client_protocol_version = 1;
+
+    //process all files client sends untill client closes socket. Global timeout just in case, kept alive client
+    //then reconnects
     while (time(0) - processing_start_time_sec < CLIENT_REQUEST_PROCESSING_TIMEOUT_SEC) {
-        char file_name[TEMP_FILE_NAME_BUFFER_LENGTH + 1] = {0};
+        char file_name[NOTE_PROTOCOL_FRAME_NAME_LENGTH + 1] = {0};
 
-        int bytes_read = recvAll(sock_descr, file_name, TEMP_FILE_NAME_BUFFER_LENGTH, nullptr);
+        if (waitForClientFrame(sock_descr) != Status::OK) {
+            return;
+        }
+
+        int bytes_read = recvAll(sock_descr, file_name, NOTE_PROTOCOL_FRAME_NAME_LENGTH, nullptr);
 
         if (bytes_read == 0) {
             //client exited
@@ -222,7 +239,7 @@ void processRequest(int sock_descr) {
             return;
         }
 
-        if (bytes_read != TEMP_FILE_NAME_BUFFER_LENGTH) {
+        if (bytes_read != NOTE_PROTOCOL_FRAME_NAME_LENGTH) {
             syslog(LOG_ERR, "failed to read file name: %s", strerror(errno));
             sendProcessedResponse(sock_descr, ProcessingStatus::DATA_TRANSFER_ERROR);
 
@@ -245,19 +262,49 @@ void processRequest(int sock_descr) {
 
         size_t file_size = ntohl(file_size_network_byteorder);
 
+        //patch carries note content, so it is replied to as note
+        if (string(file_name) == NOTE_PROTOCOL_PATCH_FRAME_NAME && client_protocol_version >= 5) {
+            if (receiveNotePatch(sock_descr, file_size, client_protocol_version) != Status::OK) {
+                return;
+            }
+
+            continue;
+        }
+
+        if (file_name[0] == NOTE_PROTOCOL_CONTROL_FRAME_PREFIX) {
+            if (processControlFrame(sock_descr, file_name, file_size, &client_protocol_version) != Status::OK) {
+                return;
+            }
+
+            continue;
+        }
+
         if (file_size <= 0) {
             syslog(LOG_ERR, "got invalid file size for '%s': %li", file_name, file_size);
-            sendProcessedResponse(sock_descr, ProcessingStatus::DATA_TRANSFER_ERROR);
+            sendNoteResponse(sock_descr, client_protocol_version, file_name, ProcessingStatus::DATA_TRANSFER_ERROR);
 
             return;
         }
 
-        char md5_file_content[MD5_FILE_CONTENT_LENGTH + 1] = {0};
+        ChecksumAlgorithm checksum_algorithm;
+        string checksum_str;
 
-        bytes_read = recvAll(sock_descr, md5_file_content, MD5_FILE_CONTENT_LENGTH, nullptr);
-        if (bytes_read != MD5_FILE_CONTENT_LENGTH) {
-            syslog(LOG_ERR, "failed to read md5 file '%s': %s", file_name, strerror(errno));
-            sendProcessedResponse(sock_descr, ProcessingStatus::DATA_TRANSFER_ERROR);
+        if (receiveNoteChecksum(sock_descr, client_protocol_version, &checksum_algorithm, &checksum_str) != Status::OK) {
+            syslog(LOG_ERR, "failed to read checksum of file '%s': %s", file_name, strerror(errno));
+            sendNoteResponse(sock_descr, client_protocol_version, file_name, ProcessingStatus::DATA_TRANSFER_ERROR);
+
+            return;
+        }
+
+        //checksum is calculated as data comes, no need to re-read file after
+        unique_ptr<ChecksumCalculator> checksum_calculator = ChecksumCalculator::create(
+            checksum_algorithm, 
+            static_cast<unsigned>(max(atol(AppConfig::getValue(CONFIG_CHECKSUM_THREADS).c_str()), 0L))
+        );
+
+        if (!checksum_calculator) {
+            syslog(LOG_ERR, "unsupported checksum algorithm %d of file '%s'", static_cast<int>(checksum_algorithm), file_name);
+            sendNoteResponse(sock_descr, client_protocol_version, file_name, ProcessingStatus::DATA_TRANSFER_ERROR);
 
             return;
         }
@@ -268,11 +315,32 @@ void processRequest(int sock_descr) {
 
         string out_file_path_tmp = OUT_FILES_TMP_DIR + OUT_FILE_TMP_PREFIX + string(file_name);
 
+        //large note of v5 client is resumable - temp file is kept along with crc log of its chunks if transfer breaks
+        unique_ptr<ChunkLog> chunk_log;
+
+        if (client_protocol_version >= 5 && file_size >= NOTE_PROTOCOL_RESUME_MIN_NOTE_LENGTH) {
+            ResumeNoteInfo note_info;
+            note_info.note_name = file_name;
+            note_info.note_size = file_size;
+            note_info.checksum_algorithm = checksum_algorithm;
+            note_info.checksum_str = checksum_str;
+
+            chunk_log = make_unique<ChunkLog>(out_file_path_tmp);
+
+            if (!chunk_log->lockNote() || chunk_log->create(note_info) != Status::OK) {
+                syslog(LOG_ERR, "failed to start chunk log of '%s', note may be received by other connection: %s", 
+                    file_name, strerror(errno));
+                sendNoteResponse(sock_descr, client_protocol_version, file_name, ProcessingStatus::SERVER_INTERNAL_ERROR);
+
+                return;
+            }
+        }
+
         ofstream out_file_stream = ofstream(out_file_path_tmp, ios::out | ios::binary);
 
         if (!out_file_stream.is_open() || !out_file_stream.good()) {
             syslog(LOG_ERR, "failed to open temp output file '%s': %s", out_file_path_tmp.c_str(), strerror(errno));
-            sendProcessedResponse(sock_descr, ProcessingStatus::SERVER_INTERNAL_ERROR);
+            sendNoteResponse(sock_descr, client_protocol_version, file_name, ProcessingStatus::SERVER_INTERNAL_ERROR);
 
             return;
         }
@@ -286,20 +354,42 @@ void processRequest(int sock_descr) {
             if (recvAll(sock_descr, file_content_buf.data(), bytes_chunk, nullptr) <= 0) {
                 syslog(LOG_ERR, "error while recieving file chunk for '%s': '%s'", file_name, strerror(errno));
                 out_file_stream.close();
-                deleteFile(out_file_path_tmp);
-                sendProcessedResponse(sock_descr, ProcessingStatus::DATA_TRANSFER_ERROR);
+
+                //client resumes note from the last chunk received whole
+                if (chunk_log) {
+                    syslog(LOG_INFO, "kept %lu chunks of '%s' for resume", 
+                        static_cast<unsigned long>(chunk_log->chunkCrcs().size()), file_name);
+                } else {
+                    deleteFile(out_file_path_tmp);
+                }
+
+                sendNoteResponse(sock_descr, client_protocol_version, file_name, ProcessingStatus::DATA_TRANSFER_ERROR);
 
                 return;
             }
 
+            checksum_calculator->update(file_content_buf.data(), bytes_chunk);
+
             //read file chunk
             out_file_stream.write(file_content_buf.data(), bytes_chunk);
 
+            //chunk is logged once its content is in temp file
+            if (out_file_stream.good() && chunk_log && (!out_file_stream.flush().good() 
+                    || chunk_log->append(file_content_buf.data(), bytes_chunk) != Status::OK)) {
+                syslog(LOG_ERR, "failed to write chunk log of '%s'", out_file_path_tmp.c_str());
+                out_file_stream.setstate(ios::failbit);
+            }
+
             if (!out_file_stream.good()) {
                 syslog(LOG_ERR, "error while writing tmp file '%s': '%s'", out_file_path_tmp.c_str(), strerror(errno));
                 out_file_stream.close();
                 deleteFile(out_file_path_tmp);
-                sendProcessedResponse(sock_descr, ProcessingStatus::SERVER_INTERNAL_ERROR);
+
+                if (chunk_log) {
+                    chunk_log->remove();
+                }
+
+                sendNoteResponse(sock_descr, client_protocol_version, file_name, ProcessingStatus::SERVER_INTERNAL_ERROR);
 
                 return;
             }
@@ -309,46 +399,433 @@ void processRequest(int sock_descr) {
 
         out_file_stream.close();
 
+        ProcessingStatus note_status = ProcessingStatus::SERVER_INTERNAL_ERROR;
+
         if (!out_file_stream.good()) {
             syslog(LOG_ERR, "failed to close temp output file '%s': %s", out_file_path_tmp.c_str(), strerror(errno));
             deleteFile(out_file_path_tmp);
-            sendProcessedResponse(sock_descr, ProcessingStatus::SERVER_INTERNAL_ERROR);
 
+            if (chunk_log) {
+                chunk_log->remove();
+            }
+        } else {
+            note_status = storeReceivedNote(file_name, out_file_path_tmp, checksum_algorithm, checksum_calculator.get(), 
+                checksum_str, chunk_log.get());
+        }
+
+        sendNoteResponse(sock_descr, client_protocol_version, file_name, note_status);
+
+        //whole frame is read, so v4 client that has next notes in flight already goes on over the same connection
+        if (note_status != ProcessingStatus::OK && client_protocol_version < 4) {
             return;
         }
+    }
+}
+
+ProcessingStatus storeReceivedNote(const char* file_name, const string& out_file_path_tmp, 
+        ChecksumAlgorithm checksum_algorithm, ChecksumCalculator* checksum_calculator, const string& checksum_str,
+        ChunkLog* chunk_log) {
+    string file_checksum_str;
+    if (checksum_calculator->hexDigest(&file_checksum_str) != Status::OK) {
+        syslog(LOG_ERR, "failed to calculate file checksum: '%s'", out_file_path_tmp.c_str());
+        deleteFile(out_file_path_tmp);
+
+        if (chunk_log) {
+            chunk_log->remove();
+        }
+
+        return ProcessingStatus::DATA_TRANSFER_ERROR;
+    }
+
+    if (file_checksum_str != checksum_str) {
+        syslog(LOG_ERR, "error: temp file %s doesnt match: '%s'", 
+            ChecksumCalculator::algorithmName(checksum_algorithm), out_file_path_tmp.c_str());
 
-        string file_md5_str;
-        if (calculateFileMD5(out_file_path_tmp, &file_md5_str) != Status::OK) {
-            syslog(LOG_ERR, "failed to calculate file md5: '%s'", out_file_path_tmp.c_str());
+        //client sends again only chunks with crc different from its own
+        if (chunk_log) {
+            syslog(LOG_INFO, "kept '%s' for resume", out_file_path_tmp.c_str());
+        } else {
             deleteFile(out_file_path_tmp);
-            sendProcessedResponse(sock_descr, ProcessingStatus::DATA_TRANSFER_ERROR);
+        }
 
-            return;
+        return ProcessingStatus::DATA_TRANSFER_ERROR;
+    }
+
+    if (chunk_log) {
+        chunk_log->remove();
+    }
+
+    //chunk of large note is put aside till whole note is received
+    bool is_chunk;
+
+    if (processReceivedChunk(out_file_path_tmp, &is_chunk) != Status::OK) {
+        syslog(LOG_ERR, "failed to process note chunk: '%s'", out_file_path_tmp.c_str());
+        deleteFile(out_file_path_tmp);
+
+        return ProcessingStatus::SERVER_INTERNAL_ERROR;
+    }
+
+    if (is_chunk) {
+        syslog(LOG_INFO, "successfully received note chunk %s", file_name);
+
+        return ProcessingStatus::OK;
+    }
+
+    string out_file_path_final = OUT_FILES_TMP_DIR + string(file_name);
+    if (renameFile(out_file_path_tmp, out_file_path_final) != Status::OK) {
+        syslog(LOG_ERR, "failed to rename temp file to final name: '%s'", out_file_path_tmp.c_str());
+        deleteFile(out_file_path_tmp);
+
+        return ProcessingStatus::SERVER_INTERNAL_ERROR;
+    }
+
+    syslog(LOG_INFO, "successfully received file %s", out_file_path_final.c_str());
+
+    return ProcessingStatus::OK;
+}
+
+int waitForClientFrame(int sock_descr) {
+    time_t wait_start_sec = time(0);
+
+    while (time(0) - wait_start_sec < SOCK_TIMEOUT_SEC) {
+        //child inherits blocked termination signals, they stay pending here
+        sigset_t pending_set;
+        sigpending(&pending_set);
+
+        if (sigismember(&pending_set, SIGTERM) || sigismember(&pending_set, SIGINT)) {
+            syslog(LOG_DEBUG, "server is shutting down, closing idle client connection");
+
+            return Status::ERROR;
+        }
+
+        struct pollfd sock_poll = {sock_descr, POLLIN, 0};
+        int poll_res = poll(&sock_poll, 1, 1000);
+
+        if (poll_res > 0) {
+            return Status::OK;
+        }
+
+        if (poll_res == -1 && errno != EINTR) {
+            syslog(LOG_ERR, "failed to wait for client frame: %s", strerror(errno));
+
+            return Status::ERROR;
+        }
+    }
+
+    syslog(LOG_DEBUG, "client connection is idle for %d sec, closing it", SOCK_TIMEOUT_SEC);
+
+    return Status::ERROR;
+}
+
+int processControlFrame(int sock_descr, const char* frame_name, size_t frame_size, uint32_t *client_protocol_version) {
+    string frame_name_str(frame_name);
+
+    //idle client keeps connection open, nothing else to do
+    if (frame_name_str == NOTE_PROTOCOL_PING_FRAME_NAME && frame_size == 0 && *client_protocol_version >= 3) {
+        syslog(LOG_DEBUG, "got ping from client");
+
+        return sendProcessedResponse(sock_descr, ProcessingStatus::OK);
+    }
+
+    if (frame_name_str == NOTE_PROTOCOL_RESUME_FRAME_NAME && *client_protocol_version >= 5) {
+        return processResumeFrame(sock_descr, frame_size);
+    }
+
+    if (!startsWith(frame_name_str, NOTE_PROTOCOL_HELLO_FRAME_NAME) || frame_size != 0) {
+        syslog(LOG_ERR, "got unknown control frame '%s'", frame_name);
+        sendProcessedResponse(sock_descr, ProcessingStatus::GENERIC_ERROR);
+
+        return Status::ERROR;
+    }
+
+    long requested_version = atol(frame_name + NOTE_PROTOCOL_HELLO_FRAME_NAME.size());
+    *client_protocol_version = static_cast<uint32_t>(max(1L, min(static_cast<long>(NOTE_PROTOCOL_VERSION), requested_version)));
+
+    //status, then server protocol version and supported checksum algorithms
+    uint32_t hello_resp[3];
+    hello_resp[0] = static_cast<uint32_t>(ProcessingStatus::OK);
+    hello_resp[1] = htonl(NOTE_PROTOCOL_VERSION);
+    hello_resp[2] = htonl(ChecksumCalculator::supportedAlgorithms());
+
+    if (sendAll(sock_descr, reinterpret_cast<char*>(hello_resp), sizeof(hello_resp)) != Status::OK) {
+        syslog(LOG_ERR, "failed to send hello response: %s", strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    syslog(LOG_DEBUG, "client speaks protocol v%u", *client_protocol_version);
+
+    return Status::OK;
+}
+
+int receiveControlPayload(int sock_descr, size_t frame_size, string *payload) {
+    if (frame_size > MAX_CONTROL_PAYLOAD_LENGTH) {
+        errno = EMSGSIZE;
+
+        return Status::ERROR;
+    }
+
+    payload->resize(frame_size);
+
+    if (frame_size > 0 && recvAll(sock_descr, payload->data(), frame_size, nullptr) != static_cast<int>(frame_size)) {
+        return Status::ERROR;
+    }
+
+    return Status::OK;
+}
+
+int processResumeFrame(int sock_descr, size_t frame_size) {
+    string payload;
+    size_t payload_offset = 0;
+    ResumeNoteInfo note_info;
+
+    if (receiveControlPayload(sock_descr, frame_size, &payload) != Status::OK 
+            || parseResumeNoteInfo(payload, &payload_offset, &note_info) != Status::OK) {
+        syslog(LOG_ERR, "got invalid resume frame: %s", strerror(errno));
+        sendProcessedResponse(sock_descr, ProcessingStatus::DATA_TRANSFER_ERROR);
+
+        return Status::ERROR;
+    }
+
+    string out_file_path_tmp = OUT_FILES_TMP_DIR + OUT_FILE_TMP_PREFIX + note_info.note_name;
+    ChunkLog chunk_log(out_file_path_tmp);
+    vector<uint32_t> chunk_crcs;
+
+    //partial of other content under the same name, or one still written by connection client gave up on, 
+    //is not resumed - client sends whole note then
+    if (chunk_log.lockNote(false) && chunk_log.load(note_info)) {
+        //logged chunks are read back - one logged before its content reached disk (or damaged since) is sent again
+        int tmp_descr = open(out_file_path_tmp.c_str(), O_RDONLY | O_CLOEXEC);
+        HeapArrayContainer<char> chunk_buf(NOTE_PROTOCOL_RESUME_CHUNK_LENGTH);
+
+        for (size_t chunk_idx = 0; tmp_descr != -1 && chunk_idx < chunk_log.chunkCrcs().size(); chunk_idx++) {
+            size_t chunk_offset = chunk_idx * NOTE_PROTOCOL_RESUME_CHUNK_LENGTH;
+            size_t chunk_length = min(NOTE_PROTOCOL_RESUME_CHUNK_LENGTH, note_info.note_size - chunk_offset);
+
+            if (preadAll(tmp_descr, chunk_buf.data(), chunk_length, chunk_offset) != Status::OK) {
+                break;
+            }
+
+            chunk_crcs.push_back(crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(chunk_buf.data()), 
+                chunk_length));
+        }
+
+        if (tmp_descr != -1) {
+            close(tmp_descr);
+        }
+    }
+
+    syslog(LOG_DEBUG, "client resumes '%s', %lu chunks are received already", note_info.note_name.c_str(), 
+        static_cast<unsigned long>(chunk_crcs.size()));
+
+    //status, count of chunks and crc of each
+    vector<uint32_t> resume_resp;
+    resume_resp.push_back(static_cast<uint32_t>(ProcessingStatus::OK));
+    resume_resp.push_back(htonl(chunk_crcs.size()));
+
+    for (uint32_t chunk_crc : chunk_crcs) {
+        resume_resp.push_back(htonl(chunk_crc));
+    }
+
+    if (sendAll(sock_descr, reinterpret_cast<char*>(resume_resp.data()), resume_resp.size() * sizeof(uint32_t)) 
+            != Status::OK) {
+        syslog(LOG_ERR, "failed to send resume response: %s", strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    return Status::OK;
+}
+
+int receiveNotePatch(int sock_descr, size_t frame_size, uint32_t client_protocol_version) {
+    string payload;
+    size_t payload_offset = 0;
+    ResumeNoteInfo note_info;
+    uint32_t patch_chunks_network_byteorder = 0;
+
+    if (receiveControlPayload(sock_descr, frame_size, &payload) != Status::OK 
+            || parseResumeNoteInfo(payload, &payload_offset, &note_info) != Status::OK
+            || payload.size() < payload_offset + sizeof(patch_chunks_network_byteorder)) {
+        syslog(LOG_ERR, "got invalid patch frame: %s", strerror(errno));
+        sendProcessedResponse(sock_descr, ProcessingStatus::DATA_TRANSFER_ERROR);
+
+        return Status::ERROR;
+    }
+
+    memcpy(&patch_chunks_network_byteorder, payload.data() + payload_offset, sizeof(patch_chunks_network_byteorder));
+    payload_offset += sizeof(patch_chunks_network_byteorder);
+
+    const char* note_name = note_info.note_name.c_str();
+    size_t note_chunks_num = (note_info.note_size + NOTE_PROTOCOL_RESUME_CHUNK_LENGTH - 1) / NOTE_PROTOCOL_RESUME_CHUNK_LENGTH;
+    size_t patch_chunks_num = ntohl(patch_chunks_network_byteorder);
+    vector<size_t> chunk_idxs;
+
+    if (payload.size() == payload_offset + patch_chunks_num * sizeof(uint32_t)) {
+        for (size_t i = 0; i < patch_chunks_num; i++) {
+            uint32_t chunk_idx_network_byteorder;
+            memcpy(&chunk_idx_network_byteorder, payload.data() + payload_offset + i * sizeof(uint32_t), sizeof(uint32_t));
+
+            size_t chunk_idx = ntohl(chunk_idx_network_byteorder);
+
+            //ascending, so no chunk is written twice
+            if (chunk_idx >= note_chunks_num || (!chunk_idxs.empty() && chunk_idx <= chunk_idxs.back())) {
+                break;
+            }
+
+            chunk_idxs.push_back(chunk_idx);
         }
+    }
+
+    if (chunk_idxs.size() != patch_chunks_num) {
+        syslog(LOG_ERR, "got invalid chunk list in patch of '%s'", note_name);
+        sendNoteResponse(sock_descr, client_protocol_version, note_name, ProcessingStatus::DATA_TRANSFER_ERROR);
+
+        return Status::ERROR;
+    }
+
+    string out_file_path_tmp = OUT_FILES_TMP_DIR + OUT_FILE_TMP_PREFIX + note_info.note_name;
+    ChunkLog chunk_log(out_file_path_tmp);
+
+    //partial may be gone since resume frame (cleaned up or taken by other connection), client sends whole note next time
+    if (!chunk_log.lockNote(false) || !chunk_log.load(note_info)) {
+        syslog(LOG_ERR, "no partial of '%s' to patch", note_name);
+        sendNoteResponse(sock_descr, client_protocol_version, note_name, ProcessingStatus::DATA_TRANSFER_ERROR);
+
+        return Status::ERROR;
+    }
+
+    int tmp_descr = open(out_file_path_tmp.c_str(), O_RDWR | O_CLOEXEC);
+    HeapArrayContainer<char> chunk_buf(NOTE_PROTOCOL_RESUME_CHUNK_LENGTH);
+
+    if (tmp_descr == -1) {
+        syslog(LOG_ERR, "failed to open temp file '%s': %s", out_file_path_tmp.c_str(), strerror(errno));
+        sendNoteResponse(sock_descr, client_protocol_version, note_name, ProcessingStatus::SERVER_INTERNAL_ERROR);
+
+        return Status::ERROR;
+    }
 
-        if (file_md5_str != string(md5_file_content)) {
-            syslog(LOG_ERR, "error: temp file md5 doesnt match: '%s'", out_file_path_tmp.c_str());
+    for (size_t chunk_idx : chunk_idxs) {
+        size_t chunk_offset = chunk_idx * NOTE_PROTOCOL_RESUME_CHUNK_LENGTH;
+        size_t chunk_length = min(NOTE_PROTOCOL_RESUME_CHUNK_LENGTH, note_info.note_size - chunk_offset);
+
+        //chunks received so far are kept for next resume
+        if (recvAll(sock_descr, chunk_buf.data(), chunk_length, nullptr) != static_cast<int>(chunk_length)) {
+            syslog(LOG_ERR, "error while recieving patch chunk for '%s': '%s'", note_name, strerror(errno));
+            close(tmp_descr);
+            chunk_log.save();
+            sendNoteResponse(sock_descr, client_protocol_version, note_name, ProcessingStatus::DATA_TRANSFER_ERROR);
+
+            return Status::ERROR;
+        }
+
+        if (pwriteAll(tmp_descr, chunk_buf.data(), chunk_length, chunk_offset) != Status::OK) {
+            syslog(LOG_ERR, "error while writing tmp file '%s': '%s'", out_file_path_tmp.c_str(), strerror(errno));
+            close(tmp_descr);
             deleteFile(out_file_path_tmp);
-            sendProcessedResponse(sock_descr, ProcessingStatus::DATA_TRANSFER_ERROR);
+            chunk_log.remove();
+            sendNoteResponse(sock_descr, client_protocol_version, note_name, ProcessingStatus::SERVER_INTERNAL_ERROR);
 
-            return;
+            return Status::ERROR;
+        }
+
+        chunk_log.setChunkCrc(chunk_idx, crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(chunk_buf.data()), 
+            chunk_length));
+    }
+
+    //whole frame is read, connection goes on whatever the note status is
+    ProcessingStatus note_status = ProcessingStatus::SERVER_INTERNAL_ERROR;
+    unique_ptr<ChecksumCalculator> checksum_calculator = ChecksumCalculator::create(
+        note_info.checksum_algorithm, 
+        static_cast<unsigned>(max(atol(AppConfig::getValue(CONFIG_CHECKSUM_THREADS).c_str()), 0L))
+    );
+
+    if (ftruncate(tmp_descr, note_info.note_size) != 0 || chunk_log.save() != Status::OK || !checksum_calculator) {
+        syslog(LOG_ERR, "failed to patch temp file '%s': %s", out_file_path_tmp.c_str(), strerror(errno));
+        close(tmp_descr);
+        deleteFile(out_file_path_tmp);
+    } else {
+        //patched note is checked as whole, so chunk with crc collision doesn't get through
+        size_t note_offset = 0;
+
+        while (note_offset < note_info.note_size) {
+            size_t bytes_chunk = min(NOTE_PROTOCOL_RESUME_CHUNK_LENGTH, note_info.note_size - note_offset);
+
+            if (preadAll(tmp_descr, chunk_buf.data(), bytes_chunk, note_offset) != Status::OK) {
+                break;
+            }
+
+            checksum_calculator->update(chunk_buf.data(), bytes_chunk);
+            note_offset += bytes_chunk;
         }
 
-        string out_file_path_final = OUT_FILES_TMP_DIR + string(file_name);
-        if (renameFile(out_file_path_tmp, out_file_path_final) != Status::OK) {
-            syslog(LOG_ERR, "failed to rename temp file to final name: '%s'", out_file_path_tmp.c_str());
+        close(tmp_descr);
+
+        if (note_offset != note_info.note_size) {
+            syslog(LOG_ERR, "failed to read patched temp file '%s': %s", out_file_path_tmp.c_str(), strerror(errno));
             deleteFile(out_file_path_tmp);
-            sendProcessedResponse(sock_descr, ProcessingStatus::SERVER_INTERNAL_ERROR);
+        } else {
+            //partial that still doesn't match is dropped, so client sends whole note next time
+            note_status = storeReceivedNote(note_name, out_file_path_tmp, note_info.checksum_algorithm, 
+                checksum_calculator.get(), note_info.checksum_str, nullptr);
+        }
+    }
 
-            return;
+    chunk_log.remove();
+
+    syslog(LOG_INFO, "patched %lu of %lu chunks of '%s'", static_cast<unsigned long>(chunk_idxs.size()), 
+        static_cast<unsigned long>(note_chunks_num), note_name);
+
+    return sendNoteResponse(sock_descr, client_protocol_version, note_name, note_status);
+}
+
+int receiveNoteChecksum(int sock_descr, uint32_t client_protocol_version, ChecksumAlgorithm *algorithm, 
+        string *checksum_str) {
+    size_t checksum_length = MD5_FILE_CONTENT_LENGTH;
+    *algorithm = ChecksumAlgorithm::MD5;
+
+    if (client_protocol_version >= 2) {
+        unsigned char checksum_info[2];
+
+        if (recvAll(sock_descr, reinterpret_cast<char*>(checksum_info), sizeof(checksum_info), nullptr) 
+                != sizeof(checksum_info)) {
+            return Status::ERROR;
         }
 
-        sendProcessedResponse(sock_descr, ProcessingStatus::OK);
-        syslog(LOG_INFO, "successfully received file %s", out_file_path_final.c_str());
+        *algorithm = static_cast<ChecksumAlgorithm>(checksum_info[0]);
+        checksum_length = checksum_info[1];
     }
+
+    if (checksum_length == 0) {
+        errno = EINVAL;
+
+        return Status::ERROR;
+    }
+
+    checksum_str->resize(checksum_length);
+
+    if (recvAll(sock_descr, checksum_str->data(), checksum_length, nullptr) != static_cast<int>(checksum_length)) {
+        return Status::ERROR;
+    }
+
+    return Status::OK;
 }
 
 int sendProcessedResponse(int s_descr, ProcessingStatus status) {
     int status_code = static_cast<int>(status);
     return sendAll(s_descr, reinterpret_cast<char*>(&status_code), sizeof(status_code));
 }
+
+int sendNoteResponse(int s_descr, uint32_t client_protocol_version, const char* note_name, ProcessingStatus status) {
+    if (client_protocol_version < 4) {
+        return sendProcessedResponse(s_descr, status);
+    }
+
+    //status and name go in single send, client matches them against notes it has in flight
+    char note_resp[sizeof(int) + NOTE_PROTOCOL_FRAME_NAME_LENGTH] = {0};
+    int status_code = static_cast<int>(status);
+
+    memcpy(note_resp, &status_code, sizeof(status_code));
+    strncpy(note_resp + sizeof(status_code), note_name, NOTE_PROTOCOL_FRAME_NAME_LENGTH);
+
+    return sendAll(s_descr, note_resp, sizeof(note_resp));
+}
@@ -1,7 +1,8 @@
 #include "noter_utils.hpp"
 
-#include <openssl/md5.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
 #include <syslog.h>
 
 #include <iostream>
@@ -17,14 +18,19 @@ using namespace std;
 extern const string OUT_FILES_TMP_DIR = "/tmp/noter_srv/";
 extern const string OUT_FILE_TRANSFER_DIR = OUT_FILES_TMP_DIR + "/transfer/";
 extern const string OUT_FILE_ARCHIVED_DIR = OUT_FILES_TMP_DIR + "/archive/";
+extern const string OUT_FILE_CHUNKS_DIR = OUT_FILES_TMP_DIR + "/chunks/";
 extern const string OUT_FILE_TMP_PREFIX = "temp_";
 extern const string OUT_FILE_ARCHIVED_PREFIX = "noter_arch_";
 
 extern const string META_KEY_TIMESTAMP = "ts";
 extern const string META_KEY_OS = "os";
 extern const string META_KEY_CHANNEL = "ch";
+extern const string META_KEY_COMPRESSION = "cz";
+extern const string META_KEY_CHUNK_PARENT = "pt";
+extern const string META_KEY_CHUNK_INDEX = "pi";
+extern const string META_KEY_CHUNK_COUNT = "pn";
+extern const string META_KEY_REFERENCE = "rf";
 
-const int MD5_CALCULATION_FILE_READ_BUFF_SIZE = 1024 * 1000;
 
 bool fileExists(const string file_path) {
     return filesystem::exists(file_path);
@@ -126,53 +132,65 @@ long getFileSize(string file_path) {
     return static_cast<long>(file_stats.st_size);
 }
 
-int calculateFileMD5(const string file_path, std::string *out_str) {
-    ifstream file(file_path, ifstream::binary);
-    if (!file.is_open() || !file.good()) {
-        return Status::ERROR;
-    }
+int preadAll(int fd, char* buf, size_t length, long offset) {
+    while (length > 0) {
+        ssize_t res = pread(fd, buf, length, offset);
+
+        if (res == -1) {
+            //continue if interrupted
+            if (errno == EINTR) {
+                continue;
+            } else {
+                return Status::ERROR;
+            }
+        }
 
-    MD5_CTX md5_context;
-    if (MD5_Init(&md5_context) != 1) {
-        return Status::ERROR;
-    }
-    
-    long file_size;
-    if ((file_size = getFileSize(file_path)) == -1) {
-        return Status::ERROR;
-    }
+        if (res == 0) {
+            //unexpected EOF
+            errno = EIO;
+
+            return Status::ERROR;
+        }
 
-    char buf[MD5_CALCULATION_FILE_READ_BUFF_SIZE];
+        buf += res;
+        offset += res;
+        length -= res;
+    }
 
-    while (file.good()) {
-        file.read(buf, sizeof(buf));
+    return Status::OK;
+}
 
-        int byte_read = file.gcount();
-        MD5_Update(&md5_context, buf, byte_read);
+int pwriteAll(int fd, const char* buf, size_t length, long offset) {
+    while (length > 0) {
+        ssize_t res = pwrite(fd, buf, length, offset);
+
+        if (res == -1) {
+            //continue if interrupted
+            if (errno == EINTR) {
+                continue;
+            } else {
+                return Status::ERROR;
+            }
+        }
 
-        file_size -= byte_read;
+        buf += res;
+        offset += res;
+        length -= res;
     }
 
-    if (file_size != 0) {
-        return Status::ERROR;
-    }
-    
-    unsigned char result_as_numbers[MD5_DIGEST_LENGTH];
-    if (MD5_Final(result_as_numbers, &md5_context) != 1) {
-        return Status::ERROR;
-    }
+    return Status::OK;
+}
 
+string digestToHexString(const unsigned char* digest, size_t length) {
     //convert to hex nums string
-    stringstream md5_string;
-    md5_string << hex << uppercase << setfill('0');
+    stringstream hex_string;
+    hex_string << hex << uppercase << setfill('0');
 
-    for (const unsigned char& byte : result_as_numbers) {
-        md5_string << setw(2) << static_cast<int>(byte);
+    for (size_t i = 0; i < length; i++) {
+        hex_string << setw(2) << static_cast<int>(digest[i]);
     }
 
-    *out_str = md5_string.str();
-
-    return Status::OK;
+    return hex_string.str();
 }
 
 bool startsWith(string str, string pref) {
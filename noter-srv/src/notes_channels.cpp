@@ -10,12 +10,17 @@
 #include "noter_utils.hpp"
 #include "email_sender.hpp"
 #include "db_manager.hpp"
+#include "note_decompressor.hpp"
 
 using namespace std;
 
 extern const string META_KEY_TIMESTAMP;
 extern const string META_KEY_OS;
 extern const string META_KEY_CHANNEL;
+extern const string META_KEY_COMPRESSION;
+extern const string META_KEY_REFERENCE;
+
+extern const size_t MAX_OUT_FILE_SIZE;
 
 extern const string OUT_FILE_TRANSFER_DIR;
 
@@ -42,7 +47,27 @@ int EmailNotesChannel::sendNote(NoteInfo& note_info) {
     }
 
     string subject = "Note from " + timestampToString(stol(note_info.note_metadata[META_KEY_TIMESTAMP]));
-    string text_payload = string(file_body.data());
+    string text_payload;
+
+    //client sends duplicate of recent note as reference to it, without body
+    if (note_info.note_metadata.count(META_KEY_REFERENCE)) {
+        text_payload = "same as note " + note_info.note_metadata[META_KEY_REFERENCE];
+    } else if (note_info.note_metadata.count(META_KEY_COMPRESSION)) {
+        //email needs plain text so compressed note is decompressed here (db stores it as is)
+        if (decompressNoteBody(
+                note_info.note_metadata[META_KEY_COMPRESSION], 
+                file_body.data(), 
+                note_info.file_body_length, 
+                MAX_OUT_FILE_SIZE, 
+                &text_payload
+            ) != Status::OK) {
+            syslog(LOG_ERR, "EmailNotesChannel: failed to decompress file body %s", note_info.file_path.c_str());
+
+            return Status::ERROR;
+        }
+    } else {
+        text_payload = string(file_body.data());
+    }
 
     if (EmailSender::sendEmail(subject, text_payload) != 0) {
         return Status::ERROR;
@@ -15,6 +15,7 @@
 #include "noter_utils.hpp"
 #include "noter_srv.hpp"
 #include "app_config.hpp"
+#include "note_chunks.hpp"
 
 using namespace std;
 
@@ -34,7 +35,7 @@ const int CONSUMER_LOOP_DELAY_SEC = 10;
 const int TEMP_FILE_NAME_LENGTH = 36;
 
 //1048576000 = 1000 mb
-const size_t MAX_OUT_FILE_SIZE = 1048576000L;
+extern const size_t MAX_OUT_FILE_SIZE = 1048576000L;
 const long int MAX_TMP_IDLE_TIME_SEC = 86400L;
 
 const string META_ENTRY_DELIM = ";";
@@ -59,6 +60,8 @@ void watchTempFiles(NotesChannelRegistry& channels_registry) {
             continue;
         }
 
+        deleteDanglingChunks();
+
         time_t curr_time_sec = time(0);
         struct stat file_stats;
 
@@ -100,66 +103,10 @@ void watchTempFiles(NotesChannelRegistry& channels_registry) {
                 continue;
             }
 
-            ifstream temp_file_stream(file_path, ifstream::binary);
-            if (!temp_file_stream.is_open() || !temp_file_stream.good()) {
-                syslog(LOG_ERR, "failed to read file %s", file_path.c_str());
-
-                continue;
-            }
-
-            temp_file_stream.seekg(0, ios::end);
-            int file_length = temp_file_stream.tellg();
-            temp_file_stream.seekg(0, ios::beg);
-
-            if (!temp_file_stream.good()) {
-                syslog(LOG_ERR, "failed to seekg to read file header size %s, %s", file_path.c_str(), strerror(errno));
-
-                continue;
-            }
-
-            //reading exactly 4bytes int from the tail of file
-            temp_file_stream.seekg(file_length - sizeof(int32_t), ios::beg);
-            uint32_t file_header_length_network_byteorder = 0;
-            temp_file_stream.read(
-                reinterpret_cast<char*>(&file_header_length_network_byteorder), 
-                sizeof(file_header_length_network_byteorder)
-            );
-
-            if (!temp_file_stream.good()) {
-                syslog(LOG_ERR, "failed to read file header size %s: %s", file_path.c_str(), strerror(errno));
-
-                continue;
-            }
-
-            uint32_t file_header_length = ntohl(file_header_length_network_byteorder);
-
-            if (file_header_length <= 0) {
-                syslog(LOG_ERR, "got bad file header size %s: %i", file_path.c_str(), file_header_length);
-
-                continue;
-            }
-
-            int file_body_length = file_length - file_header_length - sizeof(int32_t);
-
-            temp_file_stream.seekg(file_body_length, ios::beg);
-
-            HeapArrayContainer<char> header_arr(file_header_length + 1);
-            header_arr.data()[file_header_length] = 0;
-            temp_file_stream.read(header_arr.data(), file_header_length);
-
-            string header_str = string(header_arr.data());
-
-            if (!temp_file_stream.good()) {
-                syslog(LOG_ERR, "failed to read file header %s: %s", file_path.c_str(), strerror(errno));
-
-                continue;
-            }
-
-            temp_file_stream.close();
-
-            if (!temp_file_stream.good()) {
-                syslog(LOG_ERR, "failed to close file %s: %s", file_path.c_str(), strerror(errno));
+            string header_str;
+            size_t file_body_length;
 
+            if (readNoteHeader(file_path, &header_str, &file_body_length) != Status::OK) {
                 continue;
             }
 
@@ -196,6 +143,80 @@ void watchTempFiles(NotesChannelRegistry& channels_registry) {
     }
 }
 
+int readNoteHeader(const string& file_path, string *header_str, size_t *body_length) {
+    ifstream temp_file_stream(file_path, ifstream::binary);
+    if (!temp_file_stream.is_open() || !temp_file_stream.good()) {
+        syslog(LOG_ERR, "failed to read file %s", file_path.c_str());
+
+        return Status::ERROR;
+    }
+
+    temp_file_stream.seekg(0, ios::end);
+    long file_length = temp_file_stream.tellg();
+    temp_file_stream.seekg(0, ios::beg);
+
+    if (!temp_file_stream.good()) {
+        syslog(LOG_ERR, "failed to seekg to read file header size %s, %s", file_path.c_str(), strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    if (file_length < static_cast<long>(sizeof(int32_t))) {
+        syslog(LOG_ERR, "file is too short to have header %s", file_path.c_str());
+
+        return Status::ERROR;
+    }
+
+    //reading exactly 4bytes int from the tail of file
+    temp_file_stream.seekg(file_length - sizeof(int32_t), ios::beg);
+    uint32_t file_header_length_network_byteorder = 0;
+    temp_file_stream.read(
+        reinterpret_cast<char*>(&file_header_length_network_byteorder), 
+        sizeof(file_header_length_network_byteorder)
+    );
+
+    if (!temp_file_stream.good()) {
+        syslog(LOG_ERR, "failed to read file header size %s: %s", file_path.c_str(), strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    uint32_t file_header_length = ntohl(file_header_length_network_byteorder);
+
+    if (file_header_length <= 0 || file_header_length > file_length - sizeof(int32_t)) {
+        syslog(LOG_ERR, "got bad file header size %s: %i", file_path.c_str(), file_header_length);
+
+        return Status::ERROR;
+    }
+
+    long file_body_length = file_length - file_header_length - sizeof(int32_t);
+
+    temp_file_stream.seekg(file_body_length, ios::beg);
+
+    HeapArrayContainer<char> header_arr(file_header_length + 1);
+    header_arr.data()[file_header_length] = 0;
+    temp_file_stream.read(header_arr.data(), file_header_length);
+
+    if (!temp_file_stream.good()) {
+        syslog(LOG_ERR, "failed to read file header %s: %s", file_path.c_str(), strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    temp_file_stream.close();
+
+    if (!temp_file_stream.good()) {
+        syslog(LOG_ERR, "failed to close file %s: %s", file_path.c_str(), strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    *header_str = string(header_arr.data());
+    *body_length = file_body_length;
+
+    return Status::OK;
+}
+
 map<string, string> parseNoteMetadata(string header_str) {
     map<string, string> metadata_map;
     vector<string> meta_entries = split_string_by_delim(header_str, META_ENTRY_DELIM);
@@ -0,0 +1,216 @@
+/**
+ * Throughput benchmark of stdin capture methods.
+ * Pipe input (splice vs read/write): child process pushes generated data into pipe, current process captures 
+ * it into spool-like file.
+ * Regular file input (clone/copy_file_range vs read/write): generated file is captured into spool-like file 
+ * in the same directory.
+ *
+ * usage: capture_bench [size_mb] [runs]
+*/
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "capture_engine.hpp"
+#include "noter_utils.hpp"
+
+using namespace std;
+
+const string BENCH_OUT_FILE_PATH = "/tmp/noter_capture_bench.out";
+const string BENCH_IN_FILE_PATH = "/tmp/noter_capture_bench.in";
+
+//65536 = 64 kb, typical write size of producers like tar
+const size_t PRODUCER_WRITE_LENGTH = 65536;
+
+
+double cpuTimeSec() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+void produce(int out_fd, size_t total_bytes) {
+    vector<char> chunk(PRODUCER_WRITE_LENGTH);
+
+    for (size_t i = 0; i < chunk.size(); i++) {
+        chunk[i] = static_cast<char>('a' + i % 26);
+    }
+
+    while (total_bytes > 0) {
+        size_t length = min(total_bytes, chunk.size());
+
+        if (writeAll(out_fd, chunk.data(), length) != Status::OK) {
+            _exit(EXIT_FAILURE);
+        }
+
+        total_bytes -= length;
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+int runFileCapture(CaptureMethod method, size_t total_bytes, double *wall_sec, double *cpu_sec) {
+    int in_fd = open(BENCH_IN_FILE_PATH.c_str(), O_RDONLY);
+    int out_fd = open(BENCH_OUT_FILE_PATH.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (in_fd == -1 || out_fd == -1) {
+        return Status::ERROR;
+    }
+
+    double cpu_start = cpuTimeSec();
+    auto wall_start = chrono::steady_clock::now();
+
+    CaptureEngine capture_engine(in_fd, out_fd, total_bytes, method);
+    int res = capture_engine.capture();
+
+    *wall_sec = chrono::duration<double>(chrono::steady_clock::now() - wall_start).count();
+    *cpu_sec = cpuTimeSec() - cpu_start;
+
+    close(in_fd);
+    close(out_fd);
+    unlink(BENCH_OUT_FILE_PATH.c_str());
+
+    if (res != Status::OK || capture_engine.bytes_captured() != total_bytes || capture_engine.method_used() != method) {
+        return Status::ERROR;
+    }
+
+    return Status::OK;
+}
+
+int createInputFile(size_t total_bytes) {
+    int in_fd = open(BENCH_IN_FILE_PATH.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (in_fd == -1) {
+        return Status::ERROR;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        produce(in_fd, total_bytes);
+    } else if (pid < 0) {
+        return Status::ERROR;
+    }
+
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    close(in_fd);
+
+    return WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_SUCCESS ? Status::OK : Status::ERROR;
+}
+
+int runPipeCapture(CaptureMethod method, size_t total_bytes, double *wall_sec, double *cpu_sec) {
+    int pipe_fds[2];
+
+    if (pipe(pipe_fds) != 0) {
+        return Status::ERROR;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        close(pipe_fds[0]);
+        produce(pipe_fds[1], total_bytes);
+    } else if (pid < 0) {
+        return Status::ERROR;
+    }
+
+    close(pipe_fds[1]);
+
+    int out_fd = open(BENCH_OUT_FILE_PATH.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (out_fd == -1) {
+        return Status::ERROR;
+    }
+
+    double cpu_start = cpuTimeSec();
+    auto wall_start = chrono::steady_clock::now();
+
+    CaptureEngine capture_engine(pipe_fds[0], out_fd, total_bytes, method);
+    int res = capture_engine.capture();
+
+    *wall_sec = chrono::duration<double>(chrono::steady_clock::now() - wall_start).count();
+    *cpu_sec = cpuTimeSec() - cpu_start;
+
+    close(pipe_fds[0]);
+    close(out_fd);
+    waitpid(pid, nullptr, 0);
+    unlink(BENCH_OUT_FILE_PATH.c_str());
+
+    if (res != Status::OK || capture_engine.bytes_captured() != total_bytes || capture_engine.method_used() != method) {
+        return Status::ERROR;
+    }
+
+    return Status::OK;
+}
+
+int benchMethod(int (*run_capture)(CaptureMethod, size_t, double*, double*), CaptureMethod method, 
+        size_t size_mb, int runs) {
+    double best_wall_sec = 0;
+    double best_cpu_sec = 0;
+
+    for (int i = 0; i < runs; i++) {
+        double wall_sec, cpu_sec;
+
+        if (run_capture(method, size_mb * 1024 * 1024, &wall_sec, &cpu_sec) != Status::OK) {
+            cout << CaptureEngine::methodName(method) << ": failed: " << strerror(errno) << endl;
+
+            return Status::ERROR;
+        }
+
+        if (i == 0 || wall_sec < best_wall_sec) {
+            best_wall_sec = wall_sec;
+            best_cpu_sec = cpu_sec;
+        }
+    }
+
+    cout << setw(12) << left << CaptureEngine::methodName(method)
+        << fixed << setprecision(1) << setw(10) << right << size_mb / best_wall_sec << " MB/s"
+        << setprecision(3) << setw(10) << best_cpu_sec << " s cpu" << endl;
+
+    return Status::OK;
+}
+
+int main(int argc, char* argv[]) {
+    size_t size_mb = argc > 1 ? stoul(argv[1]) : 512;
+    int runs = argc > 2 ? stoi(argv[2]) : 3;
+    size_t total_bytes = size_mb * 1024 * 1024;
+
+    cout << "capturing " << size_mb << " MB from pipe, best of " << runs << " runs" << endl;
+
+    for (CaptureMethod method : {CaptureMethod::READ_WRITE, CaptureMethod::SPLICE}) {
+        if (benchMethod(runPipeCapture, method, size_mb, runs) != Status::OK) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (createInputFile(total_bytes) != Status::OK) {
+        cout << "failed to create input file: " << strerror(errno) << endl;
+
+        return EXIT_FAILURE;
+    }
+
+    cout << "capturing " << size_mb << " MB from regular file, best of " << runs << " runs" << endl;
+
+    for (CaptureMethod method : {CaptureMethod::READ_WRITE, CaptureMethod::CLONE}) {
+        if (benchMethod(runFileCapture, method, size_mb, runs) != Status::OK) {
+            unlink(BENCH_IN_FILE_PATH.c_str());
+
+            return EXIT_FAILURE;
+        }
+    }
+
+    unlink(BENCH_IN_FILE_PATH.c_str());
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+/**
+ * Throughput benchmark of note checksum algorithms built into this binary (md5 always, xxh3 and blake3 when
+ * their libs are installed) and their tree variants. Every input size is hashed in the same chunks noter and 
+ * noter-srv use, data comes from buffer of at most 64 MB that is reused for bigger inputs.
+ * Tree variants use all cores unless CHECKSUM_THREADS env variable is set.
+ *
+ * usage: checksum_bench [input_mb...]
+*/
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+#include "noter_utils.hpp"
+#include "checksum.hpp"
+
+using namespace std;
+
+//1048576 = 1 mb
+const size_t MB = 1048576;
+//same as capture buffer of noter and receive buffer of noter-srv
+const size_t CHUNK_LENGTH = 10 * MB;
+const size_t MAX_DATA_BUFFER_LENGTH = 64 * MB;
+
+const vector<size_t> DEFAULT_INPUT_MBS = {1, 16, 256, 1024};
+
+
+//best of few runs for small inputs, single run for big ones
+double measureChecksum(ChecksumCalculator* calculator, const char* data, size_t data_length, size_t input_length) {
+    int runs = input_length >= 256 * MB ? 1 : 5;
+    double best_sec = 0;
+
+    for (int i = 0; i < runs; i++) {
+        calculator->reset();
+
+        auto start = chrono::steady_clock::now();
+
+        for (size_t offset = 0; offset < input_length;) {
+            size_t chunk_length = min(CHUNK_LENGTH, input_length - offset);
+            size_t data_offset = offset % data_length;
+
+            calculator->update(data + data_offset, min(chunk_length, data_length - data_offset));
+
+            offset += min(chunk_length, data_length - data_offset);
+        }
+
+        string hex;
+        calculator->hexDigest(&hex);
+
+        double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        best_sec = i == 0 ? sec : min(best_sec, sec);
+    }
+
+    return best_sec;
+}
+
+int main(int argc, char* argv[]) {
+    vector<size_t> input_mbs;
+
+    for (int i = 1; i < argc; i++) {
+        input_mbs.push_back(stoul(argv[i]));
+    }
+
+    if (input_mbs.empty()) {
+        input_mbs = DEFAULT_INPUT_MBS;
+    }
+
+    size_t data_length = min(*max_element(input_mbs.begin(), input_mbs.end()) * MB, MAX_DATA_BUFFER_LENGTH);
+    HeapArrayContainer<char> data_container(data_length);
+    char* data = data_container.data();
+
+    //not compressible, not all zeros
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+    for (size_t i = 0; i < data_length; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        data[i] = static_cast<char>(state);
+    }
+
+    cout << left << setw(12) << "algorithm";
+
+    for (size_t input_mb : input_mbs) {
+        cout << right << setw(14) << (to_string(input_mb) + " MB");
+    }
+
+    cout << "   (MB/s)" << endl;
+
+    unsigned threads_num = getenv("CHECKSUM_THREADS") != nullptr ? stoul(getenv("CHECKSUM_THREADS")) : 0;
+
+    for (ChecksumAlgorithm algorithm : {ChecksumAlgorithm::MD5, ChecksumAlgorithm::XXH3, ChecksumAlgorithm::BLAKE3, 
+            ChecksumAlgorithm::MD5_TREE, ChecksumAlgorithm::XXH3_TREE, ChecksumAlgorithm::BLAKE3_TREE}) {
+        unique_ptr<ChecksumCalculator> calculator = ChecksumCalculator::create(algorithm, threads_num);
+
+        cout << left << setw(12) << ChecksumCalculator::algorithmName(algorithm);
+
+        if (!calculator) {
+            cout << right << setw(14) << "not built in" << endl;
+
+            continue;
+        }
+
+        for (size_t input_mb : input_mbs) {
+            double sec = measureChecksum(calculator.get(), data, data_length, input_mb * MB);
+
+            cout << right << setw(14) << fixed << setprecision(0) << input_mb / sec;
+        }
+
+        cout << endl;
+    }
+
+    cout << "default: " << ChecksumCalculator::algorithmName(ChecksumCalculator::defaultAlgorithm()) << endl;
+
+    return EXIT_SUCCESS;
+}
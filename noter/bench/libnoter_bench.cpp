@@ -0,0 +1,122 @@
+/**
+ * Per note latency of libnoter noter_send() compared with popen() of noter binary, which is how services
+ * used to emit notes. Both write the same note (10 bytes by default) given number of times.
+ * Notes created by benchmark are removed from spool dir after every run, so noterd better be stopped.
+ *
+ * usage: libnoter_bench [noter_path] [runs] [note_bytes]
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+
+#include "libnoter.h"
+
+using namespace std;
+
+const string SPOOL_DIR_PATH = "/tmp/noter/";
+
+const size_t DEFAULT_NOTE_LENGTH = 10;
+
+
+set<string> listSpoolDir() {
+    set<string> file_names;
+
+    DIR* dir = opendir(SPOOL_DIR_PATH.c_str());
+
+    if (dir == nullptr) {
+        return file_names;
+    }
+
+    while (struct dirent* entry = readdir(dir)) {
+        file_names.insert(entry->d_name);
+    }
+
+    closedir(dir);
+
+    return file_names;
+}
+
+void removeNewNotes(const set<string>& old_file_names) {
+    for (const string& file_name : listSpoolDir()) {
+        if (!old_file_names.count(file_name)) {
+            unlink((SPOOL_DIR_PATH + file_name).c_str());
+        }
+    }
+}
+
+bool sendWithLibnoter(const string& note) {
+    return noter_send(note.c_str(), note.size(), "app:libnoter_bench") == 0;
+}
+
+bool sendWithPopen(const string& noter_path, const string& note) {
+    FILE* noter_pipe = popen((noter_path + " > /dev/null").c_str(), "w");
+
+    if (noter_pipe == nullptr) {
+        return false;
+    }
+
+    bool written = fwrite(note.c_str(), 1, note.size(), noter_pipe) == note.size();
+
+    return pclose(noter_pipe) == 0 && written;
+}
+
+void printLatency(const string& title, vector<double>& wall_secs) {
+    sort(wall_secs.begin(), wall_secs.end());
+
+    cout << left << setw(10) << title << fixed << setprecision(1)
+        << "us per note: min " << wall_secs.front() * 1000000
+        << ", median " << wall_secs[wall_secs.size() / 2] * 1000000
+        << ", p90 " << wall_secs[wall_secs.size() * 9 / 10] * 1000000 << endl;
+}
+
+int main(int argc, char* argv[]) {
+    string noter_path = argc > 1 ? argv[1] : "./noter";
+    int runs = argc > 2 ? max(stoi(argv[2]), 1) : 200;
+    size_t note_length = argc > 3 ? stoul(argv[3]) : DEFAULT_NOTE_LENGTH;
+
+    string note(note_length, 'n');
+
+    set<string> old_file_names = listSpoolDir();
+    vector<double> libnoter_secs;
+    vector<double> popen_secs;
+
+    for (int i = 0; i < runs; i++) {
+        auto libnoter_start = chrono::steady_clock::now();
+
+        if (!sendWithLibnoter(note)) {
+            cout << "noter_send failed" << endl;
+
+            return EXIT_FAILURE;
+        }
+
+        libnoter_secs.push_back(chrono::duration<double>(chrono::steady_clock::now() - libnoter_start).count());
+
+        auto popen_start = chrono::steady_clock::now();
+
+        if (!sendWithPopen(noter_path, note)) {
+            cout << "noter failed" << endl;
+
+            return EXIT_FAILURE;
+        }
+
+        popen_secs.push_back(chrono::duration<double>(chrono::steady_clock::now() - popen_start).count());
+
+        removeNewNotes(old_file_names);
+    }
+
+    cout << note_length << " bytes note, " << runs << " runs" << endl;
+
+    printLatency("libnoter", libnoter_secs);
+    printLatency("popen", popen_secs);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,238 @@
+/**
+ * Startup latency benchmark of noter binary for tiny notes (like 'echo x | noter'), where whole run
+ * is dominated by startup work rather than by data capture.
+ * noter is run given number of times with note (10 bytes by default) piped to its stdin, wall time of every
+ * run is measured from fork() till exit. One extra run is traced with ptrace to count syscalls made by noter.
+ * Running it with growing note size shows where capture cost starts to outweigh startup cost.
+ * Notes created by benchmark are removed from spool dir after every run, so noterd better be stopped.
+ *
+ * usage: startup_bench [noter_path] [runs] [note_bytes]
+*/
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/ptrace.h>
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+
+#include "noter_utils.hpp"
+
+using namespace std;
+
+const string SPOOL_DIR_PATH = "/tmp/noter/";
+
+const size_t DEFAULT_NOTE_LENGTH = 10;
+
+
+set<string> listSpoolDir() {
+    set<string> file_names;
+
+    DIR* dir = opendir(SPOOL_DIR_PATH.c_str());
+
+    if (dir == nullptr) {
+        return file_names;
+    }
+
+    while (struct dirent* entry = readdir(dir)) {
+        file_names.insert(entry->d_name);
+    }
+
+    closedir(dir);
+
+    return file_names;
+}
+
+void removeNewNotes(const set<string>& old_file_names) {
+    for (const string& file_name : listSpoolDir()) {
+        if (!old_file_names.count(file_name)) {
+            unlink((SPOOL_DIR_PATH + file_name).c_str());
+        }
+    }
+}
+
+//starts noter with note coming to its stdin pipe, child is stopped right before exec if traced
+pid_t spawnNoter(const string& noter_path, size_t note_length, bool traced) {
+    int pipe_fds[2];
+
+    if (pipe(pipe_fds) != 0) {
+        return -1;
+    }
+
+    //note may not fit pipe, so it is written by separate process while noter reads it
+    pid_t producer_pid = fork();
+
+    if (producer_pid == 0) {
+        close(pipe_fds[0]);
+
+        string note(note_length, 'n');
+        _exit(writeAll(pipe_fds[1], note.c_str(), note.size()) == Status::OK ? EXIT_SUCCESS : EXIT_FAILURE);
+    } else if (producer_pid < 0) {
+        return -1;
+    }
+
+    close(pipe_fds[1]);
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+
+        dup2(pipe_fds[0], STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+
+        if (traced) {
+            ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+            raise(SIGSTOP);
+        }
+
+        execl(noter_path.c_str(), noter_path.c_str(), nullptr);
+        _exit(EXIT_FAILURE);
+    }
+
+    close(pipe_fds[0]);
+
+    return pid;
+}
+
+int runNoter(const string& noter_path, size_t note_length, double *wall_sec) {
+    auto wall_start = chrono::steady_clock::now();
+
+    pid_t pid = spawnNoter(noter_path, note_length, false);
+
+    if (pid < 0) {
+        return Status::ERROR;
+    }
+
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+
+    *wall_sec = chrono::duration<double>(chrono::steady_clock::now() - wall_start).count();
+
+    return WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_SUCCESS ? Status::OK : Status::ERROR;
+}
+
+//counts syscalls made by noter after exec (including execve itself)
+int countNoterSyscalls(const string& noter_path, size_t note_length, long *syscalls_num) {
+    pid_t pid = spawnNoter(noter_path, note_length, true);
+
+    if (pid < 0) {
+        return Status::ERROR;
+    }
+
+    int wstatus;
+
+    //child stopped itself before exec
+    if (waitpid(pid, &wstatus, 0) != pid || !WIFSTOPPED(wstatus)) {
+        return Status::ERROR;
+    }
+
+    if (ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL) != 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+
+        return Status::ERROR;
+    }
+
+    //bench code still runs in child till exec, its syscalls are not counted
+    bool exec_seen = false;
+    bool in_syscall = false;
+    int pending_signal = 0;
+
+    *syscalls_num = 0;
+
+    while (true) {
+        if (ptrace(PTRACE_SYSCALL, pid, nullptr, pending_signal) != 0) {
+            return Status::ERROR;
+        }
+
+        pending_signal = 0;
+
+        if (waitpid(pid, &wstatus, 0) != pid) {
+            return Status::ERROR;
+        }
+
+        if (WIFEXITED(wstatus) || WIFSIGNALED(wstatus)) {
+            return WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_SUCCESS ? Status::OK : Status::ERROR;
+        }
+
+        if (wstatus >> 8 == (SIGTRAP | (PTRACE_EVENT_EXEC << 8))) {
+            //reported in the middle of execve(), its exit stop comes next
+            exec_seen = true;
+            in_syscall = true;
+            (*syscalls_num)++;
+        } else if (WSTOPSIG(wstatus) == (SIGTRAP | 0x80)) {
+            //every syscall stops tracee twice - on entry and on exit
+            if (exec_seen) {
+                in_syscall = !in_syscall;
+
+                if (in_syscall) {
+                    (*syscalls_num)++;
+                }
+            }
+        } else if (WSTOPSIG(wstatus) != SIGTRAP) {
+            pending_signal = WSTOPSIG(wstatus);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    string noter_path = argc > 1 ? argv[1] : "./noter";
+    int runs = argc > 2 ? stoi(argv[2]) : 200;
+    size_t note_length = argc > 3 ? stoul(argv[3]) : DEFAULT_NOTE_LENGTH;
+
+    set<string> old_file_names = listSpoolDir();
+    vector<double> wall_secs;
+
+    for (int i = 0; i < runs; i++) {
+        double wall_sec;
+        int res = runNoter(noter_path, note_length, &wall_sec);
+
+        //producer is done once noter read whole note
+        while (waitpid(-1, nullptr, WNOHANG) > 0);
+
+        removeNewNotes(old_file_names);
+
+        if (res != Status::OK) {
+            cout << "noter failed" << endl;
+
+            return EXIT_FAILURE;
+        }
+
+        wall_secs.push_back(wall_sec);
+    }
+
+    sort(wall_secs.begin(), wall_secs.end());
+
+    cout << "running '" << noter_path << "' with " << note_length << " bytes note, " << runs << " runs" << endl
+        << fixed << setprecision(3)
+        << "wall time ms: min " << wall_secs.front() * 1000
+        << ", median " << wall_secs[wall_secs.size() / 2] * 1000
+        << ", p90 " << wall_secs[wall_secs.size() * 9 / 10] * 1000 << endl;
+
+    long syscalls_num;
+    int res = countNoterSyscalls(noter_path, note_length, &syscalls_num);
+
+    while (waitpid(-1, nullptr, WNOHANG) > 0);
+
+    removeNewNotes(old_file_names);
+
+    if (res != Status::OK) {
+        cout << "syscalls: failed to trace noter (ptrace not permitted?)" << endl;
+
+        return EXIT_SUCCESS;
+    }
+
+    cout << "syscalls: " << syscalls_num << endl;
+
+    return EXIT_SUCCESS;
+}
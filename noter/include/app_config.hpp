@@ -9,6 +9,32 @@ const std::string CONFIG_FILE_PATH = "/etc/noter/config.cfg";
 
 const std::string CONFIG_KEY_CHANNEL = "send_channel";
 const std::string CONFIG_NOTER_SRV_ADDR = "noter_srv_addr";
+const std::string CONFIG_COMPRESSION_CODEC = "compression_codec";
+const std::string CONFIG_COMPRESSION_LEVEL = "compression_level";
+const std::string CONFIG_DEBUG_ECHO_MAX_BYTES = "debug_echo_max_bytes";
+const std::string CONFIG_DEBUG_ECHO_MODE = "debug_echo_mode";
+const std::string CONFIG_SPOOL_CHUNK_BYTES = "spool_chunk_bytes";
+const std::string CONFIG_FOLLOW_NOTE_MAX_BYTES = "follow_note_max_bytes";
+const std::string CONFIG_FOLLOW_NOTE_MAX_SEC = "follow_note_max_sec";
+const std::string CONFIG_DEDUP_WINDOW_SEC = "dedup_window_sec";
+const std::string CONFIG_CHECKSUM_ALGORITHM = "checksum_algorithm";
+const std::string CONFIG_CHECKSUM_THREADS = "checksum_threads";
+const std::string CONFIG_RATE_LIMIT_NOTES_PER_MIN = "rate_limit_notes_per_min";
+const std::string CONFIG_RATE_LIMIT_BURST = "rate_limit_burst";
+const std::string CONFIG_RATE_LIMIT_MODE = "rate_limit_mode";
+const std::string CONFIG_RATE_LIMIT_SAMPLE_EVERY = "rate_limit_sample_every";
+const std::string CONFIG_SPOOL_RING_MAX_NOTE_BYTES = "spool_ring_max_note_bytes";
+const std::string CONFIG_SPOOL_RING_PATH = "spool_ring_path";
+const std::string CONFIG_SPOOL_RING_BYTES = "spool_ring_bytes";
+const std::string CONFIG_SPOOL_RING_GROUP = "spool_ring_group";
+const std::string CONFIG_BACKLOG_COMPRESSION_CODEC = "backlog_compression_codec";
+const std::string CONFIG_BACKLOG_COMPRESSION_LEVEL = "backlog_compression_level";
+const std::string CONFIG_PRESSURE_THROTTLE_PCT = "pressure_throttle_pct";
+const std::string CONFIG_PRESSURE_PAUSE_PCT = "pressure_pause_pct";
+const std::string CONFIG_PRESSURE_MAX_PAUSE_SEC = "pressure_max_pause_sec";
+const std::string CONFIG_SRV_KEEPALIVE_SEC = "srv_keepalive_sec";
+const std::string CONFIG_SRV_PIPELINE_WINDOW = "srv_pipeline_window";
+const std::string CONFIG_UPLOAD_WORKERS = "upload_workers";
 
 class AppConfig {
 public:
@@ -19,6 +45,8 @@ public:
 
     static const std::string getValue(std::string config_key);
 
+    static long getLongValue(std::string config_key, long default_value);
+
 private:
     static std::map<std::string, std::string> readConfigFile();
 
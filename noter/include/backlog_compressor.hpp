@@ -0,0 +1,46 @@
+#ifndef NOTER_BACKLOG_COMPRESSOR
+#define NOTER_BACKLOG_COMPRESSOR
+
+#include <ctime>
+#include <string>
+#include <unordered_set>
+
+/**
+ * Recompresses notes waiting in spool dir while server is unreachable, so long outage doesn't fill the disk
+ * and catch-up upload after it sends less. Uncompressed note is rewritten with slow high level codec (zstd 19
+ * by default) into temp file which then replaces it, codec goes to 'cz' of note header and checksum trailer
+ * is recalculated. Already compressed notes, chunks of big notes and references are left as they are
+*/
+
+enum class RecompressResult {
+    RECOMPRESSED,
+    //note is not eligible or doesn't get smaller
+    SKIPPED,
+    //deadline came before note was done, it is left as it was
+    ABORTED,
+    ERROR
+};
+
+class BacklogCompressor {
+public:
+    explicit BacklogCompressor(const std::string& spool_dir_path) : spool_dir_path_(spool_dir_path) {};
+    ~BacklogCompressor() {};
+
+    BacklogCompressor(const BacklogCompressor& other) = delete;
+    BacklogCompressor& operator= (const BacklogCompressor& other) = delete;
+
+    //recompresses oldest notes first until deadline. Does nothing if off in config
+    void recompressBacklog(std::time_t deadline_sec);
+
+private:
+    std::string spool_dir_path_;
+    std::string codec_name_;
+    int codec_level_ = 0;
+
+    //notes recompressed or skipped already, so they are not read again every round of outage
+    std::unordered_set<std::string> done_note_names_;
+
+    RecompressResult recompressNote(const std::string& note_name, std::time_t deadline_sec);
+};
+
+#endif //NOTER_BACKLOG_COMPRESSOR
@@ -0,0 +1,21 @@
+#ifndef NOTER_BATCH_RUNNER
+#define NOTER_BATCH_RUNNER
+
+#include <string>
+#include <vector>
+
+/**
+ * Creates one note per input file within single noter process, so config, capture buffers and uuid generator 
+ * are set up once instead of per file. Files may be captured by several threads at once
+*/
+
+//reads NUL delimited file paths, e.g. output of find -print0
+int readNulDelimitedPaths(int fd, std::vector<std::string> *paths);
+
+//returns number of files note was not created for
+size_t runBatch(const std::vector<std::string>& file_paths, int jobs_num);
+
+//drops notes being captured by batch workers, incl. chunks of them published already. Called from signal handler
+void abortBatchCaptures();
+
+#endif //NOTER_BATCH_RUNNER
@@ -0,0 +1,114 @@
+#ifndef NOTER_CAPTURE_ENGINE
+#define NOTER_CAPTURE_ENGINE
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <memory>
+#include <functional>
+
+#include "noter_utils.hpp"
+
+enum class CaptureMethod {
+    AUTO,
+    SPLICE,
+    CLONE,
+    READ_WRITE
+};
+
+/**
+ * Moves all data from input descriptor to output file descriptor.
+ * Pipes are spliced straight into output file (no userspace copy), regular files are cloned (FICLONE 
+ * on CoW filesystems) or copied in kernel with copy_file_range, anything else (tty, socket etc.) 
+ * goes through read/write with heap buffer growing with input.
+ * Data observer (if set) is called for every captured chunk - on splice path chunk is read back 
+ * from page cache right after being spliced, so output descriptor must be readable then. On clone path 
+ * chunks are read from input file, unless file observer is set - it then gets ranges of input file to read itself.
+ * Data consumer (if set) gets every chunk instead of output descriptor, e.g. to transform data before 
+ * writing. Always uses read/write then.
+ * With output chunking set, output is split into files of given size - once current output file is full 
+ * and there is more to write, chunk sealer is called to finish it and provide descriptor of the next one
+*/
+class CaptureEngine {
+public:
+    CaptureEngine(int in_fd, int out_fd, size_t max_bytes, CaptureMethod method = CaptureMethod::AUTO)
+        : in_fd_(in_fd), out_fd_(out_fd), max_bytes_(max_bytes), method_(method) {};
+    ~CaptureEngine() {};
+
+    CaptureEngine(const CaptureEngine& other) = delete;
+    CaptureEngine& operator= (const CaptureEngine& other) = delete;
+
+    int capture();
+
+    void setDataObserver(std::function<void(const char*, size_t)> data_observer) { data_observer_ = data_observer; }
+
+    void setFileObserver(std::function<int(int, off_t, size_t)> file_observer) { file_observer_ = file_observer; }
+
+    void setDataConsumer(std::function<int(const char*, size_t)> data_consumer) { data_consumer_ = data_consumer; }
+
+    //external buffer, used if it is big enough for chosen capture method
+    void setDataBuffer(char* buffer, size_t length) {
+        external_buf_ = buffer;
+        external_buf_length_ = length;
+    }
+
+    //chunk_written - bytes already in current output file when capture starts
+    void setOutputChunking(size_t chunk_bytes, size_t chunk_written, std::function<int(int*)> chunk_sealer) {
+        out_chunk_bytes_ = chunk_bytes;
+        out_chunk_written_ = chunk_written;
+        chunk_sealer_ = chunk_sealer;
+    }
+
+    size_t bytes_captured() const { return bytes_captured_; }
+    bool limit_exceeded() const { return limit_exceeded_; }
+    CaptureMethod method_used() const { return method_; }
+
+    static const char* methodName(CaptureMethod method);
+
+    //10485760 = 10 meg, max size of buffer read/write capture grows to
+    static constexpr size_t DATA_BUFFER_LENGTH = 10485760;
+
+private:
+    int in_fd_;
+    int out_fd_;
+    size_t max_bytes_;
+    CaptureMethod method_;
+
+    size_t bytes_captured_ = 0;
+    bool limit_exceeded_ = false;
+
+    std::function<void(const char*, size_t)> data_observer_;
+    std::function<int(int, off_t, size_t)> file_observer_;
+    std::function<int(const char*, size_t)> data_consumer_;
+
+    //0 if output is not chunked
+    size_t out_chunk_bytes_ = 0;
+    size_t out_chunk_written_ = 0;
+    std::function<int(int*)> chunk_sealer_;
+
+    std::unique_ptr<HeapArrayContainer<char>> data_buf_container_;
+    size_t data_buf_length_ = 0;
+    char* external_buf_ = nullptr;
+    size_t external_buf_length_ = 0;
+
+    CaptureMethod detectMethod();
+
+    int captureWithSplice();
+
+    int captureWithClone();
+
+    int copyFileRange(off_t in_offset);
+
+    int observeInputFile(off_t in_offset, size_t length);
+
+    //room left in current output chunk, switches to next chunk if current one is full
+    int nextChunkRoom(size_t *room);
+
+    int captureWithReadWrite();
+
+    int writeDataToOutput(const char* data_buffer, size_t length);
+
+    char* dataBuffer(size_t length);
+};
+
+#endif //NOTER_CAPTURE_ENGINE
@@ -0,0 +1,238 @@
+#ifndef NOTER_CHECKSUM
+#define NOTER_CHECKSUM
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include <sys/types.h>
+
+#include <openssl/md5.h>
+
+#ifdef NOTER_WITH_XXHASH
+    #include <xxhash.h>
+#endif
+
+#ifdef NOTER_WITH_BLAKE3
+    #include <blake3.h>
+#endif
+
+//id is stored in spool file checksum trailer and sent to server along with note. Tree variant of algorithm has 
+//the same id with high bit set
+enum class ChecksumAlgorithm : uint8_t {
+    MD5 = 1,
+    XXH3 = 2,
+    BLAKE3 = 3,
+    MD5_TREE = 0x81,
+    XXH3_TREE = 0x82,
+    BLAKE3_TREE = 0x83
+};
+
+const uint8_t CHECKSUM_TREE_FLAG = 0x80;
+
+/**
+ * Running checksum of data passed in chunks, e.g. while it is being written to file or received from socket.
+ * MD5 is always built in and is the only one older noterd/noter-srv understand. xxHash3 (non-cryptographic, fastest)
+ * and BLAKE3 (cryptographic) are built in when their libs are installed, both pick SIMD implementation at runtime
+*/
+class ChecksumCalculator {
+public:
+    ChecksumCalculator() {};
+    virtual ~ChecksumCalculator() {};
+
+    ChecksumCalculator(const ChecksumCalculator& other) = delete;
+    ChecksumCalculator& operator= (const ChecksumCalculator& other) = delete;
+
+    virtual void update(const char* data, size_t length) = 0;
+
+    //upper case hex of checksum of data passed so far, more data can be passed after
+    virtual int hexDigest(std::string *out_str) = 0;
+
+    //start over, e.g. for next file
+    virtual void reset() = 0;
+
+    virtual ChecksumAlgorithm algorithm() = 0;
+
+    //same as update() with data read from file, for data that never passed through userspace (e.g. cloned file)
+    virtual int updateFromFile(int fd, off_t offset, size_t length);
+
+    //nullptr if algorithm is not built in. Tree variant hashes leaves on up to threads_num threads (0 - all cores)
+    static std::unique_ptr<ChecksumCalculator> create(ChecksumAlgorithm algorithm, unsigned threads_num = 1);
+
+    //bit (1 << algorithm id) is set for every built in algorithm, bit CHECKSUM_TREE_SUPPORTED_BIT - for their 
+    //tree variants
+    static uint32_t supportedAlgorithms();
+
+    static bool isTree(ChecksumAlgorithm algorithm) { 
+        return (static_cast<uint8_t>(algorithm) & CHECKSUM_TREE_FLAG) != 0; 
+    };
+
+    static ChecksumAlgorithm treeBase(ChecksumAlgorithm algorithm) { 
+        return static_cast<ChecksumAlgorithm>(static_cast<uint8_t>(algorithm) & ~CHECKSUM_TREE_FLAG); 
+    };
+
+    //tree variant of fastest built in algorithm
+    static ChecksumAlgorithm defaultAlgorithm();
+
+    //0 for unknown algorithm
+    static size_t hexLength(ChecksumAlgorithm algorithm);
+
+    static const char* algorithmName(ChecksumAlgorithm algorithm);
+
+    //config value: md5, xxh3, blake3 or tree variant - md5-tree, xxh3-tree, blake3-tree
+    static bool parseAlgorithmName(const std::string& name, ChecksumAlgorithm *algorithm);
+
+    static constexpr uint32_t CHECKSUM_TREE_SUPPORTED_BIT = 31;
+};
+
+class Md5ChecksumCalculator : public ChecksumCalculator {
+public:
+    Md5ChecksumCalculator() { reset(); };
+    ~Md5ChecksumCalculator() override {};
+
+    Md5ChecksumCalculator(const Md5ChecksumCalculator& other) = delete;
+    Md5ChecksumCalculator& operator= (const Md5ChecksumCalculator& other) = delete;
+
+    void update(const char* data, size_t length) override;
+
+    int hexDigest(std::string *out_str) override;
+
+    void reset() override;
+
+    ChecksumAlgorithm algorithm() override { return ChecksumAlgorithm::MD5; };
+
+private:
+    MD5_CTX md5_context_;
+    bool valid_;
+};
+
+#ifdef NOTER_WITH_XXHASH
+class Xxh3ChecksumCalculator : public ChecksumCalculator {
+public:
+    Xxh3ChecksumCalculator();
+    ~Xxh3ChecksumCalculator() override;
+
+    Xxh3ChecksumCalculator(const Xxh3ChecksumCalculator& other) = delete;
+    Xxh3ChecksumCalculator& operator= (const Xxh3ChecksumCalculator& other) = delete;
+
+    void update(const char* data, size_t length) override;
+
+    int hexDigest(std::string *out_str) override;
+
+    void reset() override;
+
+    ChecksumAlgorithm algorithm() override { return ChecksumAlgorithm::XXH3; };
+
+private:
+    XXH3_state_t* state_;
+    bool valid_;
+};
+#endif
+
+#ifdef NOTER_WITH_BLAKE3
+class Blake3ChecksumCalculator : public ChecksumCalculator {
+public:
+    Blake3ChecksumCalculator() { reset(); };
+    ~Blake3ChecksumCalculator() override {};
+
+    Blake3ChecksumCalculator(const Blake3ChecksumCalculator& other) = delete;
+    Blake3ChecksumCalculator& operator= (const Blake3ChecksumCalculator& other) = delete;
+
+    void update(const char* data, size_t length) override;
+
+    int hexDigest(std::string *out_str) override;
+
+    void reset() override;
+
+    ChecksumAlgorithm algorithm() override { return ChecksumAlgorithm::BLAKE3; };
+
+private:
+    blake3_hasher hasher_;
+};
+#endif
+
+/**
+ * Tree checksum: data is split into leaves of fixed size, every leaf is hashed with base algorithm on its own, 
+ * root is base algorithm hash of all leaf hashes (hex) in order. Leaves are independent, so they are hashed 
+ * on pool of threads started once the first leaf is full - small notes never start any thread.
+ * Data passed to update() is copied to leaf buffer handed over to pool, file ranges passed to updateFromFile() 
+ * are read by pool threads themselves
+*/
+class TreeChecksumCalculator : public ChecksumCalculator {
+public:
+    TreeChecksumCalculator(ChecksumAlgorithm base_algorithm, unsigned threads_num);
+    ~TreeChecksumCalculator() override;
+
+    TreeChecksumCalculator(const TreeChecksumCalculator& other) = delete;
+    TreeChecksumCalculator& operator= (const TreeChecksumCalculator& other) = delete;
+
+    void update(const char* data, size_t length) override;
+
+    int hexDigest(std::string *out_str) override;
+
+    void reset() override;
+
+    ChecksumAlgorithm algorithm() override { 
+        return static_cast<ChecksumAlgorithm>(static_cast<uint8_t>(base_algorithm_) | CHECKSUM_TREE_FLAG); 
+    };
+
+    int updateFromFile(int fd, off_t offset, size_t length) override;
+
+    //4194304 = 4 meg, part of checksum definition - can't be changed without new algorithm id
+    static constexpr size_t LEAF_LENGTH = 4194304;
+
+private:
+    //leaf data is either in buffer or in file
+    struct LeafJob {
+        size_t leaf_index;
+        char* buffer;
+        int fd;
+        off_t offset;
+    };
+
+    ChecksumAlgorithm base_algorithm_;
+    unsigned threads_num_;
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable jobs_cond_;
+    std::condition_variable done_cond_;
+    std::deque<LeafJob> jobs_;
+    size_t jobs_in_progress_ = 0;
+    bool stop_requested_ = false;
+    bool valid_ = true;
+
+    //hex hash of every full leaf, filled by pool threads
+    std::vector<std::string> leaf_hashes_;
+
+    //leaf being filled by update(), full one goes to pool and is replaced with free buffer
+    char* leaf_buffer_ = nullptr;
+    size_t leaf_length_ = 0;
+    std::vector<char*> free_buffers_;
+    std::vector<char*> all_buffers_;
+
+    //hashed right away if there is no pool
+    std::vector<char> inline_read_buffer_;
+
+    void submitLeaf(LeafJob job);
+
+    //called under lock once leaf is hashed
+    void finishLeaf(const LeafJob& job, int res, const std::string& leaf_hash);
+
+    void waitForLeaves();
+
+    //waits for buffer returned by pool thread, new one is allocated while pool is not full
+    char* takeFreeBuffer();
+
+    void threadLoop();
+
+    int hashLeaf(const LeafJob& job, char* read_buffer, std::string *out_str);
+};
+
+#endif //NOTER_CHECKSUM
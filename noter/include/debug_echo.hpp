@@ -0,0 +1,46 @@
+#ifndef NOTER_DEBUG_ECHO
+#define NOTER_DEBUG_ECHO
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+enum class DebugEchoMode {
+    //tee first max_bytes of input to stdout as chunks arrive
+    HEAD,
+    //keep last max_bytes of input in ring buffer and print them once input is over
+    TAIL
+};
+
+/**
+ * Echoes captured input to stdout (debug builds) using at most max_bytes of memory regardless of input size
+*/
+class DebugEcho {
+public:
+    DebugEcho(size_t max_bytes, DebugEchoMode mode) : max_bytes_(max_bytes), mode_(mode) {};
+    ~DebugEcho() {};
+
+    DebugEcho(const DebugEcho& other) = delete;
+    DebugEcho& operator= (const DebugEcho& other) = delete;
+
+    void consume(const char* data, size_t length);
+
+    void finish();
+
+    static DebugEchoMode parseMode(std::string mode_name) { return mode_name == "tail" ? DebugEchoMode::TAIL : DebugEchoMode::HEAD; }
+
+private:
+    size_t max_bytes_;
+    DebugEchoMode mode_;
+
+    size_t bytes_consumed_ = 0;
+    size_t bytes_echoed_ = 0;
+
+    std::vector<char> ring_;
+    size_t ring_pos_ = 0;
+    bool ring_filled_ = false;
+
+    void consumeToRing(const char* data, size_t length);
+};
+
+#endif //NOTER_DEBUG_ECHO
@@ -5,11 +5,26 @@
 #include <fstream>
 #include <ctime>
 #include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <csignal>
 
+#include "noter_utils.hpp"
+#include "debug_echo.hpp"
+#include "note_compressor.hpp"
+
+//thread safe, unique within process even if called by several threads at the same time
+std::string newNoteUuid();
+
+//random uuid node instead of MAC address lookup, which is the most expensive part of noter startup for tiny notes.
+//Must be called before the first uuid is generated
+void useRandomNoteUuidNode();
 
 class InputDataConsumer {
 public:
-    explicit InputDataConsumer(std::time_t timestamp_sec) : timestamp_sec_(timestamp_sec) {};
+    InputDataConsumer(std::time_t timestamp_sec, int in_fd) : timestamp_sec_(timestamp_sec), in_fd_(in_fd) {};
     ~InputDataConsumer() { cleanup(false); };
     
     InputDataConsumer(const InputDataConsumer& other) = delete;
@@ -17,25 +32,177 @@ public:
 
     int readAndTransferData();
 
+    //publishes separate note every N bytes or T seconds of input till EOF or stop request, e.g. for tail -f output
+    int followAndTransferData();
+
+    //note body is passed by caller in pieces instead of being read from input, e.g. by libnoter within caller's process
+    int openNote();
+
+    int writeNoteData(const char* data, size_t length);
+
+    //publishes note written so far, empty note is dropped
+    int commitNote();
+
+    //overrides channel from config
+    void setChannel(const std::string& channel) { channel_ = channel; }
+
+    //'key:value' entries separated by ';' appended to note header
+    void setExtraMeta(const std::string& extra_meta) { extra_meta_ = extra_meta; }
+
+    //errors are not written to stdout, e.g. when consumer runs within caller's process (libnoter)
+    void setQuiet(bool quiet) { quiet_ = quiet; }
+
+    //safe to call from signal handler
+    void requestStop() { stop_requested_ = 1; }
+
+    //buffer for capture to use instead of allocating its own, e.g. when many notes are captured one by one
+    void setCaptureBuffer(char* buffer, size_t length) {
+        capture_buf_ = buffer;
+        capture_buf_length_ = length;
+    }
+
     void cleanup(bool error);
 
+    //deletes chunks of split note published so far and tells server to drop those it got already.
+    //Uses only buffers prepared when chunk is sealed, so it is safe to call from signal handler
+    void abortChunkedNote();
+
+    //drops note being captured, incl. its published chunks. Note published already is left as is, 
+    //capturing thread publishes nothing more. Safe to call from signal handler
+    void abortNote(bool from_other_thread);
+
     const char* out_file_path_final() const { return out_file_path_final_.c_str(); }
     const char* out_file_path_tmp() const { return out_file_path_tmp_.c_str(); }
-    const char* md5_file_name() const { return md5_file_name_.c_str(); }
 
 private:
     std::time_t timestamp_sec_;
+
+    //stdin or file given with -f
+    int in_fd_;
     
-    std::ofstream out_file_stream_;
+    int out_fd_ = -1;
+
+    //checksum of everything written to out file, updated as data is written
+    std::unique_ptr<ChecksumCalculator> out_file_checksum_;
+
+    std::unique_ptr<DebugEcho> debug_echo_;
+
+    //not set if note is not compressed
+    std::unique_ptr<NoteCompressor> compressor_;
+    bool compression_decided_ = false;
+    NoteCompressor::Sink out_file_sink_;
+
+    volatile std::sig_atomic_t stop_requested_ = 0;
+
+    bool quiet_ = false;
+
+    char* capture_buf_ = nullptr;
+    size_t capture_buf_length_ = 0;
+
+    //empty - channel from config
+    std::string channel_;
+    std::string extra_meta_;
+
+    //body bytes passed to writeNoteData()
+    size_t note_bytes_written_ = 0;
+
+    //notes up to that size go to ring tier of spool instead of file, 0 - ring is not used
+    size_t ring_max_note_bytes_ = 0;
+    //note passed to writeNoteData() is kept in memory while it still fits ring
+    bool ring_staging_ = false;
+    std::string ring_note_body_;
+
+    //set only in follow mode
+    std::string stream_id_;
+    size_t stream_sequence_ = 0;
+
+    //set only when note has the same body as recently published one and is published as reference to it
+    std::string reference_note_uuid_;
+
+    //set only when note is split into chunks
+    std::string note_uuid_;
+    size_t chunk_index_ = 0;
+    //reserved up front, never reallocated while signal handler may read it
+    std::vector<std::string> published_chunk_paths_;
+    //empty last chunk with zero chunks count, published if note can't be completed
+    std::string abort_marker_;
+    std::string abort_marker_path_;
+    std::string abort_marker_tmp_path_;
+    //last chunk (or whole note) is published, there is nothing to abort
+    std::atomic<bool> note_published_{false};
+    std::atomic<bool> publishing_{false};
+    std::atomic<bool> aborted_{false};
+    //0 if note is never split
+    size_t out_chunk_bytes_ = 0;
+    //body bytes in current chunk, used when data is written by consumer itself (compression path)
+    size_t out_chunk_written_ = 0;
 
     std::string out_file_uuid_;
     std::string out_file_path_final_;
+    //only set if spool filesystem does not support anonymous files
     std::string out_file_path_tmp_;
-    std::string md5_file_name_;
 
-    int writeHeaderToOutFile();
+    //stdout, or stream that drops everything if consumer is quiet
+    std::ostream& errorOut();
+
+    int openOutFile();
+
+    //resets checksum and opens out file for next note/chunk under new uuid
+    int openNextOutFile();
+
+    //writes header and checksum, publishes and closes out file
+    int finishOutFile(bool last_chunk);
+
+    //finishes compression, dedups and publishes last out file of note
+    int finishNote();
+
+    void initChunking();
+
+    //out file of note written by writeNoteData(), with compression and chunking set up
+    int openNoteOutFile();
+
+    //true if small notes go to ring
+    bool initRingTier();
+
+    //reads input while it fits ring note, input_complete is set if EOF is reached by then
+    int readSmallInput(std::string *data, bool *input_complete);
+
+    //note with given body goes to ring, or to spool dir as usual if ring is not available or full
+    int publishSmallNote(const std::string& body);
+
+    //note outgrew ring, body kept in memory so far is moved to out file
+    int spillStagedNote();
+
+    int publishFollowNote();
+
+    //drops body of out file if the same body was published recently, note then refers to that one
+    int dedupOutFile(const std::string& body_checksum, long window_sec);
+    //replaces body checksum with dedup index key which covers also channel and extra meta
+    int dedupKey(std::string *body_checksum);
+
+    int publishOutFile();
+
+    //finishes and publishes current out file as note chunk, opens next one
+    int sealOutFileChunk();
+
+    void prepareChunkAbortMarker();
+
+    void initCompressor();
+
+    void initChecksum();
+
+    int consumeForCompression(const char* data, size_t length);
+
+    std::string buildHeader(bool last_chunk);
+
+    int writeHeaderToOutFile(bool last_chunk);
+
+    //writes note body splitting it into chunks if needed
+    int writeBodyToOutFile(const char* data, size_t length);
     
-    int createChecksumFile(std::string out_file_path, std::string md5_file_path);
+    int writeToOutFile(const char* data, size_t length);
+
+    int writeChecksumTrailer();
 };
 
 #endif //NOTER_INPUT_DATA_CONSUMER
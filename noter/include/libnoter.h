@@ -0,0 +1,45 @@
+#ifndef NOTER_LIBNOTER
+#define NOTER_LIBNOTER
+
+#include <stddef.h>
+
+/**
+ * In-process API to create notes, for services that emit many of them. Notes are written straight into spool dir
+ * (same file format as written by noter binary, incl. checksum trailer, compression, chunking and dedup
+ * set up in /etc/noter/config.cfg) and noterd is told about them over local socket if it is listening -
+ * no fork/exec of noter and no pipe copy per note.
+ * Link with libnoter.a and libs noter is built with: -lcrypto -lz -pthread (+ -llz4 -lzstd -lxxhash -lblake3
+ * if built in), C programs need -lstdc++ as well.
+ *
+ * meta - NULL or 'key:value' entries separated by ';', e.g. "ch:email;app:billing". 'ch' sets channel of note
+ * instead of config one, other keys are stored in note meta as is. Keys set by noter itself can't be used.
+ * Every call returns 0 on success and -1 on error with errno set. Different notes may be written from different
+ * threads at once, single note must not be used by several threads at the same time.
+ * Nothing is written to stdout of calling process - errors are reported by return value and errno only.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct noter_note noter_note;
+
+//NULL on error
+noter_note* noter_open(const char* meta);
+
+int noter_write(noter_note* note, const void* data, size_t length);
+
+//publishes note and frees it, note without data is not published. Note is freed on error as well
+int noter_commit(noter_note* note);
+
+//drops note without publishing it
+void noter_abort(noter_note* note);
+
+//whole note at once
+int noter_send(const void* data, size_t length, const char* meta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //NOTER_LIBNOTER
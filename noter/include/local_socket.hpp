@@ -0,0 +1,24 @@
+#ifndef NOTER_LOCAL_SOCKET
+#define NOTER_LOCAL_SOCKET
+
+#include <string>
+#include <vector>
+
+/**
+ * Local unix socket between noter and noterd. Once note is published to spool dir noter sends its name 
+ * to noterd so note is sent right away instead of waiting for next spool dir scan.
+ * Spool dir stays source of truth - if noterd is down note is just picked up by scan later
+*/
+
+//client side. Best effort, fails quietly if daemon is not listening
+int notifyDaemon(const std::string& note_name);
+
+//daemon side
+int openLocalListenSocket();
+
+void closeLocalListenSocket(int listen_sock_descr);
+
+//accepts pending clients (listen socket is non-blocking) up to limit per call, returns names of notes they reported
+int acceptNotifications(int listen_sock_descr, std::vector<std::string> *note_names);
+
+#endif //NOTER_LOCAL_SOCKET
@@ -4,7 +4,11 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 
-int sendAll(int s_descr, const char* buff, size_t length);
+//MSG_MORE in flags holds data back till the rest of frame is sent, so small frame header doesn't go in its own segment
+int sendAll(int s_descr, const char* buff, size_t length, int flags = 0);
+
+//sends file content with sendfile(2), offset is not changed for other users of file_descr
+int sendFileAll(int s_descr, int file_descr, off_t offset, size_t length);
 
 int recvAll(int s_descr, char *buf_ptr, size_t length, time_t *last_data_exchange_timestamp);
 
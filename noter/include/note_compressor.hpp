@@ -0,0 +1,125 @@
+#ifndef NOTER_NOTE_COMPRESSOR
+#define NOTER_NOTE_COMPRESSOR
+
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <functional>
+#include <vector>
+
+#include <zlib.h>
+
+#ifdef NOTER_WITH_LZ4
+    #include <lz4frame.h>
+#endif
+
+#ifdef NOTER_WITH_ZSTD
+    #include <zstd.h>
+#endif
+
+/**
+ * Streaming compressor of note body. Compressed data is passed to sink as soon as codec produces it.
+ * Codec name is recorded in note header so server can decompress body where it is needed
+*/
+class NoteCompressor {
+public:
+    using Sink = std::function<int(const char*, size_t)>;
+
+    NoteCompressor() {};
+    virtual ~NoteCompressor() {};
+
+    NoteCompressor(const NoteCompressor& other) = delete;
+    NoteCompressor& operator= (const NoteCompressor& other) = delete;
+
+    virtual int compress(const char* data, size_t length, const Sink& sink) = 0;
+
+    virtual int finish(const Sink& sink) = 0;
+
+    virtual const std::string codecName() = 0;
+
+    //nullptr for 'none', unknown codec or codec not built in
+    static std::unique_ptr<NoteCompressor> create(std::string codec_name, int level);
+
+    //rough check on sample of input whether it is worth compressing (e.g. already compressed images/archives are not)
+    static bool looksCompressible(const char* sample, size_t length);
+
+    static const int DEFAULT_LEVEL = -1;
+};
+
+class GzipNoteCompressor : public NoteCompressor {
+public:
+    explicit GzipNoteCompressor(int level);
+    ~GzipNoteCompressor() override;
+
+    GzipNoteCompressor(const GzipNoteCompressor& other) = delete;
+    GzipNoteCompressor& operator= (const GzipNoteCompressor& other) = delete;
+
+    int compress(const char* data, size_t length, const Sink& sink) override;
+
+    int finish(const Sink& sink) override;
+
+    const std::string codecName() override { return CODEC_NAME; };
+
+    inline static const std::string CODEC_NAME = "gzip";
+
+private:
+    z_stream z_stream_;
+    bool initialized_;
+    std::vector<char> out_buf_;
+
+    int deflateAndDrain(int flush_mode, const Sink& sink);
+};
+
+#ifdef NOTER_WITH_LZ4
+class Lz4NoteCompressor : public NoteCompressor {
+public:
+    explicit Lz4NoteCompressor(int level);
+    ~Lz4NoteCompressor() override;
+
+    Lz4NoteCompressor(const Lz4NoteCompressor& other) = delete;
+    Lz4NoteCompressor& operator= (const Lz4NoteCompressor& other) = delete;
+
+    int compress(const char* data, size_t length, const Sink& sink) override;
+
+    int finish(const Sink& sink) override;
+
+    const std::string codecName() override { return CODEC_NAME; };
+
+    inline static const std::string CODEC_NAME = "lz4";
+
+private:
+    LZ4F_cctx* cctx_ = nullptr;
+    LZ4F_preferences_t preferences_;
+    bool frame_started_ = false;
+    std::vector<char> out_buf_;
+
+    int beginFrame(const Sink& sink);
+};
+#endif
+
+#ifdef NOTER_WITH_ZSTD
+class ZstdNoteCompressor : public NoteCompressor {
+public:
+    explicit ZstdNoteCompressor(int level);
+    ~ZstdNoteCompressor() override;
+
+    ZstdNoteCompressor(const ZstdNoteCompressor& other) = delete;
+    ZstdNoteCompressor& operator= (const ZstdNoteCompressor& other) = delete;
+
+    int compress(const char* data, size_t length, const Sink& sink) override;
+
+    int finish(const Sink& sink) override;
+
+    const std::string codecName() override { return CODEC_NAME; };
+
+    inline static const std::string CODEC_NAME = "zstd";
+
+private:
+    ZSTD_CCtx* cctx_;
+    std::vector<char> out_buf_;
+
+    int compressAndDrain(ZSTD_inBuffer* in_buf, ZSTD_EndDirective mode, const Sink& sink);
+};
+#endif
+
+#endif //NOTER_NOTE_COMPRESSOR
@@ -0,0 +1,20 @@
+#ifndef NOTER_NOTE_DEDUP
+#define NOTER_NOTE_DEDUP
+
+#include <string>
+
+/**
+ * Small persistent index of recently published notes by checksum of their body, channel and extra meta 
+ * (so note is never referred to from other channel or by note with other caller meta), shared by all noter runs
+ * of the user (file per uid inside spool dir, guarded by flock). Lets note identical to recent one (e.g. output of
+ * monitoring script run every minute) be published as reference to that note instead of full copy.
+ * Best effort - if index can't be used note is just published in full
+*/
+
+//name of note with the same key published less than window_sec seconds ago, empty if there is none
+int findRecentNote(const std::string& note_key, long window_sec, std::string *note_name);
+
+//remembers published note, entries older than window_sec seconds are dropped
+int recordRecentNote(const std::string& note_key, const std::string& note_name, long window_sec);
+
+#endif //NOTER_NOTE_DEDUP
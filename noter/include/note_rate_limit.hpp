@@ -0,0 +1,49 @@
+#ifndef NOTER_NOTE_RATE_LIMIT
+#define NOTER_NOTE_RATE_LIMIT
+
+#include <ctime>
+#include <string>
+
+/**
+ * Token bucket per note source (uid plus calling command or --source tag), shared by all noter runs of the user
+ * (small file per uid inside spool dir, guarded by flock). Keeps runaway script calling noter in a loop from flooding
+ * spool dir and starving notes of everyone else. Best effort - if state can't be used note is let through
+*/
+
+enum class RateLimitMode {
+    //over limit note is not created
+    DROP,
+    //every N-th over limit note is created anyway
+    SAMPLE,
+    //over limit notes are counted and reported by single summary note once source is under limit again
+    SUMMARY
+};
+
+struct RateLimitConfig {
+    double notes_per_min;
+    double burst;
+    RateLimitMode mode;
+    long sample_every;
+};
+
+//over limit notes of source not reported yet
+struct RateLimitSummary {
+    long dropped_num = 0;
+    std::time_t first_dropped_sec = 0;
+    std::time_t last_dropped_sec = 0;
+};
+
+RateLimitMode parseRateLimitMode(const std::string& mode_name);
+
+//'u<uid>:tag:<tag>' or 'u<uid>:cmd:<command line of parent process>' if tag is empty
+std::string noteSourceKey(const std::string& source_tag);
+
+//takes token of source. In summary mode dropped notes are returned once source gets token again
+int takeNoteToken(const std::string& source_key, const RateLimitConfig& config, bool *allowed,
+    RateLimitSummary *summary);
+
+//takes token of note about to be created, with limits from config. Runaway caller is stopped before anything is 
+//written to spool dir. Best effort - note is let through on error
+int applyRateLimit(const std::string& source_tag, bool *note_allowed);
+
+#endif //NOTER_NOTE_RATE_LIMIT
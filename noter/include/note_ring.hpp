@@ -0,0 +1,101 @@
+#ifndef NOTER_NOTE_RING
+#define NOTER_NOTE_RING
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <mutex>
+
+#include <sys/types.h>
+
+/**
+ * Ring tier of spool for small notes: records in single memory-mapped file (in /dev/shm by default, may be put
+ * on persistent filesystem to survive reboot), so small note costs no file create, rename, stat and open.
+ * Record is note name and spool file content (body, header, checksum trailer) guarded by its own crc32.
+ * Any number of writers (noter runs, libnoter threads) append under flock of ring file, single reader (noterd)
+ * reads records in order and releases them once sent. Positions grow forever, offset in data area is
+ * position % capacity. Writer that dies before publishing its record leaves nothing behind.
+ * Only reader creates ring (in dir writable by it only, writers are let in by group) and it never maps it - 
+ * ring shrunk by writer can't bring reader down with SIGBUS, records are read with pread
+*/
+
+struct NoteRingHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t capacity;
+    //written by writers, read by reader
+    uint64_t head;
+    //written by reader, read by writers
+    uint64_t tail;
+};
+
+class NoteRing {
+public:
+    NoteRing() {};
+    ~NoteRing() { closeRing(); };
+
+    NoteRing(const NoteRing& other) = delete;
+    NoteRing& operator= (const NoteRing& other) = delete;
+
+    //writer side. Maps ring file created by reader, fails if there is none (or it is not a ring)
+    int openRing(const std::string& path);
+
+    //reader side. Opens ring file, creates it with given data capacity if there is none (or it is not a ring) 
+    //under fresh name, so ring mapped by writers is never truncated. Writers_gid is group let to write to ring
+    int createRing(const std::string& path, size_t capacity, gid_t writers_gid);
+
+    void closeRing();
+
+    bool isOpen() const { return fd_ != -1; }
+
+    //writer side. Fails with ENOSPC if record doesn't fit free space of ring. Ring put in place anew by reader 
+    //meanwhile (e.g. after /dev/shm cleanup) is mapped again first - old one is never read anymore
+    int append(const std::string& note_name, const char* data, size_t length);
+
+    //reader side, ring is not mapped
+    uint64_t head();
+
+    uint64_t tail();
+
+    //record at position (padding is skipped), next_position is set to position after it.
+    //Fails with EBADMSG for corrupted record, it is skipped by releasing till next_position
+    int readRecord(uint64_t position, std::string *note_name, std::string *data, uint64_t *next_position);
+
+    //records before position are sent, their space is free for writers
+    void release(uint64_t position);
+
+private:
+    std::string path_;
+    int fd_ = -1;
+    //mapped ring file, to find out it is not the one at path_ anymore
+    dev_t dev_ = 0;
+    ino_t ino_ = 0;
+    NoteRingHeader* header_ = nullptr;
+    char* data_ = nullptr;
+    size_t mapped_length_ = 0;
+    uint64_t capacity_ = 0;
+
+    //reader keeps its own tail, it is the only one writing it
+    uint64_t reader_tail_ = 0;
+
+    //flock doesn't exclude threads sharing the same descriptor
+    std::mutex append_mutex_;
+
+    //header of ring file is checked against its size, capacity is set from header
+    bool validRing(uint64_t *capacity);
+
+    int createRingFile(const std::string& path, size_t capacity);
+
+    int reopenIfReplaced();
+
+    //field of header read by reader, till two reads agree as pread is not atomic
+    int readHeaderField(size_t field_offset, uint64_t *value);
+};
+
+//ring set up in config, used by noter/libnoter to write
+int openSpoolRing(NoteRing *ring);
+
+//ring set up in config, created and read by noterd
+int createSpoolRing(NoteRing *ring);
+
+#endif //NOTER_NOTE_RING
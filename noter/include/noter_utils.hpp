@@ -1,13 +1,38 @@
 #ifndef NOTER_NOTER_UTILS
 #define NOTER_NOTER_UTILS
 
+#include <unistd.h>
+
 #include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "checksum.hpp"
 
 enum Status {
     OK = 0,
     ERROR = 1
 };
 
+/**
+ * Checksum of note is stored in trailer at the very end of spool file:
+ * [checksum hex][1 byte checksum hex length][1 byte algorithm id][4 bytes magic].
+ * Trailer is not part of note itself and is never sent to server
+*/
+std::string buildChecksumTrailer(ChecksumAlgorithm algorithm, const std::string& checksum_hex);
+
+//trailer_length is set to 0 if file has no trailer (e.g. note written by older noter with separate .md5 file)
+int readChecksumTrailer(int fd, size_t file_size, ChecksumAlgorithm *algorithm, std::string *checksum_hex, 
+    size_t *trailer_length);
+
+//same for note kept in memory, e.g. in spool ring
+int parseChecksumTrailer(const char* data, size_t length, ChecksumAlgorithm *algorithm, std::string *checksum_hex, 
+    size_t *trailer_length);
+
+//file helpers below report errors to stdout as well as to syslog, off when they run within caller's process (libnoter)
+void setStdoutErrorReports(bool enabled);
+
 bool fileExists(const std::string file_path);
 
 int deleteFile(const std::string out_file_path);
@@ -18,10 +43,28 @@ int createDirectories(const std::string full_path);
 
 long getFileSize(std::string file_path);
 
-int calculateFileMD5(const std::string file_path, std::string *out_str);
+int writeAll(int fd, const char* buf, size_t length);
+
+int preadAll(int fd, char* buf, size_t length, long offset);
+
+//small state file of calling user (e.g. rate limit buckets) in dir shared by all users - '<dir_path><uid>', 0600,
+//held with flock(lock_operation). -1 if it can't be opened or is not owned by the user
+int openUserStateFile(const std::string& dir_path, int lock_operation);
+
+//state file is line per entry, last line cut by writer that died is skipped
+int readStateLines(int fd, std::vector<std::string> *lines);
+
+//content of state file is replaced in place, under the same flock
+int rewriteStateFile(int fd, const std::string& state_str);
+
+std::string digestToHexString(const unsigned char* digest, size_t length);
 
 bool startsWith(std::string str, std::string pref);
 
+//100-ns intervals since 15 October 1582 from version 1 uuid note is named with, i.e. when note was created. 0 if
+//name is not such uuid
+uint64_t noteUuidTimestamp(const std::string& note_name);
+
 
 template<class T>
 class HeapArrayContainer {
@@ -41,4 +84,24 @@ private:
     T* arr_;
 };
 
+/**
+ * Closes owned file descriptor when going out of scope
+*/
+class FileDescriptorGuard {
+public:
+    explicit FileDescriptorGuard(int fd) : fd_(fd) {};
+    ~FileDescriptorGuard() {
+        if (fd_ != -1) {
+            close(fd_);
+        }
+    }
+
+    FileDescriptorGuard(const FileDescriptorGuard& other) = delete;
+    FileDescriptorGuard& operator= (const FileDescriptorGuard& other) = delete;
+
+    int get() const { return fd_; }
+private:
+    int fd_;
+};
+
 #endif //NOTER_NOTER_UTILS
@@ -3,6 +3,12 @@
 
 #include <sys/types.h>
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "checksum.hpp"
+
 enum class ProcessingStatus {
     OK = 100,
     GENERIC_ERROR = 101,
@@ -10,14 +16,128 @@ enum class ProcessingStatus {
     SERVER_INTERNAL_ERROR = 103
 };
 
+enum class SendResult {
+    SENT = 0,
+    //problem with particular file - go on with the next one
+    FILE_ERROR = 1,
+    //connection to server is broken - stop sending until reconnect
+    CONNECTION_ERROR = 2,
+    //note is sent, its status comes later (protocol v4)
+    IN_FLIGHT = 3
+};
+
+//note sent to server that didn't reply with its status yet. Spool file is deleted and ring record is released
+//once status comes
+struct InFlightNote {
+    std::string note_name;
+    std::string note_label;
+    size_t note_size = 0;
+
+    std::string file_path;
+    bool has_md5_file = false;
+
+    bool from_ring = false;
+    //kept till status comes - ring note server didn't take is moved to spool dir
+    std::string note_data;
+    uint64_t ring_next_position = 0;
+};
+
 int initDaemon(pid_t pid);
 
-void doHeartbeat();
+//waits till new notes are reported by noter or inotify, or till timeout
+int waitForNewNotes(int timeout_ms, std::vector<std::string> *note_names, bool *scan_needed);
+
+//full spool dir scan, returns error if some notes are left unsent
+int doHeartbeat();
+
+int processNotifiedNotes(const std::vector<std::string>& note_names);
+
+//sends notes itself or queues spool files for upload workers
+int uploadNotes(std::vector<std::string> file_names);
+
+void startUploadWorkers();
+
+//claims spool files from upload queue and sends them over own connection
+void uploadWorkerLoop();
+
+//sends given spool files and notes of spool ring (unless with_ring is false) in order of creation
+int processNotes(std::vector<std::string> file_names, bool with_ring = true);
+
+SendResult processTempFile(const std::string& file_name, const std::string& file_path);
+
+SendResult processRingNote(const std::string& note_name, const std::string& note_data, uint64_t ring_next_position);
+
+//ring note server didn't take is kept as spool file, to be retried as any other
+int spillRingNote(const std::string& note_name, const std::string& note_data);
+
+//note content (without checksum trailer) is read from file_descr, or taken from note_data if it is set.
+//Sent again over new connection if kept alive one turns out broken
+SendResult sendNote(const std::string& note_name, const std::string& note_label, int file_descr, const char* note_data, 
+    size_t note_size, ChecksumAlgorithm checksum_algorithm, const std::string& checksum_str);
+
+//note frame and status of server
+SendResult transferNote(const std::string& note_name, const std::string& note_label, int file_descr, 
+    const char* note_data, size_t note_size, ChecksumAlgorithm checksum_algorithm, const std::string& checksum_str);
+
+SendResult sendNoteFrame(const std::string& note_name, const std::string& note_label, int file_descr, 
+    const char* note_data, size_t note_size, ChecksumAlgorithm checksum_algorithm, const std::string& checksum_str);
+
+//note content from content_offset, paced by upload throttle
+int sendNoteContent(int file_descr, const char* note_data, size_t content_offset, size_t content_length);
+
+//note uuid, size and checksum - resume and patch frames are about this very note content
+std::string buildResumeNoteInfo(const std::string& note_name, size_t note_size, ChecksumAlgorithm checksum_algorithm, 
+    const std::string& checksum_str);
+
+//control frame name padded to note name length, then payload length
+std::string buildControlFrameHeader(const std::string& frame_name, size_t payload_length);
+
+//v5 server replies with crc of chunks of large note it kept from transfer broken before
+SendResult queryNoteResume(const std::string& note_name, const std::string& note_label, size_t note_size, 
+    ChecksumAlgorithm checksum_algorithm, const std::string& checksum_str, std::vector<uint32_t> *srv_chunk_crcs);
+
+//only chunks server doesn't have or has different are sent, status is then awaited as for note frame
+SendResult sendNotePatch(const std::string& note_name, const std::string& note_label, int file_descr, size_t note_size, 
+    ChecksumAlgorithm checksum_algorithm, const std::string& checksum_str, const std::vector<uint32_t>& srv_chunk_crcs);
+
+//v4 server replies with note name along with status, it must be the note status is awaited for
+SendResult receiveNoteStatus(const std::string& note_name, const std::string& note_label, size_t note_size);
+
+//notes are sent without waiting for status of previous ones (protocol v4)
+bool pipelineAllowed();
+
+//reads statuses of oldest notes in flight till no more than max_in_flight are left. 
+//FILE_ERROR if server didn't take some of them, CONNECTION_ERROR if rest of them can't be known - sending stops
+SendResult receiveInFlightStatuses(size_t max_in_flight);
+
+//deletes sent spool file, releases ring record or moves it to spool dir if server didn't take it
+int finishInFlightNote(const InFlightNote& note, SendResult send_result);
+
+//checksum is taken from note trailer or from separate .md5 file for older notes. note_size is reduced by trailer length
+int readNoteChecksum(int file_descr, const std::string& file_path, size_t *note_size, ChecksumAlgorithm *algorithm, 
+    std::string *checksum_str, bool *has_md5_file);
+
+//for server that doesn't know checksum note was written with
+int convertNoteChecksumToMD5(int file_descr, const char* note_data, const std::string& file_path, size_t note_size, 
+    ChecksumAlgorithm *algorithm, std::string *checksum_str);
 
 void connectSocketLoop();
 
+//reuses kept alive connection unless server closed it
+void ensureConnected();
+
+//called after batch of notes - connection is kept open if server supports ping
+void releaseSocket();
+
+int pingServer();
+
 int connectSocket();
 
+//agrees on protocol version and checksum algorithms with server right after connect
+int negotiateProtocol();
+
+bool srvSupportsChecksum(ChecksumAlgorithm algorithm);
+
 void closeSocket();
 
 void registerSignalHandlers();
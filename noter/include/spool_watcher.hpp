@@ -0,0 +1,22 @@
+#ifndef NOTER_SPOOL_WATCHER
+#define NOTER_SPOOL_WATCHER
+
+#include <string>
+#include <vector>
+
+/**
+ * inotify watch on spool dir. Notes are published complete - linked in from anonymous file (IN_CREATE)
+ * or renamed from temp file (IN_MOVED_TO), IN_CLOSE_WRITE covers notes written in place. Daemon sleeps until 
+ * something is published instead of re-scanning spool dir every few seconds
+*/
+
+//returns inotify descriptor or -1 if watch is not available
+int openSpoolWatch(const std::string& dir_path);
+
+void closeSpoolWatch(int watch_descr);
+
+//reads all pending events, returns names of published notes. 
+//scan_needed is set if kernel event queue overflowed and some events were lost
+int readSpoolEvents(int watch_descr, std::vector<std::string> *note_names, bool *scan_needed);
+
+#endif //NOTER_SPOOL_WATCHER
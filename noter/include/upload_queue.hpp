@@ -0,0 +1,44 @@
+#ifndef NOTER_UPLOAD_QUEUE
+#define NOTER_UPLOAD_QUEUE
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Spool files waiting for upload workers of noterd. Note is claimed from push till release, so it is sent 
+ * by one worker at most even if scan and notifications report it again while it is queued or being sent. 
+ * Worker releases its notes whatever the outcome (sent, rejected, connection timed out), 
+ * notes left in spool dir are queued again by next scan
+*/
+
+class UploadQueue {
+public:
+    UploadQueue() {};
+    ~UploadQueue() {};
+
+    UploadQueue(const UploadQueue& other) = delete;
+    UploadQueue& operator= (const UploadQueue& other) = delete;
+
+    //note queued or being sent already is not added again
+    void push(const std::string& note_name);
+
+    //up to max_notes notes queued first, queue is shared evenly among workers_num workers. 
+    //Waits for notes up to timeout_ms, note_names is empty if none came
+    void claim(std::vector<std::string> *note_names, size_t max_notes, size_t workers_num, int timeout_ms);
+
+    void release(const std::vector<std::string>& note_names);
+
+private:
+    std::mutex mutex_;
+    std::condition_variable queue_cond_;
+    std::deque<std::string> queued_names_;
+    //queued or being sent
+    std::unordered_set<std::string> claimed_names_;
+};
+
+#endif //NOTER_UPLOAD_QUEUE
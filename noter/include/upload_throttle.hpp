@@ -0,0 +1,88 @@
+#ifndef NOTER_UPLOAD_THROTTLE
+#define NOTER_UPLOAD_THROTTLE
+
+#include <ctime>
+#include <cstddef>
+#include <string>
+#include <mutex>
+
+/**
+ * Paces uploads of noterd by Linux pressure stall information (/proc/pressure/{cpu,io,memory}), so draining
+ * big backlog doesn't compete with production workload of the host. Highest 'some avg10' of the three is used:
+ * below throttle threshold notes go at full speed, above it chunks get smaller and are followed by pauses
+ * growing with pressure, above pause threshold no new note is started (for max pause time at most).
+ * Without PSI (older kernel, psi=0) uploads always go at full speed. Shared by upload workers
+*/
+
+enum class ThrottleState {
+    FULL,
+    THROTTLED,
+    PAUSED
+};
+
+struct PressureSample {
+    bool available = false;
+    //share of time some tasks were stalled on resource over last 10 seconds, percent
+    double cpu_some_avg10 = 0.0;
+    double io_some_avg10 = 0.0;
+    double memory_some_avg10 = 0.0;
+
+    double highest() const;
+};
+
+//'some avg10' of /proc/pressure/<resource>, false if it can't be read
+bool readPressure(const std::string& resource, double *some_avg10);
+
+class UploadThrottle {
+public:
+    UploadThrottle() {};
+    ~UploadThrottle() {};
+
+    UploadThrottle(const UploadThrottle& other) = delete;
+    UploadThrottle& operator= (const UploadThrottle& other) = delete;
+
+    //reads thresholds from config
+    void init(const std::string& stats_file_path);
+
+    //called before note is sent. Returns true if it waited, connection to server is likely timed out by then
+    bool waitWhilePaused();
+
+    //length of next chunk of note content
+    size_t chunkLength(size_t max_length);
+
+    //called after chunk is sent, sleeps to bring chunk rate down under pressure
+    void paceChunk(double chunk_elapsed_sec);
+
+    //e.g. backlog recompression is skipped then
+    bool underPressure();
+
+    //re-reads PSI (at most once a second, avg10 doesn't change faster anyway) and updates stats file
+    void samplePressure();
+
+    //current pressure and throttling decisions, 'key=value' lines
+    void writeStats();
+
+private:
+    void writeStatsLocked();
+
+    std::mutex mutex_;
+
+    std::string stats_file_path_;
+    double throttle_pct_ = 0.0;
+    double pause_pct_ = 0.0;
+    long max_pause_sec_ = 0;
+
+    PressureSample sample_;
+    std::time_t sampled_time_sec_ = 0;
+    ThrottleState state_ = ThrottleState::FULL;
+    //share of time spent sending while throttled
+    double duty_ = 1.0;
+    bool max_pause_reached_ = false;
+
+    unsigned long paused_num_ = 0;
+    unsigned long paused_total_sec_ = 0;
+    unsigned long throttled_chunks_ = 0;
+    double throttled_sleep_total_sec_ = 0.0;
+};
+
+#endif //NOTER_UPLOAD_THROTTLE
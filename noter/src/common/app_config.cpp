@@ -1,16 +1,21 @@
 #include "app_config.hpp"
 
 #include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include <string>
 #include <map>
-#include <fstream>
-#include <sstream>
+#include <stdexcept>
 
 #include "noter_utils.hpp"
 
 using namespace std;
 
+//4096 = 4 kb, config file is expected to be read in single call
+const size_t CONFIG_READ_BUFFER_LENGTH = 4096;
+
 
 void AppConfig::init() {
     if (initialized_.load()) {
@@ -34,37 +39,81 @@ const string AppConfig::getValue(string config_key) {
     return config_map_.at(config_key);
 }
 
+long AppConfig::getLongValue(string config_key, long default_value) {
+    string value = getValue(config_key);
+
+    if (value == "") {
+        return default_value;
+    }
+
+    try {
+        return stol(value);
+    } catch (const logic_error& err) {
+        syslog(LOG_WARNING, "bad numeric value of config '%s': '%s', using default", config_key.c_str(), value.c_str());
+
+        return default_value;
+    }
+}
+
 map<string, string> AppConfig::readConfigFile() {
     map<string, string> config_map;
 
-    ifstream config_file_stream = ifstream(CONFIG_FILE_PATH);
-    
-    if (!config_file_stream.is_open() || !config_file_stream.good()) {
+    //plain read() of small file, noter reads config on every run so iostreams are not worth their setup cost
+    int config_fd = open(CONFIG_FILE_PATH.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (config_fd == -1) {
         syslog(LOG_ERR, "failed to open app config file");
         
         return config_map;
     }
 
-    string line;
-    while (getline(config_file_stream, line)) {
-        if (line.find('\r') != string::npos) {
-            throw runtime_error("non-unix linebreaks in config file");
+    FileDescriptorGuard config_fd_guard(config_fd);
+
+    string config_str;
+    char read_buf[CONFIG_READ_BUFFER_LENGTH];
+
+    while (true) {
+        ssize_t bytes_read = read(config_fd, read_buf, sizeof(read_buf));
+
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            syslog(LOG_ERR, "failed to read app config file");
+
+            return config_map;
         }
 
-        if (startsWith(line, "#")) {
-            continue;
+        if (bytes_read == 0) {
+            break;
         }
 
-        istringstream is_line(line);
-        string key;
+        config_str.append(read_buf, bytes_read);
+    }
+
+    if (config_str.find('\r') != string::npos) {
+        throw runtime_error("non-unix linebreaks in config file");
+    }
 
-        if (getline(is_line, key, '=')) {
-            string value;
+    size_t line_start = 0;
 
-            if (getline(is_line, value)) {
-                config_map[key] = value;
-            } 
+    while (line_start < config_str.size()) {
+        size_t line_end = config_str.find('\n', line_start);
+
+        if (line_end == string::npos) {
+            line_end = config_str.size();
         }
+
+        size_t separator_pos = config_str.find('=', line_start);
+
+        //comments, lines without value and lines with empty value are skipped
+        if (config_str[line_start] != '#' && separator_pos != string::npos && separator_pos + 1 < line_end) {
+            config_map[config_str.substr(line_start, separator_pos - line_start)] 
+                = config_str.substr(separator_pos + 1, line_end - separator_pos - 1);
+        }
+
+        line_start = line_end + 1;
     }
 
     return config_map;
@@ -0,0 +1,494 @@
+#include "checksum.hpp"
+
+#include <fcntl.h>
+
+#include <cstring>
+#include <algorithm>
+
+#include "noter_utils.hpp"
+
+using namespace std;
+
+//1048576 = 1 meg
+const size_t CHECKSUM_FILE_READ_BUFFER_LENGTH = 1048576;
+
+const unsigned MAX_TREE_CHECKSUM_THREADS = 64;
+
+
+unique_ptr<ChecksumCalculator> ChecksumCalculator::create(ChecksumAlgorithm algorithm, unsigned threads_num) {
+    if (isTree(algorithm)) {
+        ChecksumAlgorithm base_algorithm = treeBase(algorithm);
+
+        if (!create(base_algorithm)) {
+            return nullptr;
+        }
+
+        return make_unique<TreeChecksumCalculator>(base_algorithm, threads_num);
+    }
+
+    switch (algorithm) {
+        case ChecksumAlgorithm::MD5:
+            return make_unique<Md5ChecksumCalculator>();
+#ifdef NOTER_WITH_XXHASH
+        case ChecksumAlgorithm::XXH3:
+            return make_unique<Xxh3ChecksumCalculator>();
+#endif
+#ifdef NOTER_WITH_BLAKE3
+        case ChecksumAlgorithm::BLAKE3:
+            return make_unique<Blake3ChecksumCalculator>();
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+uint32_t ChecksumCalculator::supportedAlgorithms() {
+    uint32_t algorithms_mask = 1u << static_cast<uint8_t>(ChecksumAlgorithm::MD5);
+
+#ifdef NOTER_WITH_XXHASH
+    algorithms_mask |= 1u << static_cast<uint8_t>(ChecksumAlgorithm::XXH3);
+#endif
+#ifdef NOTER_WITH_BLAKE3
+    algorithms_mask |= 1u << static_cast<uint8_t>(ChecksumAlgorithm::BLAKE3);
+#endif
+
+    //tree variant of any built in algorithm
+    algorithms_mask |= 1u << CHECKSUM_TREE_SUPPORTED_BIT;
+
+    return algorithms_mask;
+}
+
+ChecksumAlgorithm ChecksumCalculator::defaultAlgorithm() {
+    //tree variant costs one extra tiny hash for small data and scales with cores for large one
+#if defined(NOTER_WITH_XXHASH)
+    return ChecksumAlgorithm::XXH3_TREE;
+#elif defined(NOTER_WITH_BLAKE3)
+    return ChecksumAlgorithm::BLAKE3_TREE;
+#else
+    return ChecksumAlgorithm::MD5_TREE;
+#endif
+}
+
+size_t ChecksumCalculator::hexLength(ChecksumAlgorithm algorithm) {
+    //root of tree is hash of base algorithm
+    if (isTree(algorithm)) {
+        return hexLength(treeBase(algorithm));
+    }
+
+    switch (algorithm) {
+        case ChecksumAlgorithm::MD5:
+            return 32;
+        case ChecksumAlgorithm::XXH3:
+            return 16;
+        case ChecksumAlgorithm::BLAKE3:
+            return 64;
+        default:
+            return 0;
+    }
+}
+
+const char* ChecksumCalculator::algorithmName(ChecksumAlgorithm algorithm) {
+    switch (algorithm) {
+        case ChecksumAlgorithm::MD5:
+            return "md5";
+        case ChecksumAlgorithm::XXH3:
+            return "xxh3";
+        case ChecksumAlgorithm::BLAKE3:
+            return "blake3";
+        case ChecksumAlgorithm::MD5_TREE:
+            return "md5-tree";
+        case ChecksumAlgorithm::XXH3_TREE:
+            return "xxh3-tree";
+        case ChecksumAlgorithm::BLAKE3_TREE:
+            return "blake3-tree";
+        default:
+            return "unknown";
+    }
+}
+
+bool ChecksumCalculator::parseAlgorithmName(const string& name, ChecksumAlgorithm *algorithm) {
+    for (ChecksumAlgorithm known_algorithm : {ChecksumAlgorithm::MD5, ChecksumAlgorithm::XXH3, ChecksumAlgorithm::BLAKE3, 
+            ChecksumAlgorithm::MD5_TREE, ChecksumAlgorithm::XXH3_TREE, ChecksumAlgorithm::BLAKE3_TREE}) {
+        if (name == algorithmName(known_algorithm)) {
+            *algorithm = known_algorithm;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int ChecksumCalculator::updateFromFile(int fd, off_t offset, size_t length) {
+    posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+
+    HeapArrayContainer<char> read_buffer(min(length, CHECKSUM_FILE_READ_BUFFER_LENGTH));
+
+    while (length > 0) {
+        size_t chunk_length = min(length, CHECKSUM_FILE_READ_BUFFER_LENGTH);
+
+        if (preadAll(fd, read_buffer.data(), chunk_length, offset) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        update(read_buffer.data(), chunk_length);
+
+        offset += chunk_length;
+        length -= chunk_length;
+    }
+
+    return Status::OK;
+}
+
+
+void Md5ChecksumCalculator::update(const char* data, size_t length) {
+    valid_ = valid_ && MD5_Update(&md5_context_, data, length) == 1;
+}
+
+int Md5ChecksumCalculator::hexDigest(string *out_str) {
+    unsigned char result_as_numbers[MD5_DIGEST_LENGTH];
+
+    //final is taken from copy of context, so original one can be updated further
+    MD5_CTX md5_context_copy = md5_context_;
+
+    if (!valid_ || MD5_Final(result_as_numbers, &md5_context_copy) != 1) {
+        return Status::ERROR;
+    }
+
+    *out_str = digestToHexString(result_as_numbers, MD5_DIGEST_LENGTH);
+
+    return Status::OK;
+}
+
+void Md5ChecksumCalculator::reset() {
+    valid_ = MD5_Init(&md5_context_) == 1;
+}
+
+
+#ifdef NOTER_WITH_XXHASH
+Xxh3ChecksumCalculator::Xxh3ChecksumCalculator() {
+    state_ = XXH3_createState();
+
+    reset();
+}
+
+Xxh3ChecksumCalculator::~Xxh3ChecksumCalculator() {
+    XXH3_freeState(state_);
+}
+
+void Xxh3ChecksumCalculator::update(const char* data, size_t length) {
+    valid_ = valid_ && XXH3_64bits_update(state_, data, length) == XXH_OK;
+}
+
+int Xxh3ChecksumCalculator::hexDigest(string *out_str) {
+    if (!valid_) {
+        return Status::ERROR;
+    }
+
+    //digest doesn't change state, so more data can be passed after
+    XXH64_canonical_t canonical_hash;
+    XXH64_canonicalFromHash(&canonical_hash, XXH3_64bits_digest(state_));
+
+    *out_str = digestToHexString(canonical_hash.digest, sizeof(canonical_hash.digest));
+
+    return Status::OK;
+}
+
+void Xxh3ChecksumCalculator::reset() {
+    valid_ = state_ != nullptr && XXH3_64bits_reset(state_) == XXH_OK;
+}
+#endif
+
+
+#ifdef NOTER_WITH_BLAKE3
+void Blake3ChecksumCalculator::update(const char* data, size_t length) {
+    blake3_hasher_update(&hasher_, data, length);
+}
+
+int Blake3ChecksumCalculator::hexDigest(string *out_str) {
+    uint8_t result_as_numbers[BLAKE3_OUT_LEN];
+
+    //finalize doesn't change hasher, so more data can be passed after
+    blake3_hasher_finalize(&hasher_, result_as_numbers, BLAKE3_OUT_LEN);
+
+    *out_str = digestToHexString(result_as_numbers, BLAKE3_OUT_LEN);
+
+    return Status::OK;
+}
+
+void Blake3ChecksumCalculator::reset() {
+    blake3_hasher_init(&hasher_);
+}
+#endif
+
+
+TreeChecksumCalculator::TreeChecksumCalculator(ChecksumAlgorithm base_algorithm, unsigned threads_num)
+        : base_algorithm_(base_algorithm) {
+    threads_num_ = threads_num != 0 ? threads_num : max(thread::hardware_concurrency(), 1u);
+    threads_num_ = min(threads_num_, MAX_TREE_CHECKSUM_THREADS);
+}
+
+TreeChecksumCalculator::~TreeChecksumCalculator() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_requested_ = true;
+    }
+
+    jobs_cond_.notify_all();
+
+    for (thread& pool_thread : threads_) {
+        pool_thread.join();
+    }
+
+    for (char* buffer : all_buffers_) {
+        delete[] buffer;
+    }
+}
+
+void TreeChecksumCalculator::update(const char* data, size_t length) {
+    while (length > 0) {
+        if (leaf_buffer_ == nullptr) {
+            leaf_buffer_ = takeFreeBuffer();
+        }
+
+        size_t copy_length = min(length, LEAF_LENGTH - leaf_length_);
+
+        memcpy(leaf_buffer_ + leaf_length_, data, copy_length);
+
+        leaf_length_ += copy_length;
+        data += copy_length;
+        length -= copy_length;
+
+        if (leaf_length_ == LEAF_LENGTH) {
+            submitLeaf({0, leaf_buffer_, -1, 0});
+
+            leaf_buffer_ = nullptr;
+            leaf_length_ = 0;
+        }
+    }
+}
+
+int TreeChecksumCalculator::updateFromFile(int fd, off_t offset, size_t length) {
+    posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+
+    //leaf partially filled by update() is completed first, so leaves stay aligned to data start
+    if (leaf_length_ > 0) {
+        size_t read_length = min(length, LEAF_LENGTH - leaf_length_);
+
+        if (preadAll(fd, leaf_buffer_ + leaf_length_, read_length, offset) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        leaf_length_ += read_length;
+        offset += read_length;
+        length -= read_length;
+
+        if (leaf_length_ == LEAF_LENGTH) {
+            submitLeaf({0, leaf_buffer_, -1, 0});
+
+            leaf_buffer_ = nullptr;
+            leaf_length_ = 0;
+        }
+    }
+
+    //full leaves are read by pool threads in parallel
+    while (length >= LEAF_LENGTH) {
+        submitLeaf({0, nullptr, fd, offset});
+
+        offset += LEAF_LENGTH;
+        length -= LEAF_LENGTH;
+    }
+
+    int res = Status::OK;
+
+    if (length > 0) {
+        leaf_buffer_ = takeFreeBuffer();
+
+        res = preadAll(fd, leaf_buffer_, length, offset);
+        leaf_length_ = res == Status::OK ? length : 0;
+    }
+
+    //descriptor may be closed by caller right after
+    waitForLeaves();
+
+    lock_guard<mutex> lock(mutex_);
+
+    if (res != Status::OK) {
+        valid_ = false;
+    }
+
+    return valid_ ? Status::OK : Status::ERROR;
+}
+
+int TreeChecksumCalculator::hexDigest(string *out_str) {
+    waitForLeaves();
+
+    lock_guard<mutex> lock(mutex_);
+
+    if (!valid_) {
+        return Status::ERROR;
+    }
+
+    unique_ptr<ChecksumCalculator> root_checksum = create(base_algorithm_);
+
+    for (const string& leaf_hash : leaf_hashes_) {
+        root_checksum->update(leaf_hash.c_str(), leaf_hash.size());
+    }
+
+    //last leaf is not full (or there is no data at all), it is hashed here without being consumed
+    if (leaf_length_ > 0 || leaf_hashes_.empty()) {
+        unique_ptr<ChecksumCalculator> leaf_checksum = create(base_algorithm_);
+        string leaf_hash;
+
+        if (leaf_length_ > 0) {
+            leaf_checksum->update(leaf_buffer_, leaf_length_);
+        }
+
+        if (leaf_checksum->hexDigest(&leaf_hash) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        root_checksum->update(leaf_hash.c_str(), leaf_hash.size());
+    }
+
+    return root_checksum->hexDigest(out_str);
+}
+
+void TreeChecksumCalculator::reset() {
+    waitForLeaves();
+
+    lock_guard<mutex> lock(mutex_);
+
+    leaf_hashes_.clear();
+    valid_ = true;
+
+    if (leaf_buffer_ != nullptr) {
+        free_buffers_.push_back(leaf_buffer_);
+    }
+
+    leaf_buffer_ = nullptr;
+    leaf_length_ = 0;
+}
+
+void TreeChecksumCalculator::submitLeaf(LeafJob job) {
+    unique_lock<mutex> lock(mutex_);
+
+    job.leaf_index = leaf_hashes_.size();
+    leaf_hashes_.emplace_back();
+
+    if (threads_num_ <= 1) {
+        //no pool, leaf is hashed right away by caller
+        lock.unlock();
+
+        if (job.buffer == nullptr && inline_read_buffer_.empty()) {
+            inline_read_buffer_.resize(CHECKSUM_FILE_READ_BUFFER_LENGTH);
+        }
+
+        string leaf_hash;
+        int res = hashLeaf(job, inline_read_buffer_.data(), &leaf_hash);
+
+        lock.lock();
+
+        finishLeaf(job, res, leaf_hash);
+
+        return;
+    }
+
+    //pool is started by the first full leaf
+    while (threads_.size() < threads_num_) {
+        threads_.emplace_back(&TreeChecksumCalculator::threadLoop, this);
+    }
+
+    jobs_.push_back(job);
+    jobs_cond_.notify_one();
+}
+
+void TreeChecksumCalculator::finishLeaf(const LeafJob& job, int res, const string& leaf_hash) {
+    leaf_hashes_[job.leaf_index] = leaf_hash;
+
+    if (res != Status::OK) {
+        valid_ = false;
+    }
+
+    if (job.buffer != nullptr) {
+        free_buffers_.push_back(job.buffer);
+    }
+
+    done_cond_.notify_all();
+}
+
+void TreeChecksumCalculator::waitForLeaves() {
+    unique_lock<mutex> lock(mutex_);
+
+    done_cond_.wait(lock, [this]() { return jobs_.empty() && jobs_in_progress_ == 0; });
+}
+
+char* TreeChecksumCalculator::takeFreeBuffer() {
+    unique_lock<mutex> lock(mutex_);
+
+    //leaf being filled + leaf per pool thread
+    if (free_buffers_.empty() && all_buffers_.size() < threads_num_ + 1) {
+        char* buffer = new char[LEAF_LENGTH];
+        all_buffers_.push_back(buffer);
+
+        return buffer;
+    }
+
+    done_cond_.wait(lock, [this]() { return !free_buffers_.empty(); });
+
+    char* buffer = free_buffers_.back();
+    free_buffers_.pop_back();
+
+    return buffer;
+}
+
+void TreeChecksumCalculator::threadLoop() {
+    HeapArrayContainer<char> read_buffer(CHECKSUM_FILE_READ_BUFFER_LENGTH);
+
+    unique_lock<mutex> lock(mutex_);
+
+    while (true) {
+        jobs_cond_.wait(lock, [this]() { return stop_requested_ || !jobs_.empty(); });
+
+        if (stop_requested_) {
+            return;
+        }
+
+        LeafJob job = jobs_.front();
+        jobs_.pop_front();
+        jobs_in_progress_++;
+
+        lock.unlock();
+
+        string leaf_hash;
+        int res = hashLeaf(job, read_buffer.data(), &leaf_hash);
+
+        lock.lock();
+
+        jobs_in_progress_--;
+
+        finishLeaf(job, res, leaf_hash);
+    }
+}
+
+int TreeChecksumCalculator::hashLeaf(const LeafJob& job, char* read_buffer, string *out_str) {
+    unique_ptr<ChecksumCalculator> leaf_checksum = create(base_algorithm_);
+
+    if (job.buffer != nullptr) {
+        leaf_checksum->update(job.buffer, LEAF_LENGTH);
+
+        return leaf_checksum->hexDigest(out_str);
+    }
+
+    for (size_t leaf_offset = 0; leaf_offset < LEAF_LENGTH; leaf_offset += CHECKSUM_FILE_READ_BUFFER_LENGTH) {
+        size_t chunk_length = min(LEAF_LENGTH - leaf_offset, CHECKSUM_FILE_READ_BUFFER_LENGTH);
+
+        if (preadAll(job.fd, read_buffer, chunk_length, job.offset + leaf_offset) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        leaf_checksum->update(read_buffer, chunk_length);
+    }
+
+    return leaf_checksum->hexDigest(out_str);
+}
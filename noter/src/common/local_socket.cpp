@@ -0,0 +1,149 @@
+#include "local_socket.hpp"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "noter_utils.hpp"
+
+using namespace std;
+
+const string NOTERD_SOCKET_PATH = "/run/noterd.sock";
+
+const int LOCAL_SOCKET_QUEUE_LIMIT = 128;
+//rest of pending clients is accepted on next wakeup, so notes keep going meanwhile
+const int LOCAL_SOCKET_MAX_ACCEPTS = LOCAL_SOCKET_QUEUE_LIMIT;
+
+//32 bytes of uuid string + 4 dash separators
+const size_t NOTIFICATION_NOTE_NAME_LENGTH = 36;
+
+
+int fillLocalSocketAddress(struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (NOTERD_SOCKET_PATH.size() >= sizeof(addr->sun_path)) {
+        return Status::ERROR;
+    }
+
+    strcpy(addr->sun_path, NOTERD_SOCKET_PATH.c_str());
+
+    return Status::OK;
+}
+
+int notifyDaemon(const string& note_name) {
+    if (note_name.size() != NOTIFICATION_NOTE_NAME_LENGTH) {
+        return Status::ERROR;
+    }
+
+    struct sockaddr_un addr;
+
+    if (fillLocalSocketAddress(&addr) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    //non-blocking so noter never waits for busy daemon (connect fails with EAGAIN if daemon's queue is full)
+    int sock_descr = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (sock_descr == -1) {
+        return Status::ERROR;
+    }
+
+    if (connect(sock_descr, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(sock_descr);
+
+        return Status::ERROR;
+    }
+
+    ssize_t res = send(sock_descr, note_name.c_str(), note_name.size(), MSG_NOSIGNAL);
+
+    close(sock_descr);
+
+    return res == static_cast<ssize_t>(note_name.size()) ? Status::OK : Status::ERROR;
+}
+
+int openLocalListenSocket() {
+    struct sockaddr_un addr;
+
+    if (fillLocalSocketAddress(&addr) != Status::OK) {
+        syslog(LOG_ERR, "local socket path is too long '%s'", NOTERD_SOCKET_PATH.c_str());
+
+        return -1;
+    }
+
+    int listen_sock_descr = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (listen_sock_descr == -1) {
+        syslog(LOG_ERR, "failed to create local socket: '%s'", strerror(errno));
+
+        return -1;
+    }
+
+    //socket file may be left by previous daemon run
+    unlink(NOTERD_SOCKET_PATH.c_str());
+
+    if (bind(listen_sock_descr, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        syslog(LOG_ERR, "failed to bind local socket '%s': '%s'", NOTERD_SOCKET_PATH.c_str(), strerror(errno));
+        close(listen_sock_descr);
+
+        return -1;
+    }
+
+    //noter may be run by any user
+    chmod(NOTERD_SOCKET_PATH.c_str(), 0666);
+
+    if (listen(listen_sock_descr, LOCAL_SOCKET_QUEUE_LIMIT) != 0) {
+        syslog(LOG_ERR, "failed to listen on local socket: '%s'", strerror(errno));
+        closeLocalListenSocket(listen_sock_descr);
+
+        return -1;
+    }
+
+    return listen_sock_descr;
+}
+
+void closeLocalListenSocket(int listen_sock_descr) {
+    if (listen_sock_descr == -1) {
+        return;
+    }
+
+    close(listen_sock_descr);
+    unlink(NOTERD_SOCKET_PATH.c_str());
+}
+
+int acceptNotifications(int listen_sock_descr, vector<string> *note_names) {
+    //accept pending clients, each one sends single note name and closes connection
+    for (int accepts_num = 0; accepts_num < LOCAL_SOCKET_MAX_ACCEPTS; accepts_num++) {
+        int client_sock_descr = accept4(listen_sock_descr, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (client_sock_descr == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            //EAGAIN - no more pending clients
+            return errno == EAGAIN || errno == EWOULDBLOCK ? Status::OK : Status::ERROR;
+        }
+
+        //noter sends name right after connect, so daemon never waits for client. Note of client that sent 
+        //nothing (or only part of name) yet is found by spool dir watch or heartbeat
+        char note_name[NOTIFICATION_NOTE_NAME_LENGTH];
+        ssize_t bytes_read = recv(client_sock_descr, note_name, NOTIFICATION_NOTE_NAME_LENGTH, MSG_DONTWAIT);
+
+        if (bytes_read == static_cast<ssize_t>(NOTIFICATION_NOTE_NAME_LENGTH)) {
+            note_names->push_back(string(note_name, NOTIFICATION_NOTE_NAME_LENGTH));
+        }
+
+        close(client_sock_descr);
+    }
+
+    return Status::OK;
+}
@@ -0,0 +1,492 @@
+#include "note_ring.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <grp.h>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <mutex>
+#include <algorithm>
+#include <filesystem>
+
+#include <zlib.h>
+
+#include "noter_utils.hpp"
+#include "app_config.hpp"
+
+using namespace std;
+
+const string DEFAULT_SPOOL_RING_PATH = "/dev/shm/noter/ring";
+//16777216 = 16 meg, tmpfs pages are taken only once written
+const long DEFAULT_SPOOL_RING_BYTES = 16777216L;
+//65536 = 64 kb
+const long MIN_SPOOL_RING_BYTES = 65536L;
+
+const char NOTE_RING_MAGIC[4] = {'N', 'T', 'R', 'G'};
+const uint32_t NOTE_RING_VERSION = 1;
+
+//data area starts at next page after header
+const size_t NOTE_RING_DATA_OFFSET = 4096;
+
+const uint32_t NOTE_RING_RECORD = 0x4e524543;
+//rest of data area till its end is unused, next record is at its beginning
+const uint32_t NOTE_RING_PADDING = 0x4e504144;
+
+//32 bytes of uuid string + 4 dash separators
+const size_t NOTE_RING_NOTE_NAME_LENGTH = 36;
+
+struct NoteRingRecordHeader {
+    uint32_t type;
+    uint32_t length;
+    //crc32 of note name and data
+    uint32_t crc;
+    char note_name[NOTE_RING_NOTE_NAME_LENGTH];
+};
+
+
+size_t ringRecordLength(size_t data_length) {
+    //records are 8 bytes aligned
+    return (sizeof(NoteRingRecordHeader) + data_length + 7) & ~static_cast<size_t>(7);
+}
+
+uint32_t ringRecordCrc(const char* note_name, const char* data, size_t length) {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(note_name), NOTE_RING_NOTE_NAME_LENGTH);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(data), length);
+
+    return static_cast<uint32_t>(crc);
+}
+
+/**
+ * Holds flock of ring file while in scope
+*/
+class RingFileLock {
+public:
+    explicit RingFileLock(int fd) : fd_(fd) { locked_ = flock(fd_, LOCK_EX) == 0; };
+    ~RingFileLock() {
+        if (locked_) {
+            flock(fd_, LOCK_UN);
+        }
+    }
+
+    RingFileLock(const RingFileLock& other) = delete;
+    RingFileLock& operator= (const RingFileLock& other) = delete;
+
+    bool locked() const { return locked_; }
+private:
+    int fd_;
+    bool locked_;
+};
+
+int NoteRing::openRing(const string& path) {
+    closeRing();
+
+    path_ = path;
+
+    //ring is created by noterd only, writer uses it once it is there
+    fd_ = open(path.c_str(), O_RDWR | O_CLOEXEC | O_NOFOLLOW);
+
+    if (fd_ == -1) {
+        return Status::ERROR;
+    }
+
+    uint64_t capacity;
+    struct stat ring_stats;
+
+    if (!validRing(&capacity) || fstat(fd_, &ring_stats) != 0) {
+        closeRing();
+        errno = EBADMSG;
+
+        return Status::ERROR;
+    }
+
+    dev_ = ring_stats.st_dev;
+    ino_ = ring_stats.st_ino;
+
+    mapped_length_ = NOTE_RING_DATA_OFFSET + capacity;
+    void* mapped = mmap(nullptr, mapped_length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+
+    if (mapped == MAP_FAILED) {
+        mapped_length_ = 0;
+        closeRing();
+
+        return Status::ERROR;
+    }
+
+    header_ = static_cast<NoteRingHeader*>(mapped);
+    data_ = static_cast<char*>(mapped) + NOTE_RING_DATA_OFFSET;
+    capacity_ = capacity;
+
+    return Status::OK;
+}
+
+int NoteRing::createRing(const string& path, size_t capacity, gid_t writers_gid) {
+    closeRing();
+
+    capacity = max(capacity, static_cast<size_t>(MIN_SPOOL_RING_BYTES)) & ~static_cast<size_t>(7);
+
+    string dir_path = filesystem::path(path).parent_path().string();
+
+    if (mkdir(dir_path.c_str(), 0755) != 0 && errno != EEXIST) {
+        if (errno != ENOENT || createDirectories(dir_path) != Status::OK) {
+            return Status::ERROR;
+        }
+    }
+
+    //nobody else may put file in place of ring, dir left writable by all by older noter is taken back
+    struct stat dir_stats;
+
+    if (lstat(dir_path.c_str(), &dir_stats) != 0 || !S_ISDIR(dir_stats.st_mode) || dir_stats.st_uid != geteuid()
+            || chmod(dir_path.c_str(), 0755) != 0) {
+        errno = EPERM;
+
+        return Status::ERROR;
+    }
+
+    fd_ = open(path.c_str(), O_RDWR | O_CLOEXEC | O_NOFOLLOW);
+
+    struct stat ring_stats;
+    uint64_t existing_capacity;
+
+    //existing ring keeps its capacity and records left unsent, unless it was created by someone else
+    if (fd_ != -1 && fstat(fd_, &ring_stats) == 0 && ring_stats.st_uid == geteuid() && validRing(&existing_capacity)) {
+        capacity = existing_capacity;
+    } else if (createRingFile(path, capacity) != Status::OK) {
+        closeRing();
+
+        return Status::ERROR;
+    }
+
+    //writers are let in by group only
+    if (fchown(fd_, static_cast<uid_t>(-1), writers_gid) != 0 || fchmod(fd_, 0660) != 0) {
+        closeRing();
+
+        return Status::ERROR;
+    }
+
+    capacity_ = capacity;
+
+    if (readHeaderField(offsetof(NoteRingHeader, tail), &reader_tail_) != Status::OK) {
+        closeRing();
+
+        return Status::ERROR;
+    }
+
+    return Status::OK;
+}
+
+bool NoteRing::validRing(uint64_t *capacity) {
+    struct stat ring_stats;
+    NoteRingHeader header;
+
+    bool valid_ring = fstat(fd_, &ring_stats) == 0 && S_ISREG(ring_stats.st_mode)
+        && static_cast<size_t>(ring_stats.st_size) > NOTE_RING_DATA_OFFSET
+        && preadAll(fd_, reinterpret_cast<char*>(&header), sizeof(header), 0) == Status::OK
+        && memcmp(header.magic, NOTE_RING_MAGIC, sizeof(NOTE_RING_MAGIC)) == 0
+        && header.version == NOTE_RING_VERSION
+        && header.capacity + NOTE_RING_DATA_OFFSET == static_cast<uint64_t>(ring_stats.st_size);
+
+    *capacity = header.capacity;
+
+    return valid_ring;
+}
+
+int NoteRing::createRingFile(const string& path, size_t capacity) {
+    if (fd_ != -1) {
+        close(fd_);
+    }
+
+    //new ring is complete before it gets its name - writer never maps ring being set up, 
+    //and the one writers may have mapped is never truncated
+    string tmp_path = path + ".new";
+    unlink(tmp_path.c_str());
+
+    fd_ = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC | O_NOFOLLOW, 0600);
+
+    if (fd_ == -1) {
+        return Status::ERROR;
+    }
+
+    NoteRingHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, NOTE_RING_MAGIC, sizeof(NOTE_RING_MAGIC));
+    header.version = NOTE_RING_VERSION;
+    header.capacity = capacity;
+
+    if (ftruncate(fd_, NOTE_RING_DATA_OFFSET + capacity) != 0 
+            || pwrite(fd_, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))
+            || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+
+        return Status::ERROR;
+    }
+
+    return Status::OK;
+}
+
+int NoteRing::readHeaderField(size_t field_offset, uint64_t *value) {
+    uint64_t prev_value = 0;
+
+    for (int read_num = 0; read_num < 8; read_num++) {
+        if (preadAll(fd_, reinterpret_cast<char*>(value), sizeof(*value), field_offset) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        if (read_num > 0 && *value == prev_value) {
+            return Status::OK;
+        }
+
+        prev_value = *value;
+    }
+
+    errno = EBADMSG;
+
+    return Status::ERROR;
+}
+
+void NoteRing::closeRing() {
+    if (header_ != nullptr) {
+        munmap(header_, mapped_length_);
+    }
+
+    if (fd_ != -1) {
+        close(fd_);
+    }
+
+    fd_ = -1;
+    header_ = nullptr;
+    data_ = nullptr;
+    mapped_length_ = 0;
+    capacity_ = 0;
+    reader_tail_ = 0;
+    dev_ = 0;
+    ino_ = 0;
+}
+
+int NoteRing::reopenIfReplaced() {
+    struct stat path_stats;
+
+    if (header_ != nullptr && stat(path_.c_str(), &path_stats) == 0 
+            && path_stats.st_dev == dev_ && path_stats.st_ino == ino_) {
+        return Status::OK;
+    }
+
+    if (path_.empty()) {
+        errno = EINVAL;
+
+        return Status::ERROR;
+    }
+
+    return openRing(path_);
+}
+
+int NoteRing::append(const string& note_name, const char* data, size_t length) {
+    if (note_name.size() != NOTE_RING_NOTE_NAME_LENGTH) {
+        errno = EINVAL;
+
+        return Status::ERROR;
+    }
+
+    lock_guard<mutex> append_lock(append_mutex_);
+
+    //process may live long (libnoter), ring may have been replaced by reader since it was mapped
+    if (reopenIfReplaced() != Status::OK) {
+        return Status::ERROR;
+    }
+
+    size_t record_length = ringRecordLength(length);
+
+    if (record_length > capacity_) {
+        errno = ENOSPC;
+
+        return Status::ERROR;
+    }
+
+    RingFileLock ring_lock(fd_);
+
+    if (!ring_lock.locked()) {
+        return Status::ERROR;
+    }
+
+    //head is written by writers only, all of them hold the lock
+    uint64_t head = __atomic_load_n(&header_->head, __ATOMIC_RELAXED);
+    uint64_t tail = __atomic_load_n(&header_->tail, __ATOMIC_ACQUIRE);
+
+    if (tail > head || head - tail > capacity_) {
+        errno = EBADMSG;
+
+        return Status::ERROR;
+    }
+
+    //record is never split by end of data area
+    size_t offset = head % capacity_;
+    size_t room_till_end = capacity_ - offset;
+    size_t padding_length = room_till_end < record_length ? room_till_end : 0;
+
+    if (head + padding_length + record_length - tail > capacity_) {
+        errno = ENOSPC;
+
+        return Status::ERROR;
+    }
+
+    //reader skips the rest of data area by itself if even padding header doesn't fit
+    if (padding_length >= sizeof(NoteRingRecordHeader)) {
+        NoteRingRecordHeader padding_header;
+        memset(&padding_header, 0, sizeof(padding_header));
+        padding_header.type = NOTE_RING_PADDING;
+
+        memcpy(data_ + offset, &padding_header, sizeof(padding_header));
+    }
+
+    uint64_t record_position = head + padding_length;
+    char* record = data_ + record_position % capacity_;
+
+    NoteRingRecordHeader record_header;
+    record_header.type = NOTE_RING_RECORD;
+    record_header.length = static_cast<uint32_t>(length);
+    memcpy(record_header.note_name, note_name.c_str(), NOTE_RING_NOTE_NAME_LENGTH);
+    record_header.crc = ringRecordCrc(record_header.note_name, data, length);
+
+    memcpy(record, &record_header, sizeof(record_header));
+    memcpy(record + sizeof(record_header), data, length);
+
+    //reader sees record only once it is complete
+    __atomic_store_n(&header_->head, record_position + record_length, __ATOMIC_RELEASE);
+
+    return Status::OK;
+}
+
+uint64_t NoteRing::head() {
+    uint64_t head;
+
+    //ring that can't be read looks empty
+    if (fd_ == -1 || readHeaderField(offsetof(NoteRingHeader, head), &head) != Status::OK) {
+        return reader_tail_;
+    }
+
+    return head;
+}
+
+uint64_t NoteRing::tail() {
+    return reader_tail_;
+}
+
+int NoteRing::readRecord(uint64_t position, string *note_name, string *data, uint64_t *next_position) {
+    uint64_t head = this->head();
+
+    *next_position = head;
+
+    if (fd_ == -1 || position > head || head - position > capacity_) {
+        errno = EBADMSG;
+
+        return Status::ERROR;
+    }
+
+    //ring shrunk by writer has nothing left to read
+    struct stat ring_stats;
+
+    if (fstat(fd_, &ring_stats) != 0 || static_cast<uint64_t>(ring_stats.st_size) != NOTE_RING_DATA_OFFSET + capacity_) {
+        errno = EBADMSG;
+
+        return Status::ERROR;
+    }
+
+    while (position < head) {
+        size_t offset = position % capacity_;
+        size_t room_till_end = capacity_ - offset;
+
+        if (room_till_end < sizeof(NoteRingRecordHeader)) {
+            position += room_till_end;
+
+            continue;
+        }
+
+        NoteRingRecordHeader record_header;
+
+        if (preadAll(fd_, reinterpret_cast<char*>(&record_header), sizeof(record_header), 
+                NOTE_RING_DATA_OFFSET + offset) != Status::OK) {
+            errno = EBADMSG;
+
+            return Status::ERROR;
+        }
+
+        if (record_header.type == NOTE_RING_PADDING) {
+            position += room_till_end;
+
+            continue;
+        }
+
+        //next record can't be found after broken header, everything till head is skipped
+        if (record_header.type != NOTE_RING_RECORD || ringRecordLength(record_header.length) > room_till_end
+                || position + ringRecordLength(record_header.length) > head) {
+            errno = EBADMSG;
+
+            return Status::ERROR;
+        }
+
+        *next_position = position + ringRecordLength(record_header.length);
+
+        data->resize(record_header.length);
+
+        if (preadAll(fd_, &(*data)[0], record_header.length, NOTE_RING_DATA_OFFSET + offset + sizeof(record_header)) 
+                != Status::OK 
+                || ringRecordCrc(record_header.note_name, data->c_str(), record_header.length) != record_header.crc) {
+            data->clear();
+            errno = EBADMSG;
+
+            return Status::ERROR;
+        }
+
+        note_name->assign(record_header.note_name, NOTE_RING_NOTE_NAME_LENGTH);
+
+        return Status::OK;
+    }
+
+    //only padding till head
+    errno = ENODATA;
+
+    return Status::ERROR;
+}
+
+void NoteRing::release(uint64_t position) {
+    if (fd_ != -1 && pwrite(fd_, &position, sizeof(position), offsetof(NoteRingHeader, tail)) 
+            == static_cast<ssize_t>(sizeof(position))) {
+        reader_tail_ = position;
+    }
+}
+
+string spoolRingPath() {
+    string ring_path = AppConfig::getValue(CONFIG_SPOOL_RING_PATH);
+
+    return ring_path != "" ? ring_path : DEFAULT_SPOOL_RING_PATH;
+}
+
+int openSpoolRing(NoteRing *ring) {
+    return ring->openRing(spoolRingPath());
+}
+
+int createSpoolRing(NoteRing *ring) {
+    long ring_bytes = AppConfig::getLongValue(CONFIG_SPOOL_RING_BYTES, DEFAULT_SPOOL_RING_BYTES);
+    string writers_group = AppConfig::getValue(CONFIG_SPOOL_RING_GROUP);
+    gid_t writers_gid = getegid();
+
+    if (writers_group != "") {
+        struct group* group_entry = getgrnam(writers_group.c_str());
+
+        if (group_entry == nullptr) {
+            errno = EINVAL;
+
+            return Status::ERROR;
+        }
+
+        writers_gid = group_entry->gr_gid;
+    }
+
+    return ring->createRing(spoolRingPath(), static_cast<size_t>(max(ring_bytes, 0L)), writers_gid);
+}
@@ -1,13 +1,22 @@
 #include "noter_utils.hpp"
 
-#include <openssl/md5.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include <iostream>
 #include <fstream>
 #include <filesystem>
 #include <sstream>
 #include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <atomic>
 #include <syslog.h>
 
 using namespace std;
@@ -18,8 +27,19 @@ extern const string OUT_FILE_TMP_PREFIX = "temp_";
 //1048576000 = 1000 mb
 extern const size_t MAX_OUT_FILE_SIZE = 1048576000L;
 
-const int MD5_CALCULATION_FILE_READ_BUFF_SIZE = 1024 * 1000;
+const char CHECKSUM_TRAILER_MAGIC[] = {'N', 'T', 'C', 'K'};
+//checksum length + algorithm id + magic
+const size_t CHECKSUM_TRAILER_FIXED_LENGTH = 2 + sizeof(CHECKSUM_TRAILER_MAGIC);
 
+//4096 = 4 kb
+const size_t STATE_FILE_READ_BUFFER_LENGTH = 4096;
+
+atomic<bool> stdout_error_reports{true};
+
+
+void setStdoutErrorReports(bool enabled) {
+    stdout_error_reports = enabled;
+}
 
 bool fileExists(const string file_path) {
     return filesystem::exists(file_path);
@@ -35,11 +55,15 @@ int deleteFile(const string file_path) {
         if (filesystem::remove(file_path)) {
             return Status::OK;
         } else {
-            cout << "failed to delete file " << file_path << endl;
+            if (stdout_error_reports) {
+                cout << "failed to delete file " << file_path << endl;
+            }
             syslog(LOG_ERR, "failed to delete file %s", file_path.c_str());
         }
     } catch (const filesystem::filesystem_error& err) {
-        cout << "error during attempt to delete file " << err.what() << endl;
+        if (stdout_error_reports) {
+            cout << "error during attempt to delete file " << err.what() << endl;
+        }
         syslog(LOG_ERR, "error during attempt to delete file %s: %s", file_path.c_str(), err.what());
     }
     
@@ -58,7 +82,9 @@ int renameFile(const string old_path, const string new_path) {
 
         return Status::OK;
     } catch (const filesystem::filesystem_error& err) {
-        cout << "error during attempt to rename file " << err.what() << endl;
+        if (stdout_error_reports) {
+            cout << "error during attempt to rename file " << err.what() << endl;
+        }
         syslog(LOG_ERR, "error during attempt to rename file %s: %s", old_path.c_str(), err.what());
     }
     
@@ -71,7 +97,9 @@ int createDirectories(const string full_path) {
 
         return Status::OK;
     } catch (const filesystem::filesystem_error& err) {
-        cout << "error during attempt to create directories " << err.what() << endl;
+        if (stdout_error_reports) {
+            cout << "error during attempt to create directories " << err.what() << endl;
+        }
         syslog(LOG_ERR, "error during attempt to create directories %s: %s", full_path.c_str(), err.what());
     }
     
@@ -88,51 +116,197 @@ long getFileSize(string file_path) {
     return static_cast<long>(file_stats.st_size);
 }
 
-int calculateFileMD5(const string file_path, std::string *out_str) {
-    ifstream file(file_path, ifstream::binary);
-    if (!file.is_open() || !file.good()) {
-        return Status::ERROR;
+int writeAll(int fd, const char* buf, size_t length) {
+    while (length > 0) {
+        ssize_t res = write(fd, buf, length);
+
+        if (res == -1) {
+            //continue if interrupted
+            if (errno == EINTR) {
+                continue;
+            } else {
+                return Status::ERROR;
+            }
+        }
+
+        buf += res;
+        length -= res;
     }
 
-    MD5_CTX md5_context;
-    if (MD5_Init(&md5_context) != 1) {
-        return Status::ERROR;
+    return Status::OK;
+}
+
+int preadAll(int fd, char* buf, size_t length, long offset) {
+    while (length > 0) {
+        ssize_t res = pread(fd, buf, length, offset);
+
+        if (res == -1) {
+            //continue if interrupted
+            if (errno == EINTR) {
+                continue;
+            } else {
+                return Status::ERROR;
+            }
+        }
+
+        if (res == 0) {
+            //unexpected EOF
+            errno = EIO;
+
+            return Status::ERROR;
+        }
+
+        buf += res;
+        offset += res;
+        length -= res;
     }
-    
-    long file_size;
-    if ((file_size = getFileSize(file_path)) == -1) {
-        return Status::ERROR;
+
+    return Status::OK;
+}
+
+int openUserStateFile(const string& dir_path, int lock_operation) {
+    //note may be checked before anything is written to spool dir, so it may not exist yet
+    if (mkdir(dir_path.c_str(), 01777) == 0 || (errno == ENOENT && createDirectories(dir_path) == Status::OK)) {
+        //umask would keep other users out, sticky bit keeps them from removing state of each other
+        chmod(dir_path.c_str(), 01777);
+    } else if (errno != EEXIST) {
+        return -1;
     }
 
-    char buf[MD5_CALCULATION_FILE_READ_BUFF_SIZE];
+    string state_file_path = dir_path + to_string(getuid());
+    int state_fd = open(state_file_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
 
-    while (file.good()) {
-        file.read(buf, sizeof(buf));
+    if (state_fd == -1) {
+        return -1;
+    }
+
+    //state planted by another user is not trusted
+    struct stat state_stats;
 
-        int byte_read = file.gcount();
-        MD5_Update(&md5_context, buf, byte_read);
+    if (fstat(state_fd, &state_stats) != 0 || !S_ISREG(state_stats.st_mode) || state_stats.st_uid != getuid()) {
+        close(state_fd);
+        errno = EPERM;
 
-        file_size -= byte_read;
+        return -1;
     }
 
-    if (file_size != 0) {
-        return Status::ERROR;
+    if (flock(state_fd, lock_operation) != 0) {
+        close(state_fd);
+
+        return -1;
     }
-    
-    unsigned char result_as_numbers[MD5_DIGEST_LENGTH];
-    if (MD5_Final(result_as_numbers, &md5_context) != 1) {
+
+    return state_fd;
+}
+
+int readStateLines(int fd, vector<string> *lines) {
+    string state_str;
+    char read_buf[STATE_FILE_READ_BUFFER_LENGTH];
+
+    while (true) {
+        ssize_t bytes_read = read(fd, read_buf, sizeof(read_buf));
+
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return Status::ERROR;
+        }
+
+        if (bytes_read == 0) {
+            break;
+        }
+
+        state_str.append(read_buf, bytes_read);
+    }
+
+    size_t line_start = 0;
+
+    while (line_start < state_str.size()) {
+        size_t line_end = state_str.find('\n', line_start);
+
+        if (line_end == string::npos) {
+            break;
+        }
+
+        lines->push_back(state_str.substr(line_start, line_end - line_start));
+        line_start = line_end + 1;
+    }
+
+    return Status::OK;
+}
+
+int rewriteStateFile(int fd, const string& state_str) {
+    if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) == -1) {
         return Status::ERROR;
     }
 
+    return writeAll(fd, state_str.c_str(), state_str.size());
+}
+
+string digestToHexString(const unsigned char* digest, size_t length) {
     //convert to hex nums string
-    stringstream md5_string;
-    md5_string << hex << uppercase << setfill('0');
+    stringstream hex_string;
+    hex_string << hex << uppercase << setfill('0');
+
+    for (size_t i = 0; i < length; i++) {
+        hex_string << setw(2) << static_cast<int>(digest[i]);
+    }
+
+    return hex_string.str();
+}
+
+string buildChecksumTrailer(ChecksumAlgorithm algorithm, const string& checksum_hex) {
+    string trailer = checksum_hex;
+
+    trailer.push_back(static_cast<char>(checksum_hex.size()));
+    trailer.push_back(static_cast<char>(algorithm));
+    trailer.append(CHECKSUM_TRAILER_MAGIC, sizeof(CHECKSUM_TRAILER_MAGIC));
+
+    return trailer;
+}
 
-    for (const unsigned char& byte : result_as_numbers) {
-        md5_string << setw(2) << static_cast<int>(byte);
+int readChecksumTrailer(int fd, size_t file_size, ChecksumAlgorithm *algorithm, string *checksum_hex, 
+        size_t *trailer_length) {
+    //trailer is never longer than that, single read is enough
+    char file_tail[CHECKSUM_TRAILER_FIXED_LENGTH + UINT8_MAX];
+    size_t file_tail_length = min(file_size, sizeof(file_tail));
+
+    if (preadAll(fd, file_tail, file_tail_length, file_size - file_tail_length) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    return parseChecksumTrailer(file_tail, file_tail_length, algorithm, checksum_hex, trailer_length);
+}
+
+int parseChecksumTrailer(const char* data, size_t length, ChecksumAlgorithm *algorithm, string *checksum_hex, 
+        size_t *trailer_length) {
+    *trailer_length = 0;
+
+    if (length < CHECKSUM_TRAILER_FIXED_LENGTH) {
+        return Status::OK;
+    }
+
+    const char* trailer_fixed_part = data + length - CHECKSUM_TRAILER_FIXED_LENGTH;
+
+    if (memcmp(trailer_fixed_part + 2, CHECKSUM_TRAILER_MAGIC, sizeof(CHECKSUM_TRAILER_MAGIC)) != 0) {
+        //no trailer
+        return Status::OK;
     }
 
-    *out_str = md5_string.str();
+    size_t checksum_length = static_cast<unsigned char>(trailer_fixed_part[0]);
+
+    if (checksum_length == 0 || length < CHECKSUM_TRAILER_FIXED_LENGTH + checksum_length) {
+        errno = EINVAL;
+
+        return Status::ERROR;
+    }
+
+    checksum_hex->assign(trailer_fixed_part - checksum_length, checksum_length);
+
+    *algorithm = static_cast<ChecksumAlgorithm>(trailer_fixed_part[1]);
+    *trailer_length = CHECKSUM_TRAILER_FIXED_LENGTH + checksum_length;
 
     return Status::OK;
 }
@@ -144,3 +318,17 @@ bool startsWith(string str, string pref) {
 
     return str.substr(0, pref.size()) == pref;
 }
+
+uint64_t noteUuidTimestamp(const string& note_name) {
+    //time_low-time_mid-version and time_high-...
+    if (note_name.size() < 18 || note_name[8] != '-' || note_name[13] != '-' || note_name[14] != '1') {
+        return 0;
+    }
+
+    char* parse_end;
+    uint64_t time_low = strtoull(note_name.substr(0, 8).c_str(), &parse_end, 16);
+    uint64_t time_mid = strtoull(note_name.substr(9, 4).c_str(), &parse_end, 16);
+    uint64_t time_high = strtoull(note_name.substr(15, 3).c_str(), &parse_end, 16);
+
+    return time_high << 48 | time_mid << 32 | time_low;
+}
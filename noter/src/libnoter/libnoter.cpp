@@ -0,0 +1,203 @@
+#include "libnoter.h"
+
+#include <errno.h>
+
+#include <ctime>
+#include <string>
+#include <set>
+#include <mutex>
+#include <new>
+#include <exception>
+
+#include "noter_utils.hpp"
+#include "app_config.hpp"
+#include "input_data_consumer.hpp"
+
+using namespace std;
+
+const string LIBNOTER_META_ENTRY_DELIM = ";";
+const string LIBNOTER_META_KEY_VAL_DELIM = ":";
+const string LIBNOTER_META_KEY_CHANNEL = "ch";
+
+//written by noter itself, caller can't override them
+const set<string> LIBNOTER_RESERVED_META_KEYS = {"ts", "os", "cz", "pt", "pi", "pn", "sid", "sq", "rf", "rl"};
+
+
+struct noter_note {
+    InputDataConsumer consumer;
+
+    //host process owns stdout, errors are reported by return value and errno only
+    explicit noter_note(time_t timestamp_sec) : consumer(timestamp_sec, -1) {
+        consumer.setQuiet(true);
+    };
+};
+
+
+//config is read once per process, not per note
+void initLibnoterConfig() {
+    static once_flag config_once;
+
+    call_once(config_once, []() {
+        setStdoutErrorReports(false);
+        AppConfig::init();
+    });
+}
+
+int parseNoteMeta(const char* meta, string *channel, string *extra_meta) {
+    if (meta == nullptr) {
+        return Status::OK;
+    }
+
+    string meta_str(meta);
+    size_t entry_start = 0;
+
+    while (entry_start < meta_str.size()) {
+        size_t entry_end = meta_str.find(LIBNOTER_META_ENTRY_DELIM, entry_start);
+
+        if (entry_end == string::npos) {
+            entry_end = meta_str.size();
+        }
+
+        string entry = meta_str.substr(entry_start, entry_end - entry_start);
+        entry_start = entry_end + 1;
+
+        if (entry.empty()) {
+            continue;
+        }
+
+        //server takes only entries with single delimiter between non empty key and value, the rest is dropped
+        size_t delim_pos = entry.find(LIBNOTER_META_KEY_VAL_DELIM);
+
+        if (delim_pos == 0 || delim_pos == string::npos || delim_pos == entry.size() - 1 
+                || entry.find(LIBNOTER_META_KEY_VAL_DELIM, delim_pos + 1) != string::npos) {
+            return Status::ERROR;
+        }
+
+        string key = entry.substr(0, delim_pos);
+
+        if (key == LIBNOTER_META_KEY_CHANNEL) {
+            *channel = entry.substr(delim_pos + 1);
+
+            continue;
+        }
+
+        if (LIBNOTER_RESERVED_META_KEYS.count(key)) {
+            return Status::ERROR;
+        }
+
+        if (!extra_meta->empty()) {
+            *extra_meta += LIBNOTER_META_ENTRY_DELIM;
+        }
+
+        *extra_meta += entry;
+    }
+
+    return Status::OK;
+}
+
+noter_note* noter_open(const char* meta) {
+    string channel;
+    string extra_meta;
+
+    if (parseNoteMeta(meta, &channel, &extra_meta) != Status::OK) {
+        errno = EINVAL;
+
+        return nullptr;
+    }
+
+    try {
+        initLibnoterConfig();
+
+        noter_note* note = new noter_note(time(nullptr));
+
+        note->consumer.setChannel(channel);
+        note->consumer.setExtraMeta(extra_meta);
+
+        if (note->consumer.openNote() != Status::OK) {
+            int open_errno = errno;
+            delete note;
+            errno = open_errno;
+
+            return nullptr;
+        }
+
+        return note;
+    } catch (const bad_alloc& err) {
+        errno = ENOMEM;
+    } catch (const exception& err) {
+        errno = EIO;
+    }
+
+    return nullptr;
+}
+
+int noter_write(noter_note* note, const void* data, size_t length) {
+    if (note == nullptr || (data == nullptr && length > 0)) {
+        errno = EINVAL;
+
+        return -1;
+    }
+
+    try {
+        return note->consumer.writeNoteData(static_cast<const char*>(data), length) == Status::OK ? 0 : -1;
+    } catch (const bad_alloc& err) {
+        errno = ENOMEM;
+    } catch (const exception& err) {
+        errno = EIO;
+    }
+
+    return -1;
+}
+
+int noter_commit(noter_note* note) {
+    if (note == nullptr) {
+        errno = EINVAL;
+
+        return -1;
+    }
+
+    int res = -1;
+
+    try {
+        res = note->consumer.commitNote() == Status::OK ? 0 : -1;
+    } catch (const bad_alloc& err) {
+        errno = ENOMEM;
+    } catch (const exception& err) {
+        errno = EIO;
+    }
+
+    int commit_errno = errno;
+    delete note;
+    errno = commit_errno;
+
+    return res;
+}
+
+void noter_abort(noter_note* note) {
+    if (note == nullptr) {
+        return;
+    }
+
+    //anonymous out file is gone with its descriptor
+    note->consumer.cleanup(true);
+
+    delete note;
+}
+
+int noter_send(const void* data, size_t length, const char* meta) {
+    noter_note* note = noter_open(meta);
+
+    if (note == nullptr) {
+        return -1;
+    }
+
+    if (noter_write(note, data, length) != 0) {
+        int write_errno = errno;
+        noter_abort(note);
+        errno = write_errno;
+
+        return -1;
+    }
+
+    return noter_commit(note);
+}
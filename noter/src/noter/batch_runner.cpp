@@ -0,0 +1,178 @@
+#include "batch_runner.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <ctime>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <iostream>
+#include <algorithm>
+
+#include "noter_utils.hpp"
+#include "capture_engine.hpp"
+#include "input_data_consumer.hpp"
+#include "note_rate_limit.hpp"
+
+using namespace std;
+
+//65536 = 64 kb
+const size_t PATHS_READ_BUFFER_LENGTH = 65536;
+
+//note being captured by every batch worker, slot per worker. Aborted by signal handler
+atomic<InputDataConsumer*>* active_consumers = nullptr;
+atomic<size_t> active_consumers_num(0);
+
+
+int readNulDelimitedPaths(int fd, vector<string> *paths) {
+    HeapArrayContainer<char> read_buf(PATHS_READ_BUFFER_LENGTH);
+    string path;
+
+    while (true) {
+        ssize_t bytes_read = read(fd, read_buf.data(), PATHS_READ_BUFFER_LENGTH);
+
+        if (bytes_read == -1) {
+            //continue if interrupted
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return Status::ERROR;
+        }
+
+        if (bytes_read == 0) {
+            break;
+        }
+
+        for (ssize_t i = 0; i < bytes_read; i++) {
+            if (read_buf.data()[i] == '\0') {
+                if (!path.empty()) {
+                    paths->push_back(path);
+                }
+
+                path.clear();
+            } else {
+                path.push_back(read_buf.data()[i]);
+            }
+        }
+    }
+
+    //last path may be not terminated
+    if (!path.empty()) {
+        paths->push_back(path);
+    }
+
+    return Status::OK;
+}
+
+int captureFile(const string& file_path, char* capture_buf, atomic<InputDataConsumer*> *active_consumer) {
+    //every file is note of its own from the command that runs batch, so it takes token as separate noter run would
+    bool note_allowed = true;
+
+    if (applyRateLimit("", &note_allowed) == Status::OK && !note_allowed) {
+        return Status::ERROR;
+    }
+
+    int in_fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (in_fd == -1) {
+        cout << "failed to open input file '" << file_path << "': " + string(strerror(errno)) << endl;
+
+        return Status::ERROR;
+    }
+
+    int res;
+
+    {
+        InputDataConsumer input_data_consumer(time(nullptr), in_fd);
+        input_data_consumer.setCaptureBuffer(capture_buf, CaptureEngine::DATA_BUFFER_LENGTH);
+
+        active_consumer->store(&input_data_consumer);
+        res = input_data_consumer.readAndTransferData();
+        active_consumer->store(nullptr);
+    }
+
+    close(in_fd);
+
+    return res;
+}
+
+size_t runBatch(const vector<string>& file_paths, int jobs_num) {
+    atomic<size_t> next_file_index(0);
+    atomic<size_t> failed_num(0);
+    mutex report_mutex;
+
+    size_t threads_num = min(static_cast<size_t>(max(jobs_num, 1)), file_paths.size());
+
+    //there is single worker even for no files
+    size_t slots_num = max(threads_num, static_cast<size_t>(1));
+    unique_ptr<atomic<InputDataConsumer*>[]> consumer_slots(new atomic<InputDataConsumer*>[slots_num]);
+
+    for (size_t i = 0; i < slots_num; i++) {
+        consumer_slots[i].store(nullptr);
+    }
+
+    active_consumers = consumer_slots.get();
+    active_consumers_num = slots_num;
+
+    auto worker = [&](size_t worker_index) {
+        //one capture buffer per worker for all its files
+        HeapArrayContainer<char> capture_buf(CaptureEngine::DATA_BUFFER_LENGTH);
+
+        for (size_t i = next_file_index++; i < file_paths.size(); i = next_file_index++) {
+            if (captureFile(file_paths[i], capture_buf.data(), &consumer_slots[worker_index]) != Status::OK) {
+                failed_num++;
+
+                lock_guard<mutex> report_lock(report_mutex);
+                cout << "failed to create note from '" << file_paths[i] << "'" << endl;
+            }
+        }
+    };
+
+    //workers don't take SIGINT/SIGTERM, so handler runs in main thread and may wait for chunk being published
+    sigset_t worker_sigset;
+    sigset_t prev_sigset;
+    sigemptyset(&worker_sigset);
+    sigaddset(&worker_sigset, SIGINT);
+    sigaddset(&worker_sigset, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &worker_sigset, &prev_sigset);
+
+    vector<thread> threads;
+
+    for (size_t i = 0; i < threads_num; i++) {
+        threads.emplace_back(worker, i);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &prev_sigset, nullptr);
+
+    for (auto& worker_thread : threads) {
+        worker_thread.join();
+    }
+
+    active_consumers_num = 0;
+    active_consumers = nullptr;
+
+    return failed_num;
+}
+
+void abortBatchCaptures() {
+    size_t consumers_num = active_consumers_num;
+
+    for (size_t i = 0; i < consumers_num && active_consumers != nullptr; i++) {
+        InputDataConsumer* consumer = active_consumers[i].load();
+
+        if (consumer == nullptr) {
+            continue;
+        }
+
+        consumer->abortNote(true);
+    }
+}
@@ -0,0 +1,407 @@
+#include "capture_engine.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include <algorithm>
+#include <cstdint>
+
+#include "noter_utils.hpp"
+
+using namespace std;
+
+//1048576 = 1 meg. Single splice() call moves at most pipe capacity anyway
+const size_t SPLICE_CHUNK_LENGTH = 1048576;
+const int SPLICE_PIPE_CAPACITY = 1048576;
+
+//65536 = 64 kb, read/write buffer starts with that (pipe capacity) and grows up to DATA_BUFFER_LENGTH
+const size_t INITIAL_DATA_BUFFER_LENGTH = 65536;
+
+//8388608 = 8 meg. Bigger chunk lets filesystem share/copy larger extents at once
+const size_t COPY_RANGE_CHUNK_LENGTH = 8388608;
+
+
+int CaptureEngine::capture() {
+    //consumer needs data in userspace anyway
+    if (data_consumer_) {
+        method_ = CaptureMethod::READ_WRITE;
+    }
+
+    if (method_ == CaptureMethod::AUTO) {
+        method_ = detectMethod();
+    }
+
+    if (method_ == CaptureMethod::SPLICE) {
+        int res = captureWithSplice();
+
+        //splice is not supported for this pair of descriptors and nothing is moved yet - fall back to read/write
+        if (res != Status::OK && errno == EINVAL && bytes_captured_ == 0 && !limit_exceeded_) {
+            method_ = CaptureMethod::READ_WRITE;
+        } else {
+            return res;
+        }
+    }
+
+    if (method_ == CaptureMethod::CLONE) {
+        int res = captureWithClone();
+
+        //e.g. input is on another filesystem on older kernel or is procfs/sysfs file with fake size
+        if (res != Status::OK && (errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOSYS) 
+                && bytes_captured_ == 0 && !limit_exceeded_) {
+            method_ = CaptureMethod::READ_WRITE;
+        } else {
+            return res;
+        }
+    }
+
+    return captureWithReadWrite();
+}
+
+const char* CaptureEngine::methodName(CaptureMethod method) {
+    switch (method) {
+        case CaptureMethod::SPLICE:
+            return "splice";
+        case CaptureMethod::CLONE:
+            return "clone";
+        case CaptureMethod::READ_WRITE:
+            return "read/write";
+        default:
+            return "auto";
+    }
+}
+
+CaptureMethod CaptureEngine::detectMethod() {
+    struct stat in_stats;
+
+    if (fstat(in_fd_, &in_stats) != 0) {
+        return CaptureMethod::READ_WRITE;
+    }
+
+    //splice() requires one end to be a pipe, output is always a regular file
+    if (S_ISFIFO(in_stats.st_mode)) {
+        return CaptureMethod::SPLICE;
+    }
+
+    //file to file copy can be done by filesystem itself
+    if (S_ISREG(in_stats.st_mode)) {
+        return CaptureMethod::CLONE;
+    }
+
+    return CaptureMethod::READ_WRITE;
+}
+
+int CaptureEngine::captureWithSplice() {
+    //bigger pipe means less splice() calls and writer blocks less often. Best effort, may fail for unprivileged user
+    fcntl(in_fd_, F_SETPIPE_SZ, SPLICE_PIPE_CAPACITY);
+
+    off_t out_offset = lseek(out_fd_, 0, SEEK_CUR);
+
+    if (out_offset == -1) {
+        return Status::ERROR;
+    }
+
+    while (true) {
+        size_t chunk_room;
+
+        if (nextChunkRoom(&chunk_room) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        //next chunk file often gets descriptor number of the sealed one, so switch is told by empty chunk
+        if (out_chunk_written_ == 0) {
+            out_offset = lseek(out_fd_, 0, SEEK_CUR);
+
+            if (out_offset == -1) {
+                return Status::ERROR;
+            }
+        }
+
+        //request one byte over the limit to detect too large input
+        size_t chunk_length = min({SPLICE_CHUNK_LENGTH, max_bytes_ - bytes_captured_ + 1, chunk_room});
+
+        ssize_t res = splice(in_fd_, nullptr, out_fd_, nullptr, chunk_length, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if (res == -1) {
+            //continue if interrupted
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return Status::ERROR;
+        }
+
+        if (res == 0) {
+            //EOF
+            return Status::OK;
+        }
+
+        bytes_captured_ += res;
+        out_chunk_written_ += res;
+
+        if (bytes_captured_ > max_bytes_) {
+            limit_exceeded_ = true;
+
+            return Status::ERROR;
+        }
+
+        //spliced chunk is still hot in page cache, so reading it back costs single copy and no disk I/O
+        if (data_observer_) {
+            //sized by actual chunk, tiny input never allocates full splice chunk
+            char* readback_buffer = dataBuffer(res);
+
+            if (preadAll(out_fd_, readback_buffer, res, out_offset) != Status::OK) {
+                return Status::ERROR;
+            }
+
+            data_observer_(readback_buffer, res);
+        }
+
+        out_offset += res;
+    }
+}
+
+int CaptureEngine::captureWithClone() {
+    struct stat in_stats;
+
+    if (fstat(in_fd_, &in_stats) != 0) {
+        return Status::ERROR;
+    }
+
+    //input may be already partially read (e.g. noter < file after someone else read from shared descriptor)
+    off_t in_offset = lseek(in_fd_, 0, SEEK_CUR);
+    off_t out_offset = lseek(out_fd_, 0, SEEK_CUR);
+
+    if (in_offset == -1 || out_offset == -1) {
+        return Status::ERROR;
+    }
+
+    size_t in_length = static_cast<size_t>(max(in_stats.st_size - in_offset, static_cast<off_t>(0)));
+
+    if (in_length > max_bytes_) {
+        limit_exceeded_ = true;
+        errno = EFBIG;
+
+        return Status::ERROR;
+    }
+
+    //whole file clone shares extents with input (btrfs/xfs reflink), so it costs nothing regardless of size.
+    //Only possible when whole input goes to the beginning of empty output
+    bool fits_out_chunk = out_chunk_bytes_ == 0 || in_length <= out_chunk_bytes_;
+
+    if (in_offset == 0 && out_offset == 0 && in_length > 0 && fits_out_chunk && ioctl(out_fd_, FICLONE, in_fd_) == 0) {
+        bytes_captured_ = in_length;
+        out_chunk_written_ = in_length;
+
+        //clone does not move file offsets, rest of note is appended after cloned data
+        if (lseek(out_fd_, 0, SEEK_END) == -1 || lseek(in_fd_, 0, SEEK_END) == -1) {
+            return Status::ERROR;
+        }
+
+        return data_observer_ || file_observer_ ? observeInputFile(in_offset, in_length) : Status::OK;
+    }
+
+    return copyFileRange(in_offset);
+}
+
+int CaptureEngine::copyFileRange(off_t in_offset) {
+    //start of input range copied to current output chunk but not passed to observer yet
+    off_t unobserved_offset = in_offset;
+
+    while (true) {
+        size_t chunk_room = out_chunk_bytes_ > 0 ? out_chunk_bytes_ - out_chunk_written_ : SIZE_MAX;
+
+        //observer has to see data of output chunk before it is sealed
+        if (chunk_room == 0 && (data_observer_ || file_observer_)) {
+            if (observeInputFile(unobserved_offset, in_offset - unobserved_offset) != Status::OK) {
+                return Status::ERROR;
+            }
+
+            unobserved_offset = in_offset;
+        }
+
+        if (nextChunkRoom(&chunk_room) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        //request one byte over the limit to detect input that grew past the limit
+        size_t chunk_length = min({COPY_RANGE_CHUNK_LENGTH, max_bytes_ - bytes_captured_ + 1, chunk_room});
+
+        //kernel copies page cache to page cache or lets filesystem share extents/do server side copy
+        ssize_t res = copy_file_range(in_fd_, nullptr, out_fd_, nullptr, chunk_length, 0);
+
+        if (res == -1) {
+            //continue if interrupted
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return Status::ERROR;
+        }
+
+        if (res == 0) {
+            //EOF. Files with fake zero size (procfs etc.) also end up here without any data copied
+            if (bytes_captured_ == 0) {
+                struct stat in_stats;
+
+                if (fstat(in_fd_, &in_stats) == 0 && in_stats.st_size == 0) {
+                    errno = EINVAL;
+
+                    return Status::ERROR;
+                }
+            }
+
+            return data_observer_ || file_observer_
+                ? observeInputFile(unobserved_offset, in_offset - unobserved_offset) : Status::OK;
+        }
+
+        bytes_captured_ += res;
+        out_chunk_written_ += res;
+        in_offset += res;
+
+        if (bytes_captured_ > max_bytes_) {
+            limit_exceeded_ = true;
+
+            return Status::ERROR;
+        }
+    }
+}
+
+int CaptureEngine::observeInputFile(off_t in_offset, size_t length) {
+    if (length == 0) {
+        return Status::OK;
+    }
+
+    if (file_observer_) {
+        return file_observer_(in_fd_, in_offset, length);
+    }
+
+    //data never passes through userspace on clone path, so it is read once from input just for observer
+    posix_fadvise(in_fd_, in_offset, length, POSIX_FADV_SEQUENTIAL);
+
+    char* readback_buffer = dataBuffer(min(COPY_RANGE_CHUNK_LENGTH, length));
+
+    while (length > 0) {
+        size_t chunk_length = min(COPY_RANGE_CHUNK_LENGTH, length);
+
+        if (preadAll(in_fd_, readback_buffer, chunk_length, in_offset) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        data_observer_(readback_buffer, chunk_length);
+
+        in_offset += chunk_length;
+        length -= chunk_length;
+    }
+
+    return Status::OK;
+}
+
+int CaptureEngine::captureWithReadWrite() {
+    //buffer starts small, so tiny input does not pay for big allocation, and grows while reads fill it up.
+    //External buffer is already there, so it is used in full right away
+    size_t data_buffer_length = max(INITIAL_DATA_BUFFER_LENGTH, min(external_buf_length_, DATA_BUFFER_LENGTH));
+    char* data_buffer = dataBuffer(data_buffer_length);
+
+    while (true) {
+        ssize_t bytes_read = read(in_fd_, data_buffer, data_buffer_length);
+
+        if (bytes_read == -1) {
+            //continue if interrupted
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return Status::ERROR;
+        }
+
+        if (bytes_read == 0) {
+            //EOF
+            return Status::OK;
+        }
+
+        bytes_captured_ += bytes_read;
+
+        if (bytes_captured_ > max_bytes_) {
+            limit_exceeded_ = true;
+
+            return Status::ERROR;
+        }
+
+        if (data_consumer_) {
+            if (data_consumer_(data_buffer, bytes_read) != Status::OK) {
+                return Status::ERROR;
+            }
+        } else if (writeDataToOutput(data_buffer, bytes_read) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        if (static_cast<size_t>(bytes_read) == data_buffer_length && data_buffer_length < DATA_BUFFER_LENGTH) {
+            data_buffer_length = min(data_buffer_length * 2, DATA_BUFFER_LENGTH);
+            data_buffer = dataBuffer(data_buffer_length);
+        }
+    }
+}
+
+int CaptureEngine::writeDataToOutput(const char* data_buffer, size_t length) {
+    //read data may span several output chunks
+    for (const char* data_ptr = data_buffer; data_ptr < data_buffer + length; ) {
+        size_t chunk_room;
+
+        if (nextChunkRoom(&chunk_room) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        size_t piece_length = min(static_cast<size_t>(data_buffer + length - data_ptr), chunk_room);
+
+        if (writeAll(out_fd_, data_ptr, piece_length) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        if (data_observer_) {
+            data_observer_(data_ptr, piece_length);
+        }
+
+        out_chunk_written_ += piece_length;
+        data_ptr += piece_length;
+    }
+
+    return Status::OK;
+}
+
+char* CaptureEngine::dataBuffer(size_t length) {
+    if (external_buf_ != nullptr && external_buf_length_ >= length) {
+        return external_buf_;
+    }
+
+    //grows on demand, e.g. read/write fallback after splice needs bigger buffer than splice readback
+    if (!data_buf_container_ || data_buf_length_ < length) {
+        data_buf_container_ = make_unique<HeapArrayContainer<char>>(length);
+        data_buf_length_ = length;
+    }
+
+    return data_buf_container_->data();
+}
+
+int CaptureEngine::nextChunkRoom(size_t *room) {
+    if (out_chunk_bytes_ == 0) {
+        *room = SIZE_MAX;
+
+        return Status::OK;
+    }
+
+    if (out_chunk_written_ >= out_chunk_bytes_) {
+        if (chunk_sealer_(&out_fd_) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        out_chunk_written_ = 0;
+    }
+
+    *room = out_chunk_bytes_ - out_chunk_written_;
+
+    return Status::OK;
+}
@@ -0,0 +1,81 @@
+#include "debug_echo.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+
+void DebugEcho::consume(const char* data, size_t length) {
+    bytes_consumed_ += length;
+
+    if (max_bytes_ == 0) {
+        return;
+    }
+
+    if (mode_ == DebugEchoMode::TAIL) {
+        consumeToRing(data, length);
+
+        return;
+    }
+
+    size_t length_to_echo = min(length, max_bytes_ - bytes_echoed_);
+
+    if (length_to_echo > 0) {
+        cout.write(data, length_to_echo);
+        bytes_echoed_ += length_to_echo;
+    }
+}
+
+void DebugEcho::finish() {
+    if (max_bytes_ == 0) {
+        return;
+    }
+
+    if (mode_ == DebugEchoMode::TAIL && bytes_consumed_ > 0) {
+        if (bytes_consumed_ > max_bytes_) {
+            cout << "[debug echo: skipped first " << bytes_consumed_ - max_bytes_ << " bytes]" << endl;
+        }
+
+        //oldest data is right after current write position once ring is filled
+        if (ring_filled_) {
+            cout.write(ring_.data() + ring_pos_, ring_.size() - ring_pos_);
+        }
+
+        cout.write(ring_.data(), ring_pos_);
+        bytes_echoed_ = min(bytes_consumed_, max_bytes_);
+    }
+
+    if (bytes_echoed_ < bytes_consumed_) {
+        cout << endl << "[debug echo: shown " << bytes_echoed_ << " of " << bytes_consumed_ << " bytes]";
+    }
+
+    cout << flush;
+}
+
+void DebugEcho::consumeToRing(const char* data, size_t length) {
+    if (ring_.empty()) {
+        ring_.resize(max_bytes_);
+    }
+
+    //only last max_bytes of chunk can survive in ring
+    if (length >= max_bytes_) {
+        memcpy(ring_.data(), data + length - max_bytes_, max_bytes_);
+        ring_pos_ = 0;
+        ring_filled_ = true;
+
+        return;
+    }
+
+    size_t length_till_ring_end = min(length, max_bytes_ - ring_pos_);
+
+    memcpy(ring_.data() + ring_pos_, data, length_till_ring_end);
+    memcpy(ring_.data(), data + length_till_ring_end, length - length_till_ring_end);
+
+    if (ring_pos_ + length >= max_bytes_) {
+        ring_filled_ = true;
+    }
+
+    ring_pos_ = (ring_pos_ + length) % max_bytes_;
+}
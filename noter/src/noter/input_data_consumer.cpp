@@ -1,19 +1,33 @@
 #include "input_data_consumer.hpp"
 
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
 
 #include <ctime>
 #include <cstring>
 #include <string>
 #include <iostream>
-#include <fstream>
 #include <array>
-#include <vector>
+#include <memory>
+#include <algorithm>
+#include <mutex>
 
 #include "sole.hpp"
 
 #include "noter_utils.hpp"
 #include "app_config.hpp"
+#include "capture_engine.hpp"
+#include "debug_echo.hpp"
+#include "note_compressor.hpp"
+#include "local_socket.hpp"
+#include "note_dedup.hpp"
+#include "note_ring.hpp"
 
 #ifndef NDEBUG
     const bool DEBUG_ENABLED = true;
@@ -27,172 +41,1045 @@ extern const string OUT_FILES_TMP_DIR;
 extern const size_t MAX_OUT_FILE_SIZE;
 extern const string OUT_FILE_TMP_PREFIX;
 
-//10485760 = 10 meg
-const int FILE_READ_BUFFER_LENGTH = 10485760;
+//1048576 = 1 meg
+const long DEFAULT_DEBUG_ECHO_MAX_BYTES = 1048576L;
 
 const string META_KEY_TIMESTAMP = "ts";
 const string META_KEY_OS = "os";
 const string META_KEY_CHANNEL = "ch";
+const string META_KEY_COMPRESSION = "cz";
+const string META_KEY_CHUNK_PARENT = "pt";
+const string META_KEY_CHUNK_INDEX = "pi";
+const string META_KEY_CHUNK_COUNT = "pn";
+const string META_KEY_STREAM_ID = "sid";
+const string META_KEY_STREAM_SEQUENCE = "sq";
+const string META_KEY_REFERENCE = "rf";
 
+//67108864 = 64 meg
+const long DEFAULT_SPOOL_CHUNK_BYTES = 67108864L;
+//1048576 = 1 meg
+const long MIN_SPOOL_CHUNK_BYTES = 1048576L;
+
+//1048576 = 1 meg
+const long DEFAULT_FOLLOW_NOTE_MAX_BYTES = 1048576L;
+const long DEFAULT_FOLLOW_NOTE_MAX_SEC = 10L;
+//1048576 = 1 meg
+const size_t FOLLOW_READ_BUFFER_LENGTH = 1048576;
+//stop request is checked at least that often while input is quiet
+const int FOLLOW_IDLE_POLL_TIMEOUT_MS = 1000;
+
+//0 - notes are never deduplicated
+const long DEFAULT_DEDUP_WINDOW_SEC = 0L;
+
+//4096 = 4 kb, most notes are smaller than that. 0 - ring tier of spool is not used
+const long DEFAULT_SPOOL_RING_MAX_NOTE_BYTES = 4096L;
+//1048576 = 1 meg, ring note is kept in memory while written
+const long MAX_SPOOL_RING_MAX_NOTE_BYTES = 1048576L;
+
+
+bool random_note_uuid_node = false;
+
+
+void useRandomNoteUuidNode() {
+    random_note_uuid_node = true;
+}
+
+uint64_t noteUuidNode() {
+    uint64_t node;
+
+    //RFC 4122, section 4.5 - random node has multicast bit set, so it never clashes with real MAC address
+    if (random_note_uuid_node && getrandom(&node, sizeof(node), 0) == sizeof(node)) {
+        return (node & 0xffffffffffffULL) | 0x010000000000ULL;
+    }
+
+    //sole::uuid1() enumerates network interfaces to get MAC address
+    return sole::uuid1().cd & 0xffffffffffffULL;
+}
+
+/**
+ * Marks note as being published while in scope - abortNote() called from other thread (batch worker aborted 
+ * by signal) waits for it. Nothing is published once note is aborted
+*/
+class NotePublishGuard {
+public:
+    NotePublishGuard(atomic<bool> *publishing, const atomic<bool>& aborted) : publishing_(publishing) {
+        publishing_->store(true);
+        aborted_ = aborted.load();
+
+        if (aborted_) {
+            errno = ECANCELED;
+        }
+    };
+    ~NotePublishGuard() { publishing_->store(false); };
+
+    NotePublishGuard(const NotePublishGuard& other) = delete;
+    NotePublishGuard& operator= (const NotePublishGuard& other) = delete;
+
+    bool aborted() const { return aborted_; }
+private:
+    atomic<bool>* publishing_;
+    bool aborted_;
+};
+
+//shared by all notes of process, e.g. all notes created through libnoter. Ring that is not there yet (or is 
+//replaced by noterd later) is mapped by append()
+NoteRing* spoolRing() {
+    static NoteRing ring;
+    static const int ring_open_res = openSpoolRing(&ring);
+    (void) ring_open_res;
+
+    return &ring;
+}
+
+string newNoteUuid() {
+    //sole::uuid1() keeps last timestamp per thread only, so parallel captures could get the same id
+    static mutex uuid_mutex;
+    static uint64_t last_ns100_intervals = 0;
+
+    lock_guard<mutex> uuid_lock(uuid_mutex);
+
+    //node is looked up once per process
+    static const uint64_t node = noteUuidNode();
+
+    //same layout as sole::uuid1() - number of 100-ns intervals since 15 October 1582, clock sequence and node
+    uint64_t ns100_intervals = max(sole::get_time(0x01b21dd213814000ULL), last_ns100_intervals + 1);
+    last_ns100_intervals = ns100_intervals;
+
+    uint64_t clock_seq = ns100_intervals & 0x3fff;
+
+    uint64_t ab = (ns100_intervals & 0xffffffff) << 32 
+        | ((ns100_intervals >> 32) & 0xffff) << 16 
+        | ((ns100_intervals >> 48) & 0x0fff) 
+        //version 1
+        | 0x1000;
+    //RFC 4122 variant
+    uint64_t cd = (clock_seq | 0x8000) << 48 | node;
+
+    return sole::rebuild(ab, cd).str();
+}
+
+ostream& InputDataConsumer::errorOut() {
+    //per thread - stream without buffer sets its error state on every write
+    static thread_local ostream discarded(nullptr);
+
+    return quiet_ ? discarded : cout;
+}
 
 int InputDataConsumer::readAndTransferData() {
-    //reopen stdin in binary mode
-    freopen(nullptr, "rb", stdin);
-    
-    if (ferror(stdin)) {
-        cout << "error while re-opening stdin: " + string(strerror(errno)) << endl;
-        
+    //if DEBUG - log transfered data to stdout as it comes, memory used for that is capped
+    if (DEBUG_ENABLED) {
+        debug_echo_ = make_unique<DebugEcho>(
+            AppConfig::getLongValue(CONFIG_DEBUG_ECHO_MAX_BYTES, DEFAULT_DEBUG_ECHO_MAX_BYTES), 
+            DebugEcho::parseMode(AppConfig::getValue(CONFIG_DEBUG_ECHO_MODE))
+        );
+    }
+
+    //small input goes to ring tier of spool - no file is created for it. Bigger one is captured as usual,
+    //its beginning read here is written to out file first
+    string small_input;
+    bool input_complete = false;
+
+    if (initRingTier() && readSmallInput(&small_input, &input_complete) != Status::OK) {
+        errorOut() << "error while reading input: " + string(strerror(errno)) << endl;
+
         return Status::ERROR;
     }
 
-    if (!fileExists(OUT_FILES_TMP_DIR)) {
-        if (createDirectories(OUT_FILES_TMP_DIR) != 0) {
-            cout << "failed to create output file directory" << endl;
-        
+    if (input_complete) {
+        //empty input
+        if (small_input.empty()) {
+            return Status::OK;
+        }
+
+        if (debug_echo_) {
+            debug_echo_->consume(small_input.c_str(), small_input.size());
+        }
+
+        if (publishSmallNote(small_input) != Status::OK) {
+            cleanup(true);
+
             return Status::ERROR;
         }
+
+        if (debug_echo_) {
+            debug_echo_->finish();
+        }
+
+        cleanup(false);
+
+        return Status::OK;
+    }
+
+    //open output file (spool dir is created by the first note)
+
+    if (openNextOutFile() != Status::OK) {
+        errorOut() << "error while opening output file: " + string(strerror(errno)) << endl;
+        
+        return Status::ERROR;
+    }
+
+    initCompressor();
+    initChunking();
+
+    //input read while checking its size, engine continues after it (in the next chunk file if it got sealed)
+    if (!small_input.empty() && consumeForCompression(small_input.c_str(), small_input.size()) != Status::OK) {
+        cleanup(true);
+
+        errorOut() << "error while writing to out file: " + string(strerror(errno)) << endl;
+
+        return Status::ERROR;
+    }
+
+    CaptureEngine capture_engine(in_fd_, out_fd_, MAX_OUT_FILE_SIZE - small_input.size());
+
+    if (capture_buf_ != nullptr) {
+        capture_engine.setDataBuffer(capture_buf_, capture_buf_length_);
+    }
+
+    if (out_chunk_bytes_ > 0) {
+        capture_engine.setOutputChunking(out_chunk_bytes_, out_chunk_written_, [this](int* out_fd) {
+            if (sealOutFileChunk() != Status::OK) {
+                return static_cast<int>(Status::ERROR);
+            }
+
+            *out_fd = out_fd_;
+
+            return static_cast<int>(Status::OK);
+        });
+    }
+
+    if (compressor_) {
+        //data is compressed on the fly, checksum is calculated over compressed data as it is written
+        capture_engine.setDataConsumer([this](const char* data, size_t length) {
+            return consumeForCompression(data, length);
+        });
+    } else {
+        //checksum is calculated over the same chunks as they are captured, no need to re-read out file after
+        capture_engine.setDataObserver([this](const char* data, size_t length) {
+            out_file_checksum_->update(data, length);
+
+            if (debug_echo_) {
+                debug_echo_->consume(data, length);
+            }
+        });
+    }
+
+    //on clone path data never passes through userspace - checksum reads input file itself (in parallel for tree one)
+    if (!compressor_ && !debug_echo_) {
+        capture_engine.setFileObserver([this](int fd, off_t offset, size_t length) {
+            return out_file_checksum_->updateFromFile(fd, offset, length);
+        });
+    }
+
+    if (capture_engine.capture() != Status::OK) {
+        cleanup(true);
+
+        if (capture_engine.limit_exceeded()) {
+            errorOut() << "input size it too large. Max is " << MAX_OUT_FILE_SIZE << " bytes" << endl;
+        } else {
+            errorOut() << "error while transferring input to out file (" << CaptureEngine::methodName(capture_engine.method_used()) 
+                << "): " + string(strerror(errno)) << endl;
+        }
+
+        return Status::ERROR;
+    }
+
+    size_t bytes_read_total = capture_engine.bytes_captured() + small_input.size();
+
+    if (!bytes_read_total) {
+        //empty input
+        cleanup(true);
+
+        return Status::OK;
     }
 
-    //open output file
+    if (finishNote() != Status::OK) {
+        cleanup(true);
+
+        return Status::ERROR;
+    }
+
+    //if DEBUG - finish logging transfered data to stdout
+    if (debug_echo_) {
+        debug_echo_->finish();
+    }
     
-    out_file_uuid_ = sole::uuid1().str();
-    out_file_path_final_ = OUT_FILES_TMP_DIR + out_file_uuid_;
-    out_file_path_tmp_ = OUT_FILES_TMP_DIR + OUT_FILE_TMP_PREFIX + out_file_uuid_;
+    cleanup(false);
 
-    out_file_stream_ = ofstream(out_file_path_tmp_, ios::out | ios::binary);
+    return Status::OK;
+}
 
-    if (!out_file_stream_.is_open() || !out_file_stream_.good()) {
-        cout << "error while opening output file: " + string(strerror(errno)) << endl;
+int InputDataConsumer::openNote() {
+    //out file is opened only once note outgrows ring
+    if (initRingTier()) {
+        ring_staging_ = true;
+
+        return Status::OK;
+    }
+
+    return openNoteOutFile();
+}
+
+int InputDataConsumer::openNoteOutFile() {
+    if (openNextOutFile() != Status::OK) {
+        errorOut() << "error while opening output file: " + string(strerror(errno)) << endl;
         
         return Status::ERROR;
     }
-    
-    HeapArrayContainer<char> data_buf_container(FILE_READ_BUFFER_LENGTH);
-    char* data_buffer = data_buf_container.data();
-    size_t bytes_read = 0;
-    size_t bytes_read_total = 0;
 
-    vector<char> input_data_log;
+    initCompressor();
+    initChunking();
 
-    while ((bytes_read = fread(data_buffer, sizeof(data_buffer[0]), FILE_READ_BUFFER_LENGTH, stdin))) {
-        if (ferror(stdin) && !feof(stdin)) {
-            cleanup(true);
+    return Status::OK;
+}
+
+int InputDataConsumer::writeNoteData(const char* data, size_t length) {
+    //same limit as for captured input
+    if (length > MAX_OUT_FILE_SIZE - note_bytes_written_) {
+        errorOut() << "input size it too large. Max is " << MAX_OUT_FILE_SIZE << " bytes" << endl;
+        errno = EFBIG;
+
+        return Status::ERROR;
+    }
 
-            cout << "error while reading stdin: " + string(strerror(errno)) << endl;
+    if (length == 0) {
+        return Status::OK;
+    }
+
+    if (ring_staging_) {
+        if (ring_note_body_.size() + length <= ring_max_note_bytes_) {
+            ring_note_body_.append(data, length);
+            note_bytes_written_ += length;
+
+            return Status::OK;
+        }
 
+        if (spillStagedNote() != Status::OK) {
             return Status::ERROR;
         }
+    }
 
-        bytes_read_total += bytes_read;
+    if (consumeForCompression(data, length) != Status::OK) {
+        errorOut() << "error while writing to out file: " + string(strerror(errno)) << endl;
 
-        if (bytes_read_total > MAX_OUT_FILE_SIZE) {
-            cleanup(true);
+        return Status::ERROR;
+    }
+
+    note_bytes_written_ += length;
+
+    return Status::OK;
+}
+
+int InputDataConsumer::commitNote() {
+    if (note_bytes_written_ == 0) {
+        //empty input
+        cleanup(true);
+
+        return Status::OK;
+    }
+
+    int res = ring_staging_ ? publishSmallNote(ring_note_body_) : finishNote();
+
+    cleanup(res != Status::OK);
+
+    return res;
+}
+
+int InputDataConsumer::spillStagedNote() {
+    ring_staging_ = false;
+
+    if (openNoteOutFile() != Status::OK) {
+        return Status::ERROR;
+    }
+
+    if (consumeForCompression(ring_note_body_.c_str(), ring_note_body_.size()) != Status::OK) {
+        errorOut() << "error while writing to out file: " + string(strerror(errno)) << endl;
+
+        return Status::ERROR;
+    }
+
+    ring_note_body_.clear();
+
+    return Status::OK;
+}
+
+bool InputDataConsumer::initRingTier() {
+    ring_max_note_bytes_ = static_cast<size_t>(clamp(
+        AppConfig::getLongValue(CONFIG_SPOOL_RING_MAX_NOTE_BYTES, DEFAULT_SPOOL_RING_MAX_NOTE_BYTES), 
+        0L, MAX_SPOOL_RING_MAX_NOTE_BYTES
+    ));
+
+    return ring_max_note_bytes_ > 0;
+}
+
+int InputDataConsumer::readSmallInput(string *data, bool *input_complete) {
+    *input_complete = false;
+
+    struct stat in_stats;
+
+    //big file is captured without reading it here, e.g. cloned
+    if (fstat(in_fd_, &in_stats) == 0 && S_ISREG(in_stats.st_mode) 
+            && static_cast<size_t>(in_stats.st_size) > ring_max_note_bytes_) {
+        return Status::OK;
+    }
+
+    //one byte over the limit tells input doesn't fit ring
+    data->resize(ring_max_note_bytes_ + 1);
+    size_t length = 0;
+
+    while (length < data->size()) {
+        ssize_t bytes_read = read(in_fd_, data->data() + length, data->size() - length);
+
+        if (bytes_read == -1) {
+            //continue if interrupted
+            if (errno == EINTR) {
+                continue;
+            }
 
-            cout << "input size it too large. Max is " << MAX_OUT_FILE_SIZE << " bytes" << endl;
-            
             return Status::ERROR;
         }
 
-        if (DEBUG_ENABLED) {
-            input_data_log.insert(input_data_log.end(), data_buffer, data_buffer + bytes_read);
+        if (bytes_read == 0) {
+            //EOF
+            *input_complete = true;
+
+            break;
         }
 
-        out_file_stream_.write(data_buffer, bytes_read);
+        length += bytes_read;
+    }
 
-        if (!out_file_stream_.good()) {
-            cleanup(true);
+    data->resize(length);
+
+    return Status::OK;
+}
+
+int InputDataConsumer::publishSmallNote(const string& body) {
+    if (out_file_checksum_) {
+        out_file_checksum_->reset();
+    } else {
+        initChecksum();
+    }
+
+    out_file_uuid_ = newNoteUuid();
+    out_file_path_final_ = OUT_FILES_TMP_DIR + out_file_uuid_;
+    out_file_path_tmp_.clear();
+
+    //small note is not worth compressing
+    compressor_.reset();
+
+    //same layout as spool file - body, header, checksum trailer
+    string note_str = body;
+    out_file_checksum_->update(body.c_str(), body.size());
+
+    long dedup_window_sec = AppConfig::getLongValue(CONFIG_DEDUP_WINDOW_SEC, DEFAULT_DEDUP_WINDOW_SEC);
+    string body_checksum;
+    string recent_note_name;
+
+    if (dedup_window_sec > 0 && out_file_checksum_->hexDigest(&body_checksum) == Status::OK 
+            && dedupKey(&body_checksum) == Status::OK
+            && findRecentNote(body_checksum, dedup_window_sec, &recent_note_name) == Status::OK 
+            && !recent_note_name.empty()) {
+        note_str.clear();
+        out_file_checksum_->reset();
+        reference_note_uuid_ = recent_note_name;
+    }
+
+    string header_str = buildHeader(true);
+    out_file_checksum_->update(header_str.c_str(), header_str.size());
+    note_str += header_str;
+
+    string checksum_str;
+
+    if (out_file_checksum_->hexDigest(&checksum_str) != Status::OK) {
+        errorOut() << "error while caculating file checksum" << endl;
+
+        return Status::ERROR;
+    }
+
+    note_str += buildChecksumTrailer(out_file_checksum_->algorithm(), checksum_str);
+
+    NoteRing* ring = spoolRing();
+
+    //ring is not available or full - note is written to spool dir as usual
+    if (ring == nullptr || ring->append(out_file_uuid_, note_str.c_str(), note_str.size()) != Status::OK) {
+        if (openOutFile() != Status::OK || writeAll(out_fd_, note_str.c_str(), note_str.size()) != Status::OK 
+                || publishOutFile() != Status::OK) {
+            errorOut() << "error while writing out file: " + string(strerror(errno)) << endl;
+
+            return Status::ERROR;
+        }
+
+        int close_res = close(out_fd_);
+        out_fd_ = -1;
+
+        if (close_res != 0) {
+            errorOut() << "error after writing all data to out file: " + string(strerror(errno)) << endl;
 
-            cout << "error while writing data to out file: " + string(strerror(errno)) << endl;
-            
             return Status::ERROR;
         }
     }
 
-    if (!bytes_read_total) {
-        //empty input
-        cleanup(true);
+    note_published_ = true;
+    notifyDaemon(out_file_uuid_);
+
+    //only note with body can be referred to, and only once it is published
+    if (!body_checksum.empty() && reference_note_uuid_.empty()) {
+        recordRecentNote(body_checksum, out_file_uuid_, dedup_window_sec);
+    }
+
+    return Status::OK;
+}
+
+int InputDataConsumer::followAndTransferData() {
+    //every note of the stream refers to stream id and has its sequence number
+    stream_id_ = newNoteUuid();
+
+    size_t note_max_bytes = static_cast<size_t>(clamp(
+        AppConfig::getLongValue(CONFIG_FOLLOW_NOTE_MAX_BYTES, DEFAULT_FOLLOW_NOTE_MAX_BYTES), 
+        1L, static_cast<long>(MAX_OUT_FILE_SIZE)
+    ));
+    long note_max_sec = max(AppConfig::getLongValue(CONFIG_FOLLOW_NOTE_MAX_SEC, DEFAULT_FOLLOW_NOTE_MAX_SEC), 1L);
+
+    if (openNextOutFile() != Status::OK) {
+        errorOut() << "error while opening output file: " + string(strerror(errno)) << endl;
+        
+        return Status::ERROR;
+    }
+
+    initCompressor();
+
+    HeapArrayContainer<char> data_buf(FOLLOW_READ_BUFFER_LENGTH);
+
+    size_t note_bytes = 0;
+    time_t note_start_time_sec = 0;
+    int res = Status::OK;
+
+    while (!stop_requested_) {
+        //wake up in time to publish collected data even if input is quiet
+        int timeout_ms = note_bytes > 0 
+            ? max(static_cast<int>(note_start_time_sec + note_max_sec - time(0)) * 1000, 0) 
+            : FOLLOW_IDLE_POLL_TIMEOUT_MS;
+
+        struct pollfd poll_descr;
+        poll_descr.fd = in_fd_;
+        poll_descr.events = POLLIN;
+
+        int ready_num = poll(&poll_descr, 1, timeout_ms);
+
+        if (ready_num == -1) {
+            //interrupted, e.g. by termination signal
+            if (errno == EINTR) {
+                continue;
+            }
+
+            errorOut() << "error while waiting for input: " + string(strerror(errno)) << endl;
+            res = Status::ERROR;
+
+            break;
+        }
+
+        if (ready_num > 0) {
+            ssize_t bytes_read = read(in_fd_, data_buf.data(), min(FOLLOW_READ_BUFFER_LENGTH, note_max_bytes - note_bytes));
+
+            if (bytes_read == -1) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    continue;
+                }
+
+                errorOut() << "error while reading input: " + string(strerror(errno)) << endl;
+                res = Status::ERROR;
+
+                break;
+            }
+
+            if (bytes_read == 0) {
+                //EOF
+                break;
+            }
+
+            if (note_bytes == 0) {
+                note_start_time_sec = time(0);
+                timestamp_sec_ = note_start_time_sec;
+            }
+
+            if (consumeForCompression(data_buf.data(), bytes_read) != Status::OK) {
+                errorOut() << "error while writing to out file: " + string(strerror(errno)) << endl;
+                res = Status::ERROR;
+
+                break;
+            }
+
+            note_bytes += bytes_read;
+        }
+
+        if (note_bytes > 0 && (note_bytes >= note_max_bytes || time(0) - note_start_time_sec >= note_max_sec)) {
+            if (publishFollowNote() != Status::OK) {
+                res = Status::ERROR;
+
+                break;
+            }
+
+            note_bytes = 0;
+        }
+    }
+
+    //whatever is collected when stream ends or noter is stopped is published as last note
+    if (note_bytes > 0 && res == Status::OK && publishFollowNote() != Status::OK) {
+        res = Status::ERROR;
+    }
 
+    cleanup(res != Status::OK);
+
+    return res;
+}
+
+int InputDataConsumer::publishFollowNote() {
+    if (compressor_ && compressor_->finish(out_file_sink_) != Status::OK) {
+        errorOut() << "error while finishing compression of out file: " + string(strerror(errno)) << endl;
+
+        return Status::ERROR;
+    }
+
+    if (finishOutFile(true) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    stream_sequence_++;
+
+    if (openNextOutFile() != Status::OK) {
+        errorOut() << "error while opening output file: " + string(strerror(errno)) << endl;
+
+        return Status::ERROR;
+    }
+
+    //every note is compressed separately
+    compression_decided_ = false;
+    initCompressor();
+
+    return Status::OK;
+}
+
+int InputDataConsumer::dedupOutFile(const string& body_checksum, long window_sec) {
+    string recent_note_name;
+
+    //index is best effort, note is published in full if it can't be read
+    if (findRecentNote(body_checksum, window_sec, &recent_note_name) != Status::OK || recent_note_name.empty()) {
         return Status::OK;
     }
-    
+
+    if (ftruncate(out_fd_, 0) != 0 || lseek(out_fd_, 0, SEEK_SET) == -1) {
+        return Status::ERROR;
+    }
+
+    //reference note has only header, its checksum starts over
+    out_file_checksum_->reset();
+    compressor_.reset();
+    reference_note_uuid_ = recent_note_name;
+
+    return Status::OK;
+}
+
+int InputDataConsumer::dedupKey(string *body_checksum) {
+    //note may be referred to only by note going to the same channel with the same caller meta
+    string channel = !channel_.empty() ? channel_ : AppConfig::getValue(CONFIG_KEY_CHANNEL);
+    string key_str = *body_checksum + '\n' + (channel != "" ? channel : "default") + '\n' + extra_meta_;
+    unique_ptr<ChecksumCalculator> key_checksum = ChecksumCalculator::create(out_file_checksum_->algorithm());
+
+    if (!key_checksum) {
+        body_checksum->clear();
+
+        return Status::ERROR;
+    }
+
+    key_checksum->update(key_str.c_str(), key_str.size());
+
+    if (key_checksum->hexDigest(body_checksum) != Status::OK) {
+        body_checksum->clear();
+
+        return Status::ERROR;
+    }
+
+    return Status::OK;
+}
+
+int InputDataConsumer::finishOutFile(bool last_chunk) {
     //write header to tail of out file
-    if (writeHeaderToOutFile() != 0) {
-        cleanup(true);
+    if (writeHeaderToOutFile(last_chunk) != 0) {
+        errorOut() << "error during writing headers to out file" << endl;
         
-        cout << "error during writing headers to out file" << endl;
+        return Status::ERROR;
+    }
+    
+    //checksum goes to trailer of out file, so note is published as single complete file
+    if (writeChecksumTrailer() != Status::OK) {
+        errorOut() << "error during writing checksum to out file" << endl;
         
         return Status::ERROR;
     }
     
+    //give out file its final name
+    if (publishOutFile() != Status::OK) {
+        errorOut() << "error during publishing out file: " + string(strerror(errno)) << endl;
+        
+        return Status::ERROR;
+    }
+
+    //published chunk may be sent by noterd right away, it is deleted again only if note is aborted
+    if (last_chunk) {
+        note_published_ = true;
+    } else {
+        published_chunk_paths_.push_back(out_file_path_final_);
+    }
+
     //close out file
-    out_file_stream_.close();
+    int close_res = close(out_fd_);
+    out_fd_ = -1;
 
-    if (!out_file_stream_.good()) {
-        cleanup(true);
-        
-        cout << "error after writing all data to out file: " + string(strerror(errno)) << endl;
+    if (close_res != 0) {
+        errorOut() << "error after writing all data to out file: " + string(strerror(errno)) << endl;
         
         return Status::ERROR;
     }
     
-    //create checksum file for out file
-    md5_file_name_ = OUT_FILES_TMP_DIR + out_file_uuid_ + ".md5";
-    
-    if (createChecksumFile(out_file_path_tmp_, md5_file_name_) != 0) {
-        cleanup(true);
-        
-        cout << "error during writing checksum file" << endl;
-        
+    //let daemon send note right away. If it is not running note stays in spool dir till it is up
+    notifyDaemon(out_file_uuid_);
+
+    return Status::OK;
+}
+
+int InputDataConsumer::finishNote() {
+    //flush rest of compressed stream
+    if (compressor_ && compressor_->finish(out_file_sink_) != Status::OK) {
+        errorOut() << "error while finishing compression of out file: " + string(strerror(errno)) << endl;
+
         return Status::ERROR;
     }
     
-    //rename file to final value
-    if (renameFile(out_file_path_tmp_, out_file_path_final_) != 0) {
-        cleanup(true);
-        
-        cout << "error during renaming out file" << endl;
-        
+    //e.g. output of monitoring script run every minute - only reference to recent note with the same body is published
+    long dedup_window_sec = AppConfig::getLongValue(CONFIG_DEDUP_WINDOW_SEC, DEFAULT_DEDUP_WINDOW_SEC);
+    string body_checksum;
+
+    if (dedup_window_sec > 0 && note_uuid_.empty() && out_file_checksum_->hexDigest(&body_checksum) == Status::OK 
+            && dedupKey(&body_checksum) == Status::OK && dedupOutFile(body_checksum, dedup_window_sec) != Status::OK) {
+        errorOut() << "error while replacing out file body with reference: " + string(strerror(errno)) << endl;
+
         return Status::ERROR;
     }
     
-    //if DEBUG - log all transfered data to stdout
-    if (DEBUG_ENABLED) {
-        for (auto b : input_data_log) {
-            cout << static_cast<char>(b);
+    NotePublishGuard publish_guard(&publishing_, aborted_);
+
+    if (publish_guard.aborted()) {
+        return Status::ERROR;
+    }
+
+    //header, checksum, publish
+    if (finishOutFile(true) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    //only note with body can be referred to, and only once it is published
+    if (!body_checksum.empty() && reference_note_uuid_.empty()) {
+        recordRecentNote(body_checksum, out_file_uuid_, dedup_window_sec);
+    }
+
+    return Status::OK;
+}
+
+int InputDataConsumer::sealOutFileChunk() {
+    //chunk, its record and abort marker of next one are complete before abortNote() goes on
+    NotePublishGuard publish_guard(&publishing_, aborted_);
+
+    if (publish_guard.aborted()) {
+        return Status::ERROR;
+    }
+
+    //from now on note is sent in chunks, every chunk refers to id of whole note
+    if (chunk_index_ == 0) {
+        note_uuid_ = newNoteUuid();
+    }
+
+    if (finishOutFile(false) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    //next chunk is separate spool file with its own checksum
+    chunk_index_++;
+    out_chunk_written_ = 0;
+
+    if (openNextOutFile() != Status::OK) {
+        errorOut() << "error while opening output file chunk: " + string(strerror(errno)) << endl;
+
+        return Status::ERROR;
+    }
+
+    prepareChunkAbortMarker();
+
+    return Status::OK;
+}
+
+void InputDataConsumer::prepareChunkAbortMarker() {
+    //zero count on chunk of note tells server to drop the note. Marker uuid is newer than any chunk published
+    string header_str = META_KEY_TIMESTAMP + ":" + to_string(timestamp_sec_) + ";" 
+        + META_KEY_CHUNK_PARENT + ":" + note_uuid_ + ";" 
+        + META_KEY_CHUNK_INDEX + ":" + to_string(chunk_index_) + ";" 
+        + META_KEY_CHUNK_COUNT + ":0";
+
+    uint32_t header_len_network_byteroder = htonl(header_str.size());
+    header_str.append(reinterpret_cast<char*>(&header_len_network_byteroder), sizeof(header_len_network_byteroder));
+
+    unique_ptr<ChecksumCalculator> marker_checksum = ChecksumCalculator::create(out_file_checksum_->algorithm());
+    string checksum_str;
+
+    if (!marker_checksum) {
+        return;
+    }
+
+    marker_checksum->update(header_str.c_str(), header_str.size());
+
+    if (marker_checksum->hexDigest(&checksum_str) != Status::OK) {
+        return;
+    }
+
+    string marker_uuid = newNoteUuid();
+
+    abort_marker_ = header_str + buildChecksumTrailer(marker_checksum->algorithm(), checksum_str);
+    abort_marker_path_ = OUT_FILES_TMP_DIR + marker_uuid;
+    abort_marker_tmp_path_ = OUT_FILES_TMP_DIR + OUT_FILE_TMP_PREFIX + marker_uuid;
+}
+
+void InputDataConsumer::abortChunkedNote() {
+    if (published_chunk_paths_.empty()) {
+        return;
+    }
+
+    //chunks noterd hasn't taken yet are never sent
+    for (const auto& chunk_path : published_chunk_paths_) {
+        unlink(chunk_path.c_str());
+    }
+
+    if (abort_marker_.empty()) {
+        return;
+    }
+
+    //noterd picks marker up from spool dir on its own, daemon is not notified from here
+    int marker_fd = open(abort_marker_tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (marker_fd == -1) {
+        return;
+    }
+
+    bool written = writeAll(marker_fd, abort_marker_.c_str(), abort_marker_.size()) == Status::OK;
+
+    if (close(marker_fd) != 0 || !written || rename(abort_marker_tmp_path_.c_str(), abort_marker_path_.c_str()) != 0) {
+        unlink(abort_marker_tmp_path_.c_str());
+    }
+}
+
+void InputDataConsumer::abortNote(bool from_other_thread) {
+    aborted_ = true;
+
+    //capturing thread may be just publishing chunk, it is not waited for from its own signal handler
+    while (from_other_thread && publishing_) {
+    }
+
+    if (note_published_) {
+        return;
+    }
+
+    unlink(out_file_path_tmp_.c_str());
+    unlink(out_file_path_final_.c_str());
+    abortChunkedNote();
+}
+
+int InputDataConsumer::openNextOutFile() {
+    if (out_file_checksum_) {
+        out_file_checksum_->reset();
+    } else {
+        initChecksum();
+    }
+
+    out_file_uuid_ = newNoteUuid();
+    out_file_path_final_ = OUT_FILES_TMP_DIR + out_file_uuid_;
+    out_file_path_tmp_.clear();
+
+    return openOutFile();
+}
+
+int InputDataConsumer::openOutFile() {
+    //e.g. next note in follow mode
+    note_published_ = false;
+
+    //anonymous file in spool dir - nothing is visible to noterd until complete note is linked in 
+    //and nothing is left behind if noter dies. Readable as well - spliced data is read back from it for checksum
+    out_fd_ = open(OUT_FILES_TMP_DIR.c_str(), O_TMPFILE | O_RDWR, 0644);
+
+    //spool dir is checked only when it is missing, not on every run
+    if (out_fd_ == -1 && errno == ENOENT) {
+        if (createDirectories(OUT_FILES_TMP_DIR) != Status::OK) {
+            errorOut() << "failed to create output file directory" << endl;
+
+            return Status::ERROR;
         }
+
+        out_fd_ = open(OUT_FILES_TMP_DIR.c_str(), O_TMPFILE | O_RDWR, 0644);
+    }
+
+    if (out_fd_ != -1) {
+        return Status::OK;
+    }
+
+    //filesystem without O_TMPFILE support - use named temp file renamed on publish
+    out_file_path_tmp_ = OUT_FILES_TMP_DIR + OUT_FILE_TMP_PREFIX + out_file_uuid_;
+
+    out_fd_ = open(out_file_path_tmp_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    return out_fd_ != -1 ? Status::OK : Status::ERROR;
+}
+
+int InputDataConsumer::publishOutFile() {
+    if (!out_file_path_tmp_.empty()) {
+        return rename(out_file_path_tmp_.c_str(), out_file_path_final_.c_str()) == 0 ? Status::OK : Status::ERROR;
+    }
+
+    //linkat() with AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH, going through /proc does not
+    string out_fd_path = "/proc/self/fd/" + to_string(out_fd_);
+
+    if (linkat(AT_FDCWD, out_fd_path.c_str(), AT_FDCWD, out_file_path_final_.c_str(), AT_SYMLINK_FOLLOW) != 0) {
+        return Status::ERROR;
     }
-    
-    cleanup(false);
 
     return Status::OK;
 }
 
-int InputDataConsumer::writeHeaderToOutFile() {
+void InputDataConsumer::initChunking() {
+    //large input is published in chunks as it is captured, so noterd can send first chunks while rest is still read
+    long chunk_bytes = AppConfig::getLongValue(CONFIG_SPOOL_CHUNK_BYTES, DEFAULT_SPOOL_CHUNK_BYTES);
+
+    if (chunk_bytes > 0) {
+        out_chunk_bytes_ = max(chunk_bytes, MIN_SPOOL_CHUNK_BYTES);
+        published_chunk_paths_.reserve(MAX_OUT_FILE_SIZE / out_chunk_bytes_ + 2);
+    }
+}
+
+void InputDataConsumer::initCompressor() {
+    string codec_name = AppConfig::getValue(CONFIG_COMPRESSION_CODEC);
+
+    if (codec_name == "" || codec_name == "none") {
+        return;
+    }
+
+    compressor_ = NoteCompressor::create(
+        codec_name, 
+        AppConfig::getLongValue(CONFIG_COMPRESSION_LEVEL, NoteCompressor::DEFAULT_LEVEL)
+    );
+
+    if (!compressor_) {
+        //dont lose note because of bad config, just store it as is
+        errorOut() << "unknown or not supported compression codec '" << codec_name << "', note is not compressed" << endl;
+
+        return;
+    }
+
+    out_file_sink_ = [this](const char* data, size_t length) {
+        return writeBodyToOutFile(data, length);
+    };
+}
+
+void InputDataConsumer::initChecksum() {
+    string algorithm_name = AppConfig::getValue(CONFIG_CHECKSUM_ALGORITHM);
+    ChecksumAlgorithm algorithm = ChecksumCalculator::defaultAlgorithm();
+
+    if (algorithm_name != "" && !ChecksumCalculator::parseAlgorithmName(algorithm_name, &algorithm)) {
+        errorOut() << "unknown checksum algorithm '" << algorithm_name << "', using " 
+            << ChecksumCalculator::algorithmName(algorithm) << endl;
+    }
+
+    //tree checksum of large note is calculated on all cores by default
+    unsigned threads_num = static_cast<unsigned>(max(AppConfig::getLongValue(CONFIG_CHECKSUM_THREADS, 0L), 0L));
+
+    out_file_checksum_ = ChecksumCalculator::create(algorithm, threads_num);
+
+    if (!out_file_checksum_) {
+        //dont lose note because of bad config, md5 is always there
+        errorOut() << "checksum algorithm '" << algorithm_name << "' is not supported, using md5" << endl;
+
+        out_file_checksum_ = ChecksumCalculator::create(ChecksumAlgorithm::MD5);
+    }
+}
+
+int InputDataConsumer::consumeForCompression(const char* data, size_t length) {
+    if (debug_echo_) {
+        debug_echo_->consume(data, length);
+    }
+
+    //decide by first chunk whether input is compressible at all (e.g. png or tar.gz is not) and pass it through if not
+    if (compressor_ && !compression_decided_) {
+        compression_decided_ = true;
+
+        if (!NoteCompressor::looksCompressible(data, length)) {
+            compressor_.reset();
+        }
+    }
+
+    if (!compressor_) {
+        return writeBodyToOutFile(data, length);
+    }
+
+    return compressor_->compress(data, length, out_file_sink_);
+}
+
+string InputDataConsumer::buildHeader(bool last_chunk) {
     string timestamp_mills_str = to_string(timestamp_sec_);
-    string channel = AppConfig::getValue(CONFIG_KEY_CHANNEL);
+    string channel = !channel_.empty() ? channel_ : AppConfig::getValue(CONFIG_KEY_CHANNEL);
 
     string header_str = META_KEY_TIMESTAMP + ":" + timestamp_mills_str + ";" 
         + META_KEY_OS + ":linux;"
         + META_KEY_CHANNEL + ":" + (channel != "" ? channel : "default");
 
-    const char* header_c_str = header_str.c_str();
+    if (compressor_) {
+        header_str += ";" + META_KEY_COMPRESSION + ":" + compressor_->codecName();
+    }
 
-    uint32_t header_len = strlen(header_c_str);
+    //body is the same as of referred note
+    if (!reference_note_uuid_.empty()) {
+        header_str += ";" + META_KEY_REFERENCE + ":" + reference_note_uuid_;
+    }
 
-    out_file_stream_.write(header_c_str, static_cast<streamsize>(header_len));
-    
-    if (!out_file_stream_.good()) {
-        cout << "error after writing header string to out file: " + string(strerror(errno)) << endl;
-        
-        return Status::ERROR;
+    //note of followed stream
+    if (!stream_id_.empty()) {
+        header_str += ";" + META_KEY_STREAM_ID + ":" + stream_id_ + ";" + META_KEY_STREAM_SEQUENCE + ":" + to_string(stream_sequence_);
     }
-    
-    //exactly 4bytes int to be written
+
+    //meta given by caller, e.g. through libnoter
+    if (!extra_meta_.empty()) {
+        header_str += ";" + extra_meta_;
+    }
+
+    //chunk of large note. Total chunks count is known only when last chunk is written
+    if (!note_uuid_.empty()) {
+        header_str += ";" + META_KEY_CHUNK_PARENT + ":" + note_uuid_ 
+            + ";" + META_KEY_CHUNK_INDEX + ":" + to_string(chunk_index_);
+
+        if (last_chunk) {
+            header_str += ";" + META_KEY_CHUNK_COUNT + ":" + to_string(chunk_index_ + 1);
+        }
+    }
+
+    uint32_t header_len = header_str.size();
+
+    //exactly 4bytes int follows header, both go in single write
     uint32_t header_len_network_byteroder = htonl(header_len);
-    out_file_stream_.write(reinterpret_cast<char*>(&header_len_network_byteroder), sizeof(header_len_network_byteroder));
+    header_str.append(reinterpret_cast<char*>(&header_len_network_byteroder), sizeof(header_len_network_byteroder));
 
-    if (!out_file_stream_.good()) {
-        cout << "error after writing header string length to out file: " + string(strerror(errno)) << endl;
+    return header_str;
+}
+
+int InputDataConsumer::writeHeaderToOutFile(bool last_chunk) {
+    string header_str = buildHeader(last_chunk);
+
+    if (writeToOutFile(header_str.c_str(), header_str.size()) != Status::OK) {
+        errorOut() << "error after writing header string to out file: " + string(strerror(errno)) << endl;
         
         return Status::ERROR;
     }
@@ -200,39 +1087,49 @@ int InputDataConsumer::writeHeaderToOutFile() {
     return Status::OK;
 }
 
-int InputDataConsumer::createChecksumFile(string out_file_path, string md5_file_path) {
-    string md5_str = "";
-    if (calculateFileMD5(out_file_path, &md5_str) != Status::OK) {
-        cout << "error while caculating file md5" << endl;
-        
-        return Status::ERROR;
+int InputDataConsumer::writeBodyToOutFile(const char* data, size_t length) {
+    while (length > 0) {
+        if (out_chunk_bytes_ > 0 && out_chunk_written_ >= out_chunk_bytes_ && sealOutFileChunk() != Status::OK) {
+            return Status::ERROR;
+        }
+
+        size_t piece_length = out_chunk_bytes_ > 0 ? min(length, out_chunk_bytes_ - out_chunk_written_) : length;
+
+        if (writeToOutFile(data, piece_length) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        out_chunk_written_ += piece_length;
+        data += piece_length;
+        length -= piece_length;
     }
-    
-    ofstream md5_file_stream(md5_file_path, ios::out | ios::binary);
 
-    if (!md5_file_stream) {
-        cout << "error while opening md5 file: " + string(strerror(errno)) << endl;
-        
+    return Status::OK;
+}
+
+int InputDataConsumer::writeToOutFile(const char* data, size_t length) {
+    if (writeAll(out_fd_, data, length) != Status::OK) {
         return Status::ERROR;
     }
-    
-    md5_file_stream.write(md5_str.c_str(), md5_str.size());
 
-    if (!md5_file_stream.good()) {
-        md5_file_stream.close();
-        cleanup(true);
+    out_file_checksum_->update(data, length);
+
+    return Status::OK;
+}
 
-        cout << "error while writing data to md5 file: " + string(strerror(errno)) << endl;
+int InputDataConsumer::writeChecksumTrailer() {
+    string checksum_str = "";
+    if (out_file_checksum_->hexDigest(&checksum_str) != Status::OK) {
+        errorOut() << "error while caculating file checksum" << endl;
         
         return Status::ERROR;
     }
 
-    md5_file_stream.close();
+    string trailer = buildChecksumTrailer(out_file_checksum_->algorithm(), checksum_str);
 
-    if (!md5_file_stream.good()) {
-        cleanup(true);
-
-        cout << "error while closing md5 file: " + string(strerror(errno)) << endl;
+    //not part of note, so written directly without updating checksum
+    if (writeAll(out_fd_, trailer.c_str(), trailer.size()) != Status::OK) {
+        errorOut() << "error while writing checksum trailer to out file: " + string(strerror(errno)) << endl;
         
         return Status::ERROR;
     }
@@ -241,12 +1138,24 @@ int InputDataConsumer::createChecksumFile(string out_file_path, string md5_file_
 }
 
 void InputDataConsumer::cleanup(bool error) {
-    out_file_stream_.close();
+    if (out_fd_ != -1) {
+        close(out_fd_);
+        out_fd_ = -1;
+    }
 
-    deleteFile(out_file_path_tmp_);
+    //anonymous out file is gone with its descriptor, only named temp file has to be removed
+    if (!out_file_path_tmp_.empty()) {
+        unlink(out_file_path_tmp_.c_str());
+    }
     
+    if (error && !out_file_path_final_.empty()) {
+        unlink(out_file_path_final_.c_str());
+    }
+
+    //chunks published before error can never be assembled
     if (error) {
-        deleteFile(out_file_path_final_);
-        deleteFile(md5_file_name_);
+        abortChunkedNote();
     }
+
+    published_chunk_paths_.clear();
 }
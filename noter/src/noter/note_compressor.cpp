@@ -0,0 +1,262 @@
+#include "note_compressor.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#include "noter_utils.hpp"
+
+using namespace std;
+
+//262144 = 256 kb
+const size_t COMPRESSOR_OUT_BUFFER_LENGTH = 262144;
+
+//65536 = 64 kb
+const size_t COMPRESSIBILITY_SAMPLE_LENGTH = 65536;
+//sample must shrink at least by 10% to be worth compressing
+const double COMPRESSIBLE_SAMPLE_MAX_RATIO = 0.9;
+
+#ifdef NOTER_WITH_LZ4
+//65536 = 64 kb, lz4 output buffer must fit worst case of single input slice
+const size_t LZ4_INPUT_SLICE_LENGTH = 65536;
+#endif
+
+
+unique_ptr<NoteCompressor> NoteCompressor::create(string codec_name, int level) {
+    if (codec_name == GzipNoteCompressor::CODEC_NAME) {
+        return make_unique<GzipNoteCompressor>(level);
+    }
+
+#ifdef NOTER_WITH_LZ4
+    if (codec_name == Lz4NoteCompressor::CODEC_NAME) {
+        return make_unique<Lz4NoteCompressor>(level);
+    }
+#endif
+
+#ifdef NOTER_WITH_ZSTD
+    if (codec_name == ZstdNoteCompressor::CODEC_NAME) {
+        return make_unique<ZstdNoteCompressor>(level);
+    }
+#endif
+
+    return nullptr;
+}
+
+bool NoteCompressor::looksCompressible(const char* sample, size_t length) {
+    length = min(length, COMPRESSIBILITY_SAMPLE_LENGTH);
+
+    if (length == 0) {
+        return false;
+    }
+
+    //fastest deflate is good enough estimation of entropy for any codec
+    uLongf compressed_length = compressBound(length);
+    vector<Bytef> compressed_sample(compressed_length);
+
+    if (compress2(compressed_sample.data(), &compressed_length, reinterpret_cast<const Bytef*>(sample), length, 1) != Z_OK) {
+        return false;
+    }
+
+    return compressed_length < length * COMPRESSIBLE_SAMPLE_MAX_RATIO;
+}
+
+/* Gzip */
+
+GzipNoteCompressor::GzipNoteCompressor(int level) : out_buf_(COMPRESSOR_OUT_BUFFER_LENGTH) {
+    memset(&z_stream_, 0, sizeof(z_stream_));
+
+    if (level != DEFAULT_LEVEL) {
+        level = max(Z_BEST_SPEED, min(Z_BEST_COMPRESSION, level));
+    } else {
+        level = Z_DEFAULT_COMPRESSION;
+    }
+
+    //15 bits window + 16 means gzip wrapper, so stored body can be read with plain gunzip
+    initialized_ = deflateInit2(&z_stream_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+GzipNoteCompressor::~GzipNoteCompressor() {
+    if (initialized_) {
+        deflateEnd(&z_stream_);
+    }
+}
+
+int GzipNoteCompressor::compress(const char* data, size_t length, const Sink& sink) {
+    if (!initialized_) {
+        return Status::ERROR;
+    }
+
+    z_stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    z_stream_.avail_in = length;
+
+    return deflateAndDrain(Z_NO_FLUSH, sink);
+}
+
+int GzipNoteCompressor::finish(const Sink& sink) {
+    if (!initialized_) {
+        return Status::ERROR;
+    }
+
+    z_stream_.next_in = nullptr;
+    z_stream_.avail_in = 0;
+
+    return deflateAndDrain(Z_FINISH, sink);
+}
+
+int GzipNoteCompressor::deflateAndDrain(int flush_mode, const Sink& sink) {
+    int res;
+
+    do {
+        z_stream_.next_out = reinterpret_cast<Bytef*>(out_buf_.data());
+        z_stream_.avail_out = out_buf_.size();
+
+        res = deflate(&z_stream_, flush_mode);
+
+        if (res == Z_STREAM_ERROR) {
+            return Status::ERROR;
+        }
+
+        size_t produced_length = out_buf_.size() - z_stream_.avail_out;
+
+        if (produced_length > 0 && sink(out_buf_.data(), produced_length) != Status::OK) {
+            return Status::ERROR;
+        }
+    //full output buffer means deflate may have more pending output
+    } while (z_stream_.avail_out == 0 || (flush_mode == Z_FINISH && res != Z_STREAM_END));
+
+    return Status::OK;
+}
+
+/* LZ4 */
+
+#ifdef NOTER_WITH_LZ4
+Lz4NoteCompressor::Lz4NoteCompressor(int level) {
+    memset(&preferences_, 0, sizeof(preferences_));
+    preferences_.compressionLevel = level != DEFAULT_LEVEL ? level : 0;
+
+    out_buf_.resize(max(LZ4F_compressBound(LZ4_INPUT_SLICE_LENGTH, &preferences_), static_cast<size_t>(LZ4F_HEADER_SIZE_MAX)));
+
+    if (LZ4F_isError(LZ4F_createCompressionContext(&cctx_, LZ4F_VERSION))) {
+        cctx_ = nullptr;
+    }
+}
+
+Lz4NoteCompressor::~Lz4NoteCompressor() {
+    if (cctx_ != nullptr) {
+        LZ4F_freeCompressionContext(cctx_);
+    }
+}
+
+int Lz4NoteCompressor::compress(const char* data, size_t length, const Sink& sink) {
+    if (beginFrame(sink) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    while (length > 0) {
+        size_t slice_length = min(length, LZ4_INPUT_SLICE_LENGTH);
+
+        size_t produced_length = LZ4F_compressUpdate(cctx_, out_buf_.data(), out_buf_.size(), data, slice_length, nullptr);
+
+        if (LZ4F_isError(produced_length)) {
+            return Status::ERROR;
+        }
+
+        if (produced_length > 0 && sink(out_buf_.data(), produced_length) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        data += slice_length;
+        length -= slice_length;
+    }
+
+    return Status::OK;
+}
+
+int Lz4NoteCompressor::finish(const Sink& sink) {
+    if (beginFrame(sink) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    size_t produced_length = LZ4F_compressEnd(cctx_, out_buf_.data(), out_buf_.size(), nullptr);
+
+    if (LZ4F_isError(produced_length)) {
+        return Status::ERROR;
+    }
+
+    return sink(out_buf_.data(), produced_length);
+}
+
+int Lz4NoteCompressor::beginFrame(const Sink& sink) {
+    if (cctx_ == nullptr) {
+        return Status::ERROR;
+    }
+
+    if (frame_started_) {
+        return Status::OK;
+    }
+
+    size_t produced_length = LZ4F_compressBegin(cctx_, out_buf_.data(), out_buf_.size(), &preferences_);
+
+    if (LZ4F_isError(produced_length)) {
+        return Status::ERROR;
+    }
+
+    frame_started_ = true;
+
+    return sink(out_buf_.data(), produced_length);
+}
+#endif
+
+/* Zstd */
+
+#ifdef NOTER_WITH_ZSTD
+ZstdNoteCompressor::ZstdNoteCompressor(int level) : out_buf_(ZSTD_CStreamOutSize()) {
+    cctx_ = ZSTD_createCCtx();
+
+    if (cctx_ != nullptr && level != DEFAULT_LEVEL) {
+        ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level);
+    }
+}
+
+ZstdNoteCompressor::~ZstdNoteCompressor() {
+    ZSTD_freeCCtx(cctx_);
+}
+
+int ZstdNoteCompressor::compress(const char* data, size_t length, const Sink& sink) {
+    ZSTD_inBuffer in_buf = {data, length, 0};
+
+    return compressAndDrain(&in_buf, ZSTD_e_continue, sink);
+}
+
+int ZstdNoteCompressor::finish(const Sink& sink) {
+    ZSTD_inBuffer in_buf = {nullptr, 0, 0};
+
+    return compressAndDrain(&in_buf, ZSTD_e_end, sink);
+}
+
+int ZstdNoteCompressor::compressAndDrain(ZSTD_inBuffer* in_buf, ZSTD_EndDirective mode, const Sink& sink) {
+    if (cctx_ == nullptr) {
+        return Status::ERROR;
+    }
+
+    bool finished;
+
+    do {
+        ZSTD_outBuffer out_buf = {out_buf_.data(), out_buf_.size(), 0};
+
+        size_t remaining = ZSTD_compressStream2(cctx_, &out_buf, in_buf, mode);
+
+        if (ZSTD_isError(remaining)) {
+            return Status::ERROR;
+        }
+
+        if (out_buf.pos > 0 && sink(out_buf_.data(), out_buf.pos) != Status::OK) {
+            return Status::ERROR;
+        }
+
+        //on end of frame zstd reports how much it still has to flush
+        finished = mode == ZSTD_e_end ? remaining == 0 : in_buf->pos == in_buf->size;
+    } while (!finished);
+
+    return Status::OK;
+}
+#endif
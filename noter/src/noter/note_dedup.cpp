@@ -0,0 +1,118 @@
+#include "note_dedup.hpp"
+
+#include <sys/file.h>
+
+#include <ctime>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "noter_utils.hpp"
+
+using namespace std;
+
+extern const string OUT_FILES_TMP_DIR;
+
+//inside spool dir, directories there are skipped by noterd. Index of user is file named by uid
+const string DEDUP_INDEX_DIR_NAME = "dedup/";
+
+//index is rewritten on every recorded note, so it is kept small. Oldest entries are dropped first
+const size_t MAX_DEDUP_INDEX_ENTRIES = 256;
+
+struct DedupIndexEntry {
+    string note_key;
+    string note_name;
+    time_t timestamp_sec;
+};
+
+
+//line per entry: '<note key> <note name> <timestamp sec>'
+int readDedupIndex(int index_fd, vector<DedupIndexEntry> *entries) {
+    vector<string> lines;
+
+    if (readStateLines(index_fd, &lines) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    for (const auto& line : lines) {
+        size_t name_start = line.find(' ') + 1;
+        size_t timestamp_start = line.find(' ', name_start) + 1;
+
+        if (name_start > 0 && timestamp_start > name_start && timestamp_start < line.size()) {
+            DedupIndexEntry entry;
+            entry.note_key = line.substr(0, name_start - 1);
+            entry.note_name = line.substr(name_start, timestamp_start - 1 - name_start);
+            entry.timestamp_sec = atol(line.c_str() + timestamp_start);
+
+            entries->push_back(entry);
+        }
+    }
+
+    return Status::OK;
+}
+
+int findRecentNote(const string& note_key, long window_sec, string *note_name) {
+    note_name->clear();
+
+    int index_fd = openUserStateFile(OUT_FILES_TMP_DIR + DEDUP_INDEX_DIR_NAME, LOCK_SH);
+
+    if (index_fd == -1) {
+        return Status::ERROR;
+    }
+
+    FileDescriptorGuard index_fd_guard(index_fd);
+
+    vector<DedupIndexEntry> entries;
+
+    if (readDedupIndex(index_fd, &entries) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    time_t curr_time_sec = time(0);
+
+    for (const auto& entry : entries) {
+        if (entry.note_key == note_key && curr_time_sec - entry.timestamp_sec < window_sec) {
+            *note_name = entry.note_name;
+        }
+    }
+
+    return Status::OK;
+}
+
+int recordRecentNote(const string& note_key, const string& note_name, long window_sec) {
+    int index_fd = openUserStateFile(OUT_FILES_TMP_DIR + DEDUP_INDEX_DIR_NAME, LOCK_EX);
+
+    if (index_fd == -1) {
+        return Status::ERROR;
+    }
+
+    FileDescriptorGuard index_fd_guard(index_fd);
+
+    vector<DedupIndexEntry> entries;
+
+    if (readDedupIndex(index_fd, &entries) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    time_t curr_time_sec = time(0);
+
+    //expired entries and older note with the same key are not needed anymore
+    entries.erase(remove_if(entries.begin(), entries.end(), [&](const DedupIndexEntry& entry) {
+        return curr_time_sec - entry.timestamp_sec >= window_sec || entry.note_key == note_key;
+    }), entries.end());
+
+    entries.push_back({note_key, note_name, curr_time_sec});
+
+    if (entries.size() > MAX_DEDUP_INDEX_ENTRIES) {
+        entries.erase(entries.begin(), entries.end() - MAX_DEDUP_INDEX_ENTRIES);
+    }
+
+    string index_str;
+
+    for (const auto& entry : entries) {
+        index_str += entry.note_key + " " + entry.note_name + " " + to_string(entry.timestamp_sec) + "\n";
+    }
+
+    return rewriteStateFile(index_fd, index_str);
+}
@@ -0,0 +1,289 @@
+#include "note_rate_limit.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#include <ctime>
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "noter_utils.hpp"
+#include "app_config.hpp"
+#include "input_data_consumer.hpp"
+
+using namespace std;
+
+extern const string OUT_FILES_TMP_DIR;
+
+//0 - notes are never rate limited
+const long DEFAULT_RATE_LIMIT_NOTES_PER_MIN = 0L;
+const long DEFAULT_RATE_LIMIT_SAMPLE_EVERY = 100L;
+
+const string META_KEY_RATE_LIMITED = "rl";
+
+//inside spool dir, directories there are skipped by noterd. State of user is file named by uid
+const string RATE_LIMIT_STATE_DIR_NAME = "ratelimit/";
+
+//state is rewritten on every note, so it is kept small. Least recently seen sources are dropped first
+const size_t MAX_RATE_LIMIT_SOURCES = 256;
+
+//long command lines (e.g. with generated args) would make every run separate source
+const size_t MAX_SOURCE_COMMAND_LENGTH = 128;
+
+struct RateLimitEntry {
+    string source_key;
+    double tokens;
+    long long updated_ms;
+    //over limit notes since source had token last time
+    long limited_num;
+    time_t first_limited_sec;
+    time_t last_limited_sec;
+};
+
+
+RateLimitMode parseRateLimitMode(const string& mode_name) {
+    if (mode_name == "sample") {
+        return RateLimitMode::SAMPLE;
+    }
+
+    if (mode_name == "summary") {
+        return RateLimitMode::SUMMARY;
+    }
+
+    return RateLimitMode::DROP;
+}
+
+string noteSourceKey(const string& source_tag) {
+    string source = source_tag;
+    string source_kind = "tag:";
+
+    if (source.empty()) {
+        source_kind = "cmd:";
+
+        //noter is run by the command that emits notes, e.g. 'bash backup.sh'
+        string cmdline_path = "/proc/" + to_string(getppid()) + "/cmdline";
+        int cmdline_fd = open(cmdline_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (cmdline_fd != -1) {
+            char cmdline_buf[MAX_SOURCE_COMMAND_LENGTH];
+            ssize_t bytes_read = read(cmdline_fd, cmdline_buf, sizeof(cmdline_buf));
+
+            if (bytes_read > 0) {
+                source.assign(cmdline_buf, bytes_read);
+            }
+
+            close(cmdline_fd);
+        }
+
+        if (source.empty()) {
+            source = "unknown";
+        }
+    }
+
+    source.resize(min(source.size(), MAX_SOURCE_COMMAND_LENGTH));
+
+    //single token in state file line - args separators, spaces and line breaks are replaced
+    for (char& c : source) {
+        if (static_cast<unsigned char>(c) <= ' ') {
+            c = '_';
+        }
+    }
+
+    //trailing separator of last arg
+    while (source.size() > 1 && source.back() == '_') {
+        source.pop_back();
+    }
+
+    return "u" + to_string(getuid()) + ":" + source_kind + source;
+}
+
+//line per source: '<source key> <tokens> <updated ms> <limited num> <first limited sec> <last limited sec>'
+int readRateLimitState(int state_fd, vector<RateLimitEntry> *entries) {
+    vector<string> lines;
+
+    if (readStateLines(state_fd, &lines) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    for (const auto& line : lines) {
+        size_t values_start = line.find(' ') + 1;
+
+        if (values_start > 0 && values_start < line.size()) {
+            RateLimitEntry entry;
+            entry.source_key = line.substr(0, values_start - 1);
+
+            long first_limited_sec;
+            long last_limited_sec;
+
+            if (sscanf(line.c_str() + values_start, "%lf %lld %ld %ld %ld", &entry.tokens, &entry.updated_ms,
+                    &entry.limited_num, &first_limited_sec, &last_limited_sec) == 5) {
+                entry.first_limited_sec = first_limited_sec;
+                entry.last_limited_sec = last_limited_sec;
+
+                entries->push_back(entry);
+            }
+        }
+    }
+
+    return Status::OK;
+}
+
+int writeRateLimitState(int state_fd, const vector<RateLimitEntry>& entries) {
+    string state_str;
+    char values_buf[128];
+
+    for (const auto& entry : entries) {
+        snprintf(values_buf, sizeof(values_buf), " %.3f %lld %ld %ld %ld\n", entry.tokens, entry.updated_ms,
+            entry.limited_num, static_cast<long>(entry.first_limited_sec), static_cast<long>(entry.last_limited_sec));
+
+        state_str += entry.source_key + values_buf;
+    }
+
+    return rewriteStateFile(state_fd, state_str);
+}
+
+int takeNoteToken(const string& source_key, const RateLimitConfig& config, bool *allowed, RateLimitSummary *summary) {
+    *allowed = true;
+
+    //every user has own buckets, other users can't drain them
+    int state_fd = openUserStateFile(OUT_FILES_TMP_DIR + RATE_LIMIT_STATE_DIR_NAME, LOCK_EX);
+
+    if (state_fd == -1) {
+        return Status::ERROR;
+    }
+
+    FileDescriptorGuard state_fd_guard(state_fd);
+
+    vector<RateLimitEntry> entries;
+
+    if (readRateLimitState(state_fd, &entries) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    long long curr_time_ms = chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    time_t curr_time_sec = curr_time_ms / 1000;
+
+    auto refilledTokens = [&](const RateLimitEntry& entry) {
+        double elapsed_min = max(curr_time_ms - entry.updated_ms, 0LL) / 60000.0;
+
+        return min(config.burst, entry.tokens + elapsed_min * config.notes_per_min);
+    };
+
+    auto entry_it = find_if(entries.begin(), entries.end(), [&](const RateLimitEntry& entry) {
+        return entry.source_key == source_key;
+    });
+
+    if (entry_it == entries.end()) {
+        entries.push_back({source_key, config.burst, curr_time_ms, 0, 0, 0});
+        entry_it = entries.end() - 1;
+    }
+
+    RateLimitEntry& entry = *entry_it;
+    entry.tokens = refilledTokens(entry);
+    entry.updated_ms = curr_time_ms;
+
+    if (entry.tokens >= 1.0) {
+        entry.tokens -= 1.0;
+
+        if (entry.limited_num > 0 && config.mode == RateLimitMode::SUMMARY) {
+            summary->dropped_num = entry.limited_num;
+            summary->first_dropped_sec = entry.first_limited_sec;
+            summary->last_dropped_sec = entry.last_limited_sec;
+        }
+
+        entry.limited_num = 0;
+        entry.first_limited_sec = 0;
+        entry.last_limited_sec = 0;
+    } else {
+        entry.limited_num++;
+        entry.first_limited_sec = entry.first_limited_sec != 0 ? entry.first_limited_sec : curr_time_sec;
+        entry.last_limited_sec = curr_time_sec;
+
+        *allowed = config.mode == RateLimitMode::SAMPLE && entry.limited_num % max(config.sample_every, 1L) == 0;
+    }
+
+    //sources with full bucket and nothing to report are the same as never seen ones
+    entries.erase(remove_if(entries.begin(), entries.end(), [&](const RateLimitEntry& other_entry) {
+        return other_entry.source_key != source_key && other_entry.limited_num == 0 
+            && refilledTokens(other_entry) >= config.burst;
+    }), entries.end());
+
+    if (entries.size() > MAX_RATE_LIMIT_SOURCES) {
+        sort(entries.begin(), entries.end(), [](const RateLimitEntry& a, const RateLimitEntry& b) {
+            return a.updated_ms < b.updated_ms;
+        });
+
+        entries.erase(entries.begin(), entries.end() - MAX_RATE_LIMIT_SOURCES);
+    }
+
+    return writeRateLimitState(state_fd, entries);
+}
+
+int publishRateLimitSummary(const string& source_key, const RateLimitSummary& summary) {
+    char first_dropped_str[32];
+    char last_dropped_str[32];
+    struct tm time_parts;
+
+    strftime(first_dropped_str, sizeof(first_dropped_str), "%Y-%m-%d %H:%M:%S", 
+        localtime_r(&summary.first_dropped_sec, &time_parts));
+    strftime(last_dropped_str, sizeof(last_dropped_str), "%Y-%m-%d %H:%M:%S", 
+        localtime_r(&summary.last_dropped_sec, &time_parts));
+
+    string summary_str = to_string(summary.dropped_num) + " notes from source '" + source_key 
+        + "' were dropped by rate limit between " + first_dropped_str + " and " + last_dropped_str + "\n";
+
+    InputDataConsumer summary_consumer(time(nullptr), -1);
+    summary_consumer.setExtraMeta(META_KEY_RATE_LIMITED + ":" + to_string(summary.dropped_num));
+
+    if (summary_consumer.openNote() != Status::OK 
+            || summary_consumer.writeNoteData(summary_str.c_str(), summary_str.size()) != Status::OK) {
+        summary_consumer.cleanup(true);
+
+        return Status::ERROR;
+    }
+
+    return summary_consumer.commitNote();
+}
+
+int applyRateLimit(const string& source_tag, bool *note_allowed) {
+    *note_allowed = true;
+
+    RateLimitConfig config;
+    config.notes_per_min = AppConfig::getLongValue(CONFIG_RATE_LIMIT_NOTES_PER_MIN, DEFAULT_RATE_LIMIT_NOTES_PER_MIN);
+
+    if (config.notes_per_min <= 0) {
+        return Status::OK;
+    }
+
+    //burst of the same size as minute worth of notes by default
+    config.burst = max(AppConfig::getLongValue(CONFIG_RATE_LIMIT_BURST, static_cast<long>(config.notes_per_min)), 1L);
+    config.mode = parseRateLimitMode(AppConfig::getValue(CONFIG_RATE_LIMIT_MODE));
+    config.sample_every = AppConfig::getLongValue(CONFIG_RATE_LIMIT_SAMPLE_EVERY, DEFAULT_RATE_LIMIT_SAMPLE_EVERY);
+
+    string source_key = noteSourceKey(source_tag);
+    RateLimitSummary summary;
+
+    if (takeNoteToken(source_key, config, note_allowed, &summary) != Status::OK) {
+        return Status::ERROR;
+    }
+
+    if (!*note_allowed) {
+        cout << "note is dropped: source '" << source_key << "' is over limit of " << config.notes_per_min 
+            << " notes per minute" << endl;
+
+        return Status::OK;
+    }
+
+    //notes dropped while source was over limit are reported before its next note
+    if (summary.dropped_num > 0 && publishRateLimitSummary(source_key, summary) != Status::OK) {
+        cout << "failed to create rate limit summary note" << endl;
+    }
+
+    return Status::OK;
+}
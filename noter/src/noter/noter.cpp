@@ -1,6 +1,10 @@
 #include "input_data_consumer.hpp"
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
 
 #include <iostream>
 #include <csignal>
@@ -9,30 +13,227 @@
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <algorithm>
 
 #include "noter_utils.hpp"
 #include "app_config.hpp"
+#include "batch_runner.hpp"
+#include "note_rate_limit.hpp"
 
 using namespace std;
 
+struct NoterArgs {
+    //empty means stdin
+    std::string input_file_path;
+    bool follow = false;
+    //--batch - paths are in args, --batch0 - on stdin
+    bool batch = false;
+    bool batch_paths_on_stdin = false;
+    std::vector<std::string> batch_file_paths;
+    int jobs_num = 1;
+    //rate limit key instead of calling command
+    std::string source_tag;
+};
+
+//long only options
+const int OPT_FOLLOW = 256;
+const int OPT_BATCH = 257;
+const int OPT_BATCH0 = 258;
+const int OPT_SOURCE = 259;
+
+//exit codes above are reserved by shells
+const int MAX_BATCH_EXIT_CODE = 125;
+
+//65536 = 64 kb. Up to that size whole noter run takes about the same time, it is dominated by startup
+//(see bench/startup_bench), so startup work is cut down for such notes
+const size_t LEAN_STARTUP_MAX_INPUT_BYTES = 65536;
+
 unique_ptr<InputDataConsumer> input_data_consumer;
 
+bool follow_mode = false;
+
+
+int parseArgs(int argc, char* argv[], NoterArgs *args);
+
+int runBatchMode(NoterArgs *args);
+
+bool inputLooksSmall(int in_fd);
+
+void printUsage();
 
 void registerSignalHandlers();
 
 void sigHandler(int sig_num);
 
-int main() {
+int main(int argc, char* argv[]) {
+    NoterArgs args;
+
+    if (parseArgs(argc, argv, &args) != Status::OK) {
+        printUsage();
+
+        return Status::ERROR;
+    }
+
+    if (args.batch) {
+        return runBatchMode(&args);
+    }
+
+    int in_fd = STDIN_FILENO;
+
+    if (!args.input_file_path.empty()) {
+        in_fd = open(args.input_file_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (in_fd == -1) {
+            cout << "failed to open input file '" << args.input_file_path << "': " + string(strerror(errno)) << endl;
+
+            return Status::ERROR;
+        }
+    }
+
+    //e.g. 'echo x | noter' - no need to look up MAC address of network interface just to name single note
+    if (!args.follow && inputLooksSmall(in_fd)) {
+        useRandomNoteUuidNode();
+    }
+
     AppConfig::init();
 
-    unique_ptr<InputDataConsumer> consumer(new InputDataConsumer(time(nullptr)));
+    //follow mode creates notes at pace set in config anyway
+    bool note_allowed = true;
+
+    if (!args.follow && applyRateLimit(args.source_tag, &note_allowed) == Status::OK && !note_allowed) {
+        return Status::ERROR;
+    }
+
+    unique_ptr<InputDataConsumer> consumer(new InputDataConsumer(time(nullptr), in_fd));
     input_data_consumer = move(consumer);
 
+    follow_mode = args.follow;
+
     registerSignalHandlers();
 
+    if (follow_mode) {
+        return input_data_consumer->followAndTransferData();
+    }
+
     return input_data_consumer->readAndTransferData();
 }
 
+int runBatchMode(NoterArgs *args) {
+    if (args->batch_paths_on_stdin && readNulDelimitedPaths(STDIN_FILENO, &args->batch_file_paths) != Status::OK) {
+        cout << "failed to read file paths from stdin: " + string(strerror(errno)) << endl;
+
+        return Status::ERROR;
+    }
+
+    AppConfig::init();
+
+    registerSignalHandlers();
+
+    size_t failed_num = runBatch(args->batch_file_paths, args->jobs_num);
+
+    //exit code is number of files note was not created for
+    return static_cast<int>(min(failed_num, static_cast<size_t>(MAX_BATCH_EXIT_CODE)));
+}
+
+bool inputLooksSmall(int in_fd) {
+    struct stat in_stats;
+
+    if (fstat(in_fd, &in_stats) != 0) {
+        return false;
+    }
+
+    if (S_ISREG(in_stats.st_mode)) {
+        return static_cast<size_t>(in_stats.st_size) <= LEAN_STARTUP_MAX_INPUT_BYTES;
+    }
+
+    //only what producer has written so far is known, but tiny note is usually written at once (echo, printf)
+    int bytes_available;
+
+    if (S_ISFIFO(in_stats.st_mode) && ioctl(in_fd, FIONREAD, &bytes_available) == 0) {
+        return static_cast<size_t>(bytes_available) <= LEAN_STARTUP_MAX_INPUT_BYTES;
+    }
+
+    return false;
+}
+
+int parseArgs(int argc, char* argv[], NoterArgs *args) {
+    static const struct option long_options[] = {
+        {"file", required_argument, nullptr, 'f'},
+        {"follow", no_argument, nullptr, OPT_FOLLOW},
+        {"batch", no_argument, nullptr, OPT_BATCH},
+        {"batch0", no_argument, nullptr, OPT_BATCH0},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"source", required_argument, nullptr, OPT_SOURCE},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "f:j:h", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'f':
+                args->input_file_path = optarg;
+                break;
+            case OPT_FOLLOW:
+                args->follow = true;
+                break;
+            case OPT_BATCH:
+                args->batch = true;
+                break;
+            case OPT_BATCH0:
+                args->batch = true;
+                args->batch_paths_on_stdin = true;
+                break;
+            case OPT_SOURCE:
+                args->source_tag = optarg;
+                break;
+            case 'j':
+                args->jobs_num = atoi(optarg);
+
+                if (args->jobs_num < 1) {
+                    return Status::ERROR;
+                }
+
+                break;
+            default:
+                return Status::ERROR;
+        }
+    }
+
+    if (args->batch) {
+        //batch mode takes input files from args or stdin and can't be combined with other input options
+        if (args->follow || !args->input_file_path.empty() || !args->source_tag.empty()) {
+            return Status::ERROR;
+        }
+
+        args->batch_file_paths.assign(argv + optind, argv + argc);
+
+        return args->batch_paths_on_stdin == args->batch_file_paths.empty() ? Status::OK : Status::ERROR;
+    }
+
+    //no positional args
+    return optind == argc ? Status::OK : Status::ERROR;
+}
+
+void printUsage() {
+    cout << "usage: noter [-f FILE] [--follow] [--source TAG]" << endl
+        << "       noter --batch [-j N] FILE..." << endl
+        << "       noter --batch0 [-j N]" << endl
+        << "creates note from stdin or from given file" << endl
+        << "  -f, --file FILE    read note from FILE instead of stdin" << endl
+        << "  --follow           keep reading input till EOF or SIGINT/SIGTERM and create note every" << endl
+        << "                     follow_note_max_bytes bytes or follow_note_max_sec seconds (e.g. tail -f log | noter --follow)" << endl
+        << "  --batch FILE...    create one note per FILE" << endl
+        << "  --batch0           create one note per file, NUL delimited paths are read from stdin (e.g. find -print0)" << endl
+        << "  -j, --jobs N       capture up to N files at once in batch mode" << endl
+        << "  --source TAG       rate limit note as coming from TAG instead of calling command (see rate_limit_* in config)" << endl
+        << "in batch mode exit code is number of files note was not created for" << endl;
+}
+
 void registerSignalHandlers() {
     signal(SIGINT, sigHandler);
     signal(SIGABRT, sigHandler);
@@ -40,9 +241,21 @@ void registerSignalHandlers() {
 }
 
 void sigHandler(int sig_num) {
-    unlink(input_data_consumer->out_file_path_tmp());
-    unlink(input_data_consumer->out_file_path_final());
-    unlink(input_data_consumer->md5_file_name());
+    //collected data is published as last note of the stream and noter exits normally
+    if (follow_mode && sig_num != SIGABRT) {
+        input_data_consumer->requestStop();
+
+        return;
+    }
+
+    //batch mode - note of every worker is dropped, big one may have published chunks already
+    if (!input_data_consumer) {
+        abortBatchCaptures();
+
+        exit(sig_num);
+    }
+
+    input_data_consumer->abortNote(false);
 
     exit(sig_num);
 }
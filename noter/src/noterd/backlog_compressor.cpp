@@ -0,0 +1,301 @@
+#include "backlog_compressor.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <filesystem>
+
+#include "noter_utils.hpp"
+#include "checksum.hpp"
+#include "note_compressor.hpp"
+#include "note_protocol.hpp"
+#include "app_config.hpp"
+
+using namespace std;
+
+extern const string OUT_FILE_TMP_PREFIX;
+
+//1048576 = 1 meg
+const size_t BACKLOG_READ_BUFFER_LENGTH = 1048576;
+
+//4096 = 4 kb, smaller notes are not worth rewriting
+const size_t BACKLOG_MIN_NOTE_BODY_BYTES = 4096;
+
+//note being recompressed when round deadline comes is given that long to finish
+const time_t BACKLOG_NOTE_MAX_SEC = 60;
+
+//recompressed body must be at least 10% smaller to replace note
+const double BACKLOG_MAX_RATIO = 0.9;
+
+//slow levels are fine - noterd has nothing else to do while server is down
+const int BACKLOG_ZSTD_LEVEL = 19;
+const int BACKLOG_LZ4_LEVEL = 12;
+const int BACKLOG_GZIP_LEVEL = 9;
+
+const string META_KEY_COMPRESSION = "cz";
+const string META_KEY_CHUNK_PARENT = "pt";
+const string META_KEY_REFERENCE = "rf";
+
+
+bool headerHasMetaKey(const string& header_str, const string& meta_key) {
+    size_t pair_start = 0;
+
+    while (pair_start < header_str.size()) {
+        size_t pair_end = header_str.find(';', pair_start);
+
+        if (pair_end == string::npos) {
+            pair_end = header_str.size();
+        }
+
+        if (header_str.compare(pair_start, meta_key.size() + 1, meta_key + ":") == 0) {
+            return true;
+        }
+
+        pair_start = pair_end + 1;
+    }
+
+    return false;
+}
+
+void BacklogCompressor::recompressBacklog(time_t deadline_sec) {
+    codec_name_ = AppConfig::getValue(CONFIG_BACKLOG_COMPRESSION_CODEC);
+
+    if (codec_name_ == "") {
+#ifdef NOTER_WITH_ZSTD
+        codec_name_ = ZstdNoteCompressor::CODEC_NAME;
+#else
+        codec_name_ = GzipNoteCompressor::CODEC_NAME;
+#endif
+    }
+
+    if (codec_name_ == "none") {
+        return;
+    }
+
+    long default_level = BACKLOG_GZIP_LEVEL;
+
+    if (codec_name_ == "zstd") {
+        default_level = BACKLOG_ZSTD_LEVEL;
+    } else if (codec_name_ == "lz4") {
+        default_level = BACKLOG_LZ4_LEVEL;
+    }
+
+    codec_level_ = static_cast<int>(AppConfig::getLongValue(CONFIG_BACKLOG_COMPRESSION_LEVEL, default_level));
+
+    if (!NoteCompressor::create(codec_name_, codec_level_)) {
+        syslog(LOG_WARNING, "unknown or not supported backlog compression codec '%s'", codec_name_.c_str());
+
+        return;
+    }
+
+    vector<string> note_names;
+    unordered_set<string> spool_note_names;
+    error_code dir_error;
+
+    for (const auto& entry : filesystem::directory_iterator(spool_dir_path_, dir_error)) {
+        string file_name = entry.path().filename().string();
+
+        if (!entry.is_regular_file() || file_name.size() != NOTE_PROTOCOL_FRAME_NAME_LENGTH
+                || startsWith(file_name, OUT_FILE_TMP_PREFIX)) {
+            continue;
+        }
+
+        spool_note_names.insert(file_name);
+
+        if (done_note_names_.count(file_name) == 0) {
+            note_names.push_back(file_name);
+        }
+    }
+
+    //sent notes are forgotten
+    for (auto it = done_note_names_.begin(); it != done_note_names_.end(); ) {
+        it = spool_note_names.count(*it) == 0 ? done_note_names_.erase(it) : next(it);
+    }
+
+    //oldest notes are sent first once server is back
+    sort(note_names.begin(), note_names.end(), [](const string& a, const string& b) {
+        return noteUuidTimestamp(a) < noteUuidTimestamp(b);
+    });
+
+    for (const auto& note_name : note_names) {
+        if (time(0) >= deadline_sec) {
+            break;
+        }
+
+        //note too big to be done in time is not tried again, it would keep postponing reconnect
+        recompressNote(note_name, max(deadline_sec, time(0) + BACKLOG_NOTE_MAX_SEC));
+        done_note_names_.insert(note_name);
+    }
+}
+
+RecompressResult BacklogCompressor::recompressNote(const string& note_name, time_t deadline_sec) {
+    string note_path = spool_dir_path_ + note_name;
+    FileDescriptorGuard note_descr(open(note_path.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat note_stats;
+
+    if (note_descr.get() == -1 || fstat(note_descr.get(), &note_stats) != 0) {
+        return RecompressResult::ERROR;
+    }
+
+    size_t note_size = static_cast<size_t>(note_stats.st_size);
+    ChecksumAlgorithm checksum_algorithm;
+    string checksum_str;
+    size_t trailer_length;
+
+    //note written by older noter (separate .md5 file) is left as is
+    if (readChecksumTrailer(note_descr.get(), note_size, &checksum_algorithm, &checksum_str, &trailer_length)
+            != Status::OK || trailer_length == 0) {
+        return RecompressResult::SKIPPED;
+    }
+
+    note_size -= trailer_length;
+
+    //body, header, 4 bytes header length
+    uint32_t header_length_network_byteorder;
+
+    if (note_size < sizeof(header_length_network_byteorder) || preadAll(note_descr.get(),
+            reinterpret_cast<char*>(&header_length_network_byteorder), sizeof(header_length_network_byteorder),
+            note_size - sizeof(header_length_network_byteorder)) != Status::OK) {
+        return RecompressResult::ERROR;
+    }
+
+    size_t header_length = ntohl(header_length_network_byteorder);
+
+    if (header_length > note_size - sizeof(header_length_network_byteorder)) {
+        return RecompressResult::ERROR;
+    }
+
+    size_t body_size = note_size - sizeof(header_length_network_byteorder) - header_length;
+    string header_str(header_length, '\0');
+
+    if (preadAll(note_descr.get(), header_str.data(), header_length, body_size) != Status::OK) {
+        return RecompressResult::ERROR;
+    }
+
+    //compressed already, or body is split across chunk notes, or there is no body at all
+    if (body_size < BACKLOG_MIN_NOTE_BODY_BYTES || headerHasMetaKey(header_str, META_KEY_COMPRESSION)
+            || headerHasMetaKey(header_str, META_KEY_CHUNK_PARENT) || headerHasMetaKey(header_str, META_KEY_REFERENCE)) {
+        return RecompressResult::SKIPPED;
+    }
+
+    unsigned checksum_threads = static_cast<unsigned>(max(AppConfig::getLongValue(CONFIG_CHECKSUM_THREADS, 0L), 0L));
+
+    //note is verified against its own checksum in the same pass, so corrupted note never gets valid checksum
+    unique_ptr<ChecksumCalculator> note_checksum = ChecksumCalculator::create(checksum_algorithm, checksum_threads);
+    unique_ptr<ChecksumCalculator> new_checksum = ChecksumCalculator::create(checksum_algorithm, checksum_threads);
+    unique_ptr<NoteCompressor> compressor = NoteCompressor::create(codec_name_, codec_level_);
+
+    if (!note_checksum || !new_checksum || !compressor) {
+        return RecompressResult::SKIPPED;
+    }
+
+    string tmp_path = spool_dir_path_ + OUT_FILE_TMP_PREFIX + note_name;
+    FileDescriptorGuard tmp_descr(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+
+    if (tmp_descr.get() == -1) {
+        syslog(LOG_ERR, "failed to open temp file '%s': '%s'", tmp_path.c_str(), strerror(errno));
+
+        return RecompressResult::ERROR;
+    }
+
+    size_t compressed_size = 0;
+
+    NoteCompressor::Sink tmp_sink = [&](const char* data, size_t length) {
+        new_checksum->update(data, length);
+        compressed_size += length;
+
+        return writeAll(tmp_descr.get(), data, length);
+    };
+
+    vector<char> read_buf(BACKLOG_READ_BUFFER_LENGTH);
+    size_t body_offset = 0;
+    RecompressResult res = RecompressResult::RECOMPRESSED;
+
+    while (body_offset < body_size && res == RecompressResult::RECOMPRESSED) {
+        size_t bytes_chunk = min(read_buf.size(), body_size - body_offset);
+
+        if (preadAll(note_descr.get(), read_buf.data(), bytes_chunk, body_offset) != Status::OK) {
+            res = RecompressResult::ERROR;
+        } else if (body_offset == 0 && !NoteCompressor::looksCompressible(read_buf.data(), bytes_chunk)) {
+            res = RecompressResult::SKIPPED;
+        } else if (compressor->compress(read_buf.data(), bytes_chunk, tmp_sink) != Status::OK) {
+            res = RecompressResult::ERROR;
+        } else if (time(0) > deadline_sec) {
+            res = RecompressResult::ABORTED;
+        }
+
+        note_checksum->update(read_buf.data(), bytes_chunk);
+        body_offset += bytes_chunk;
+    }
+
+    if (res == RecompressResult::RECOMPRESSED && compressor->finish(tmp_sink) != Status::OK) {
+        res = RecompressResult::ERROR;
+    }
+
+    if (res == RecompressResult::RECOMPRESSED && compressed_size > body_size * BACKLOG_MAX_RATIO) {
+        res = RecompressResult::SKIPPED;
+    }
+
+    string original_header_str = header_str;
+    original_header_str.append(reinterpret_cast<char*>(&header_length_network_byteorder),
+        sizeof(header_length_network_byteorder));
+    note_checksum->update(original_header_str.c_str(), original_header_str.size());
+
+    string note_checksum_str;
+
+    if (res == RecompressResult::RECOMPRESSED
+            && (note_checksum->hexDigest(&note_checksum_str) != Status::OK || note_checksum_str != checksum_str)) {
+        syslog(LOG_ERR, "error: %s of '%s' doesnt match, note is not recompressed",
+            ChecksumCalculator::algorithmName(checksum_algorithm), note_path.c_str());
+
+        res = RecompressResult::ERROR;
+    }
+
+    if (res != RecompressResult::RECOMPRESSED) {
+        unlink(tmp_path.c_str());
+
+        return res;
+    }
+
+    //codec is flagged in note header, server stores body as is
+    header_str += ";" + META_KEY_COMPRESSION + ":" + compressor->codecName();
+
+    uint32_t new_header_length_network_byteorder = htonl(header_str.size());
+    header_str.append(reinterpret_cast<char*>(&new_header_length_network_byteorder),
+        sizeof(new_header_length_network_byteorder));
+    new_checksum->update(header_str.c_str(), header_str.size());
+
+    string new_checksum_str;
+
+    if (new_checksum->hexDigest(&new_checksum_str) != Status::OK) {
+        unlink(tmp_path.c_str());
+
+        return RecompressResult::ERROR;
+    }
+
+    string note_tail = header_str + buildChecksumTrailer(checksum_algorithm, new_checksum_str);
+
+    //original note is replaced, so new one must be on disk before rename
+    if (writeAll(tmp_descr.get(), note_tail.c_str(), note_tail.size()) != Status::OK || fdatasync(tmp_descr.get()) != 0
+            || rename(tmp_path.c_str(), note_path.c_str()) != 0) {
+        syslog(LOG_ERR, "failed to replace note '%s' with recompressed one: '%s'", note_path.c_str(), strerror(errno));
+
+        unlink(tmp_path.c_str());
+
+        return RecompressResult::ERROR;
+    }
+
+    syslog(LOG_INFO, "recompressed note '%s' with %s, body %lu -> %lu bytes", note_path.c_str(),
+        compressor->codecName().c_str(), static_cast<unsigned long>(body_size), static_cast<unsigned long>(compressed_size));
+
+    return RecompressResult::RECOMPRESSED;
+}
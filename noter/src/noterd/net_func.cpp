@@ -3,6 +3,7 @@
 #include <syslog.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/sendfile.h>
 
 #include <ctime>
 #include <cstring>
@@ -14,12 +15,12 @@ using namespace std;
 extern const int SOCK_TIMEOUT_SEC = 60;
 
 
-int sendAll(int s_descr, const char* buff, size_t length) {
+int sendAll(int s_descr, const char* buff, size_t length, int flags) {
     time_t send_start_time_sec = time(0);
     time_t time_elapsed;
 
     while (length > 0) {
-        int res = send(s_descr, buff, length, 0);
+        int res = send(s_descr, buff, length, flags);
 
         //make sure request times out even if data is sent but too slow
         time_t curr_time_sec = time(0);
@@ -39,6 +40,43 @@ int sendAll(int s_descr, const char* buff, size_t length) {
             }
         }
 
+        buff += res;
+        length -= res;
+    }
+
+    return Status::OK;
+}
+
+int sendFileAll(int s_descr, int file_descr, off_t offset, size_t length) {
+    time_t send_start_time_sec = time(0);
+
+    while (length > 0) {
+        //file pages go to socket without copy to user space
+        ssize_t res = sendfile(s_descr, file_descr, &offset, length);
+
+        //make sure request times out even if data is sent but too slow
+        if (time(0) - send_start_time_sec > SOCK_TIMEOUT_SEC) {
+            errno = ETIMEDOUT;
+
+            return Status::ERROR;
+        }
+
+        if (res == -1) {
+            //continue if interrupted
+            if (errno == EINTR) {
+                continue;
+            } else {
+                return Status::ERROR;
+            }
+        }
+
+        //file is shorter than expected
+        if (res == 0) {
+            errno = EIO;
+
+            return Status::ERROR;
+        }
+
         length -= res;
     }
 
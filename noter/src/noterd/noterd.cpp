@@ -11,6 +11,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <poll.h>
+#include <zlib.h>
 
 #include <csignal>
 #include <ctime>
@@ -18,10 +20,26 @@
 #include <string>
 #include <cstring>
 #include <filesystem>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 #include "noter_utils.hpp"
+#include "checksum.hpp"
+#include "note_protocol.hpp"
 #include "net_func.hpp"
 #include "app_config.hpp"
+#include "local_socket.hpp"
+#include "spool_watcher.hpp"
+#include "note_ring.hpp"
+#include "backlog_compressor.hpp"
+#include "upload_throttle.hpp"
+#include "upload_queue.hpp"
 
 using namespace std;
 
@@ -41,15 +59,29 @@ extern const long unsigned int MAX_OUT_FILE_SIZE;
 extern const int SOCK_TIMEOUT_SEC;
 
 const int SLEEP_INTERVAL_SEC = 5;
+//spool dir scan when new notes are reported by inotify/local socket
+const int SAFETY_SCAN_INTERVAL_SEC = 300;
 const int SOCKET_RECONNECT_INTERVAL_SEC = 10;
+//server that didn't know hello is asked again after that long, in case it was upgraded
+const int PROTOCOL_HELLO_RETRY_INTERVAL_SEC = 3600;
+//idle connection is pinged that often, well below socket timeout of server. 0 - connection is closed after every batch
+const long DEFAULT_SRV_KEEPALIVE_SEC = 30L;
+//notes sent before status of the oldest one is awaited (protocol v4). 1 - every note waits for its status
+const long DEFAULT_SRV_PIPELINE_WINDOW = 16L;
+//spool files are sent over that many connections at once. 1 - single connection, notes go strictly in order of creation
+const long DEFAULT_UPLOAD_WORKERS = 1L;
+const long MAX_UPLOAD_WORKERS = 32L;
 const long int MAX_TMP_IDLE_TIME_SEC = 86400L;
+//ring writes are not seen by inotify - ring is checked that often in case noter couldn't notify
+const int SPOOL_RING_CHECK_INTERVAL_MS = 1000;
 
-//10485760 = 10 meg
-const long int FILE_CONTENT_BUFFER_LENGTH = 10485760;
+//10485760 = 10 meg, note content is sent in chunks that long at full speed
+const long int FILE_CONTENT_CHUNK_LENGTH = 10485760;
+//1048576 = 1 meg, for rare re-checksum of note - content is not copied to user space when sent
+const size_t CHECKSUM_READ_BUFFER_LENGTH = 1048576;
 
 const string PID_FILE_PATH = "/run/noterd.pid";
-//32 bytes of uuid string + 4 dash separators
-const int TEMP_FILE_NAME_LENGTH = 36;
+const string STATS_FILE_PATH = "/run/noterd.stats";
 const int MD5_FILE_CONTENT_LENGTH = 32;
 
 const int SRV_PORT = 8000;
@@ -58,9 +90,39 @@ const int SRV_PORT = 8000;
 
 struct sockaddr_in srv_addr;
 
-HeapArrayContainer<char> file_content_buf(FILE_CONTENT_BUFFER_LENGTH);
+//every upload worker has own connection to server
+thread_local int sock_descr = -1;
 
-int sock_descr = -1;
+int local_listen_sock_descr = -1;
+
+int spool_watch_descr = -1;
+
+//small notes written by noter without spool file
+NoteRing spool_ring;
+
+//uploads are slowed down while host is under pressure
+UploadThrottle upload_throttle;
+
+//negotiated on every connect
+thread_local uint32_t srv_protocol_version = 1;
+thread_local uint32_t srv_checksum_algorithms = 0;
+thread_local time_t legacy_srv_detected_time_sec = 0;
+
+//connection is kept open between batches of notes (protocol v3)
+long srv_keepalive_sec = DEFAULT_SRV_KEEPALIVE_SEC;
+thread_local time_t sock_last_used_sec = 0;
+thread_local bool sock_kept_alive = false;
+
+//notes sent over current connection that server didn't reply to yet, oldest first
+long srv_pipeline_window = DEFAULT_SRV_PIPELINE_WINDOW;
+thread_local deque<InFlightNote> in_flight_notes;
+
+//with more than one worker spool files are sent by workers, ring notes are sent by main thread
+long upload_workers_num = DEFAULT_UPLOAD_WORKERS;
+vector<thread> upload_workers;
+UploadQueue upload_queue;
+//some notes were left unsent by workers - spool dir is scanned again soon
+atomic<bool> upload_retry_needed(false);
 
 
 int main() {
@@ -109,10 +171,81 @@ int main() {
 
     syslog(LOG_INFO, "starting heartbeat loop");
 
+    //noter reports new notes through local socket and spool dir is watched with inotify, 
+    //so dir is scanned only rarely - to pick up anything events were missed for and to clean dangling temp files
+    local_listen_sock_descr = openLocalListenSocket();
+
+    if (local_listen_sock_descr == -1) {
+        syslog(LOG_WARNING, "local socket is not available");
+    }
+
+    spool_watch_descr = openSpoolWatch(OUT_FILES_TMP_DIR);
+
+    if (spool_watch_descr == -1) {
+        syslog(LOG_WARNING, "spool dir watch is not available, falling back to frequent spool dir scan");
+    }
+
+    upload_throttle.init(STATS_FILE_PATH);
+
+    if (createSpoolRing(&spool_ring) != Status::OK) {
+        syslog(LOG_WARNING, "spool ring is not available: '%s'", strerror(errno));
+    }
+
+    startUploadWorkers();
+
+    time_t last_heartbeat_time_sec = 0;
+    bool scan_needed = true;
+    bool retry_needed = false;
+
     while (1) {
-        doHeartbeat();
+        //without inotify or while some notes are waiting for retry - scan as often as before
+        int heartbeat_interval_sec = spool_watch_descr == -1 || retry_needed 
+            ? SLEEP_INTERVAL_SEC : SAFETY_SCAN_INTERVAL_SEC;
+
+        if (scan_needed || time(0) - last_heartbeat_time_sec >= heartbeat_interval_sec) {
+            retry_needed = doHeartbeat() != Status::OK;
+            scan_needed = false;
+
+            last_heartbeat_time_sec = time(0);
+
+            continue;
+        }
+
+        int time_till_heartbeat_ms = (last_heartbeat_time_sec + heartbeat_interval_sec - time(0)) * 1000;
+        vector<string> note_names;
+
+        if (spool_ring.isOpen()) {
+            time_till_heartbeat_ms = min(time_till_heartbeat_ms, SPOOL_RING_CHECK_INTERVAL_MS);
+        }
+
+        //notes workers failed to send are retried as often as notes of main thread
+        if (!upload_workers.empty()) {
+            time_till_heartbeat_ms = min(time_till_heartbeat_ms, SLEEP_INTERVAL_SEC * 1000);
+        }
+
+        if (sock_descr != -1) {
+            time_till_heartbeat_ms = min(time_till_heartbeat_ms, 
+                static_cast<int>(sock_last_used_sec + srv_keepalive_sec - time(0)) * 1000);
+        }
+
+        if (waitForNewNotes(max(time_till_heartbeat_ms, 0), &note_names, &scan_needed) != Status::OK) {
+            syslog(LOG_ERR, "error while waiting for new notes: '%s'", strerror(errno));
+        }
+
+        if (sock_descr != -1 && time(0) - sock_last_used_sec >= srv_keepalive_sec) {
+            pingServer();
+        }
+
+        if (upload_retry_needed.exchange(false)) {
+            retry_needed = true;
+        }
+
+        //ring notes left unsent are retried by heartbeat
+        bool ring_pending = !retry_needed && spool_ring.isOpen() && spool_ring.head() != spool_ring.tail();
 
-        sleep(SLEEP_INTERVAL_SEC);
+        if ((!note_names.empty() || ring_pending) && processNotifiedNotes(note_names) != Status::OK) {
+            retry_needed = true;
+        }
     }
 
     closelog();
@@ -163,6 +296,10 @@ int initDaemon(pid_t pid) {
         return Status::ERROR;
     }
 
+    srv_keepalive_sec = max(AppConfig::getLongValue(CONFIG_SRV_KEEPALIVE_SEC, DEFAULT_SRV_KEEPALIVE_SEC), 0L);
+    srv_pipeline_window = max(AppConfig::getLongValue(CONFIG_SRV_PIPELINE_WINDOW, DEFAULT_SRV_PIPELINE_WINDOW), 1L);
+    upload_workers_num = clamp(AppConfig::getLongValue(CONFIG_UPLOAD_WORKERS, DEFAULT_UPLOAD_WORKERS), 1L, MAX_UPLOAD_WORKERS);
+
     srv_addr.sin_family = AF_INET;
     srv_addr.sin_port = htons(SRV_PORT);
 
@@ -177,12 +314,60 @@ int initDaemon(pid_t pid) {
     return Status::OK;
 }
 
-void doHeartbeat() {
+int waitForNewNotes(int timeout_ms, vector<string> *note_names, bool *scan_needed) {
+    struct pollfd poll_descrs[3];
+    nfds_t poll_descrs_num = 0;
+
+    //server never sends anything to idle connection - it is readable only once server closed it
+    for (int descr : {local_listen_sock_descr, spool_watch_descr, sock_descr}) {
+        if (descr != -1) {
+            poll_descrs[poll_descrs_num].fd = descr;
+            poll_descrs[poll_descrs_num].events = POLLIN;
+            poll_descrs_num++;
+        }
+    }
+
+    int ready_num = poll(poll_descrs, poll_descrs_num, timeout_ms);
+
+    if (ready_num == -1) {
+        return errno == EINTR ? Status::OK : Status::ERROR;
+    }
+
+    if (ready_num == 0) {
+        //timed out
+        return Status::OK;
+    }
+
+    int res = Status::OK;
+
+    if (sock_descr != -1 && poll_descrs[poll_descrs_num - 1].revents != 0) {
+        syslog(LOG_INFO, "server closed idle connection");
+
+        closeSocket();
+    }
+
+    if (local_listen_sock_descr != -1 && acceptNotifications(local_listen_sock_descr, note_names) != Status::OK) {
+        res = Status::ERROR;
+    }
+
+    if (spool_watch_descr != -1 && readSpoolEvents(spool_watch_descr, note_names, scan_needed) != Status::OK) {
+        res = Status::ERROR;
+    }
+
+    //same note is usually reported both by noter and by inotify
+    sort(note_names->begin(), note_names->end());
+    note_names->erase(unique(note_names->begin(), note_names->end()), note_names->end());
+
+    return res;
+}
+
+int doHeartbeat() {
     syslog(LOG_DEBUG, "hearthbeat");
 
     //iterate files in dir, remove possible old tmp files and process new ones
     time_t curr_time_sec = time(0);
     struct stat file_stats;
+    vector<string> note_names;
 
     for (const auto& entry : filesystem::directory_iterator(OUT_FILES_TMP_DIR)) {
         filesystem::path entry_path = entry.path();
@@ -193,171 +378,961 @@ void doHeartbeat() {
             continue;
         }
 
-        if (stat(file_path.c_str(), &file_stats) != 0) {
-            syslog(LOG_ERR, "error while reading temp file '%s': '%s'", file_path.c_str(), strerror(errno));
+        if (startsWith(file_name, OUT_FILE_TMP_PREFIX)) {
+            if (stat(file_path.c_str(), &file_stats) != 0) {
+                syslog(LOG_ERR, "error while reading temp file '%s': '%s'", file_path.c_str(), strerror(errno));
+
+                continue;
+            }
+
+            if (curr_time_sec - file_stats.st_ctime > MAX_TMP_IDLE_TIME_SEC) {
+                deleteFile(file_path);
+                deleteFile(file_path + ".md5");
+
+                syslog(LOG_INFO, "deleted dangling temp file '%s'", file_path.c_str());
+            }
 
+            //not published yet
             continue;
         }
 
-        if (startsWith(file_name, OUT_FILE_TMP_PREFIX) && curr_time_sec - file_stats.st_ctime > MAX_TMP_IDLE_TIME_SEC) {
-            deleteFile(file_path);
-            deleteFile(file_path + ".md5");
+        note_names.push_back(file_name);
+    }
 
-            syslog(LOG_INFO, "deleted dangling temp file '%s'", file_path.c_str());
+    //stats stay fresh while nothing is sent
+    upload_throttle.samplePressure();
+
+    return uploadNotes(note_names);
+}
+
+int processNotifiedNotes(const vector<string>& note_names) {
+    vector<string> file_names;
+
+    for (const auto& note_name : note_names) {
+        //name comes from local client - make sure it is plain note name inside spool dir
+        if (note_name.find('/') != string::npos || startsWith(note_name, OUT_FILE_TMP_PREFIX)) {
+            syslog(LOG_WARNING, "got notification with bad note name");
 
             continue;
         }
 
-        /* Process tmp file */
+        //may be already sent by scan, or written to spool ring
+        if (!fileExists(OUT_FILES_TMP_DIR + note_name)) {
+            continue;
+        }
 
-        syslog(LOG_INFO, "processing temp file '%s'", file_path.c_str());
+        file_names.push_back(note_name);
+    }
 
-        if (file_name.size() != TEMP_FILE_NAME_LENGTH) {
-            syslog(LOG_WARNING, "found temp file with bad name: '%s'", file_path.c_str());
+    return uploadNotes(file_names);
+}
+
+int uploadNotes(vector<string> file_names) {
+    if (upload_workers.empty()) {
+        return processNotes(file_names);
+    }
+
+    //oldest first, workers claim notes in order they were queued
+    sort(file_names.begin(), file_names.end(), [](const string& a, const string& b) {
+        return noteUuidTimestamp(a) < noteUuidTimestamp(b);
+    });
+
+    for (const auto& file_name : file_names) {
+        upload_queue.push(file_name);
+    }
+
+    return processNotes({});
+}
+
+void startUploadWorkers() {
+    if (upload_workers_num <= 1) {
+        return;
+    }
+
+    for (long worker_idx = 0; worker_idx < upload_workers_num; worker_idx++) {
+        upload_workers.emplace_back(uploadWorkerLoop);
+    }
+
+    syslog(LOG_INFO, "started %li upload workers", upload_workers_num);
+}
+
+void uploadWorkerLoop() {
+    vector<string> note_names;
+
+    while (true) {
+        int keepalive_ms = static_cast<int>(max(srv_keepalive_sec, 1L) * 1000);
+
+        upload_queue.claim(&note_names, static_cast<size_t>(srv_pipeline_window), static_cast<size_t>(upload_workers_num), 
+            keepalive_ms);
+
+        //idle worker keeps its connection like main thread does
+        if (note_names.empty()) {
+            if (sock_descr != -1 && time(0) - sock_last_used_sec >= srv_keepalive_sec) {
+                pingServer();
+            }
 
             continue;
         }
 
-        size_t file_size = static_cast<size_t>(file_stats.st_size);
+        //note may be sent by other worker already, if it was queued again by scan right before it was deleted
+        vector<string> file_names;
 
-        if (file_size == 0 || file_size > MAX_OUT_FILE_SIZE) {
-            syslog(LOG_WARNING, "found temp file with invalid size - %li max is %lui: '%s'", 
-                file_size, MAX_OUT_FILE_SIZE, file_path.c_str());
+        copy_if(note_names.begin(), note_names.end(), back_inserter(file_names), [](const string& note_name) {
+            return fileExists(OUT_FILES_TMP_DIR + note_name);
+        });
 
-            continue;
+        if (processNotes(file_names, false) != Status::OK) {
+            upload_retry_needed.store(true);
         }
 
-        //send file info to noter server
+        //notes left unsent are in spool dir still, next scan queues them again
+        upload_queue.release(note_names);
+    }
+}
+
+int processNotes(vector<string> file_names, bool with_ring) {
+    //oldest first - uuid of note holds its creation time
+    stable_sort(file_names.begin(), file_names.end(), [](const string& a, const string& b) {
+        return noteUuidTimestamp(a) < noteUuidTimestamp(b);
+    });
+
+    int res = Status::OK;
+    auto file_it = file_names.begin();
+
+    uint64_t ring_position = spool_ring.tail();
+    uint64_t ring_next_position = ring_position;
+    string ring_note_name;
+    string ring_note_data;
+    bool ring_note_read = false;
+
+    while (true) {
+        //records are appended as notes are created, so ring is merged with files in order of creation
+        while (with_ring && !ring_note_read && spool_ring.isOpen() && ring_position != spool_ring.head()) {
+            if (spool_ring.readRecord(ring_position, &ring_note_name, &ring_note_data, &ring_next_position) 
+                    == Status::OK) {
+                ring_note_read = true;
+
+                break;
+            }
+
+            if (errno == EBADMSG) {
+                syslog(LOG_ERR, "skipped corrupted record of spool ring at %lu", static_cast<unsigned long>(ring_position));
+            }
+
+            //only padding till head or corrupted record. Ring notes in flight hold their records till status comes,
+            //space after them is released along with them
+            bool ring_note_in_flight = any_of(in_flight_notes.begin(), in_flight_notes.end(), 
+                [](const InFlightNote& note) { return note.from_ring; });
 
-        //(re)connect to noter server
-        if (sock_descr == -1) {
-            connectSocketLoop();
+            if (!ring_note_in_flight) {
+                spool_ring.release(ring_next_position);
+            }
+
+            ring_position = ring_next_position;
         }
 
-        //send file name
-        if (sendAll(sock_descr, file_name.c_str(), file_name.size()) != Status::OK) {
-            syslog(LOG_ERR, "failed to send file name: '%s'", strerror(errno));
+        bool file_next = file_it != file_names.end() 
+            && (!ring_note_read || noteUuidTimestamp(*file_it) <= noteUuidTimestamp(ring_note_name));
 
+        if (!file_next && !ring_note_read) {
             break;
         }
 
-        //send file size
-        uint32_t file_size_network_byteroder = htonl(file_size);
-        if (sendAll(sock_descr, reinterpret_cast<char*>(&file_size_network_byteroder), sizeof(file_size_network_byteroder))
-             != Status::OK) {
-            syslog(LOG_ERR, "failed to send file size: '%s'", strerror(errno));
+        //connection idle for whole pause may be dropped by server already, statuses sent before are still there
+        if (upload_throttle.waitWhilePaused()) {
+            SendResult in_flight_result = receiveInFlightStatuses(0);
+
+            closeSocket();
+
+            if (in_flight_result != SendResult::SENT) {
+                res = Status::ERROR;
+            }
+
+            if (in_flight_result == SendResult::CONNECTION_ERROR) {
+                break;
+            }
+        }
+
+        SendResult send_result;
 
+        if (file_next) {
+            send_result = processTempFile(*file_it, OUT_FILES_TMP_DIR + *file_it);
+            file_it++;
+        } else {
+            send_result = processRingNote(ring_note_name, ring_note_data, ring_next_position);
+
+            //note server didn't take is moved to spool dir, ring space is not held by it
+            if (send_result == SendResult::FILE_ERROR && spillRingNote(ring_note_name, ring_note_data) != Status::OK) {
+                syslog(LOG_ERR, "failed to move note '%s' from spool ring to spool dir: '%s'", 
+                    ring_note_name.c_str(), strerror(errno));
+
+                res = Status::ERROR;
+
+                break;
+            }
+
+            if (send_result != SendResult::CONNECTION_ERROR) {
+                //note in flight is released once server takes it
+                if (send_result != SendResult::IN_FLIGHT) {
+                    spool_ring.release(ring_next_position);
+                }
+
+                ring_position = ring_next_position;
+                ring_note_read = false;
+            }
+        }
+
+        //window is full - status of the oldest note is awaited before next one goes
+        if (send_result == SendResult::IN_FLIGHT) {
+            send_result = receiveInFlightStatuses(static_cast<size_t>(srv_pipeline_window) - 1);
+        }
+
+        if (send_result != SendResult::SENT) {
+            res = Status::ERROR;
+        }
+
+        if (send_result == SendResult::CONNECTION_ERROR) {
             break;
         }
+    }
+
+    //statuses of the last notes of batch
+    if (receiveInFlightStatuses(0) != SendResult::SENT) {
+        res = Status::ERROR;
+    }
 
-        //send md5 file contents
-        ifstream md5_f_stream(file_path + ".md5", ios::out | ios::binary);
+    //after attempt to send notes - connection is kept for next batch or closed till then
+    releaseSocket();
 
-        if (!md5_f_stream.is_open() || !md5_f_stream.good()) {
-            syslog(LOG_ERR, "failed to open md5 file '%s': '%s'", file_path.c_str(), strerror(errno));
+    upload_throttle.writeStats();
 
-            continue;
+    return res;
+}
+
+SendResult processTempFile(const string& file_name, const string& file_path) {
+    /* Process tmp file */
+
+    syslog(LOG_INFO, "processing temp file '%s'", file_path.c_str());
+
+    if (file_name.size() != NOTE_PROTOCOL_FRAME_NAME_LENGTH) {
+        syslog(LOG_WARNING, "found temp file with bad name: '%s'", file_path.c_str());
+
+        return SendResult::FILE_ERROR;
+    }
+
+    //single descriptor is used for checksum trailer and file content
+    FileDescriptorGuard file_descr(open(file_path.c_str(), O_RDONLY | O_CLOEXEC));
+
+    if (file_descr.get() == -1) {
+        syslog(LOG_ERR, "failed to open file '%s': '%s'", file_path.c_str(), strerror(errno));
+
+        return SendResult::FILE_ERROR;
+    }
+
+    struct stat file_stats;
+
+    if (fstat(file_descr.get(), &file_stats) != 0) {
+        syslog(LOG_ERR, "error while reading temp file '%s': '%s'", file_path.c_str(), strerror(errno));
+
+        return SendResult::FILE_ERROR;
+    }
+
+    size_t file_size = static_cast<size_t>(file_stats.st_size);
+
+    //get checksum
+    ChecksumAlgorithm checksum_algorithm;
+    string checksum_str;
+    bool has_md5_file = false;
+
+    if (readNoteChecksum(file_descr.get(), file_path, &file_size, &checksum_algorithm, &checksum_str, &has_md5_file) 
+            != Status::OK) {
+        return SendResult::FILE_ERROR;
+    }
+
+    if (file_size == 0 || file_size > MAX_OUT_FILE_SIZE) {
+        syslog(LOG_WARNING, "found temp file with invalid size - %li max is %lui: '%s'", 
+            file_size, MAX_OUT_FILE_SIZE, file_path.c_str());
+
+        return SendResult::FILE_ERROR;
+    }
+
+    //send file info to noter server
+
+    //(re)connect to noter server
+    ensureConnected();
+
+    //md5 is understood by any server, so note is re-checksummed if server doesn't know algorithm it was written with
+    if (!srvSupportsChecksum(checksum_algorithm)
+            && convertNoteChecksumToMD5(file_descr.get(), nullptr, file_path, file_size, &checksum_algorithm, 
+                &checksum_str) != Status::OK) {
+        return SendResult::FILE_ERROR;
+    }
+
+    //large note waits for reply to resume query, so it isn't pipelined
+    bool resumable = srv_protocol_version >= 5 && file_size >= NOTE_PROTOCOL_RESUME_MIN_NOTE_LENGTH;
+
+    if (pipelineAllowed() && !resumable) {
+        SendResult send_result = sendNoteFrame(file_name, file_path, file_descr.get(), nullptr, file_size, 
+            checksum_algorithm, checksum_str);
+
+        if (send_result != SendResult::SENT) {
+            return send_result;
         }
 
-        char md5_file_buf[MD5_FILE_CONTENT_LENGTH];
+        InFlightNote in_flight_note;
+        in_flight_note.note_name = file_name;
+        in_flight_note.note_label = file_path;
+        in_flight_note.note_size = file_size;
+        in_flight_note.file_path = file_path;
+        in_flight_note.has_md5_file = has_md5_file;
 
-        md5_f_stream.read(md5_file_buf, MD5_FILE_CONTENT_LENGTH);
+        in_flight_notes.push_back(move(in_flight_note));
 
-        if (!md5_f_stream.good()) {
-            syslog(LOG_ERR, "failed to read md5 file for '%s': '%s'", file_path.c_str(), strerror(errno));
+        return SendResult::IN_FLIGHT;
+    }
 
-            continue;
+    //replies to notes in flight come before reply to resume query
+    SendResult in_flight_result = receiveInFlightStatuses(0);
+
+    if (in_flight_result == SendResult::CONNECTION_ERROR) {
+        return in_flight_result;
+    }
+
+    SendResult send_result = sendNote(file_name, file_path, file_descr.get(), nullptr, file_size, checksum_algorithm, 
+        checksum_str);
+
+    if (send_result == SendResult::SENT) {
+        unlink(file_path.c_str());
+
+        if (has_md5_file) {
+            unlink((file_path + ".md5").c_str());
         }
+    }
+
+    //note in flight server didn't take is reported too
+    return send_result == SendResult::SENT ? in_flight_result : send_result;
+}
 
-        if (sendAll(sock_descr, md5_file_buf, MD5_FILE_CONTENT_LENGTH) != Status::OK) {
-            syslog(LOG_ERR, "failed to send md5 file for '%s': '%s'", file_path.c_str(), strerror(errno));
+SendResult processRingNote(const string& note_name, const string& note_data, uint64_t ring_next_position) {
+    string note_label = "ring:" + note_name;
 
-            break;
+    syslog(LOG_INFO, "processing note '%s'", note_label.c_str());
+
+    size_t note_size = note_data.size();
+    ChecksumAlgorithm checksum_algorithm;
+    string checksum_str;
+    size_t trailer_length;
+
+    //ring notes are always written with checksum trailer
+    if (parseChecksumTrailer(note_data.c_str(), note_size, &checksum_algorithm, &checksum_str, &trailer_length) 
+            != Status::OK || trailer_length == 0) {
+        syslog(LOG_ERR, "failed to read checksum trailer of '%s'", note_label.c_str());
+
+        return SendResult::FILE_ERROR;
+    }
+
+    note_size -= trailer_length;
+
+    if (note_size == 0) {
+        syslog(LOG_WARNING, "found empty note '%s'", note_label.c_str());
+
+        return SendResult::FILE_ERROR;
+    }
+
+    ensureConnected();
+
+    if (!srvSupportsChecksum(checksum_algorithm)
+            && convertNoteChecksumToMD5(-1, note_data.c_str(), note_label, note_size, &checksum_algorithm, &checksum_str) 
+                != Status::OK) {
+        return SendResult::FILE_ERROR;
+    }
+
+    if (pipelineAllowed()) {
+        SendResult send_result = sendNoteFrame(note_name, note_label, -1, note_data.c_str(), note_size, 
+            checksum_algorithm, checksum_str);
+
+        if (send_result != SendResult::SENT) {
+            return send_result;
         }
 
-        //send file content
+        InFlightNote in_flight_note;
+        in_flight_note.note_name = note_name;
+        in_flight_note.note_label = note_label;
+        in_flight_note.note_size = note_size;
+        in_flight_note.from_ring = true;
+        in_flight_note.note_data = note_data;
+        in_flight_note.ring_next_position = ring_next_position;
 
-        ifstream f_stream(file_path, ios::out | ios::binary);
+        in_flight_notes.push_back(move(in_flight_note));
 
-        if (!f_stream.is_open() || !f_stream.good()) {
-            syslog(LOG_ERR, "failed to open file '%s': '%s'", file_path.c_str(), strerror(errno));
+        return SendResult::IN_FLIGHT;
+    }
 
-            continue;
+    return sendNote(note_name, note_label, -1, note_data.c_str(), note_size, checksum_algorithm, checksum_str);
+}
+
+int spillRingNote(const string& note_name, const string& note_data) {
+    //temp file is skipped by scan until renamed to note name
+    string tmp_file_path = OUT_FILES_TMP_DIR + OUT_FILE_TMP_PREFIX + note_name;
+    FileDescriptorGuard file_descr(open(tmp_file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+
+    if (file_descr.get() == -1) {
+        return Status::ERROR;
+    }
+
+    if (writeAll(file_descr.get(), note_data.c_str(), note_data.size()) != Status::OK 
+            || rename(tmp_file_path.c_str(), (OUT_FILES_TMP_DIR + note_name).c_str()) != 0) {
+        unlink(tmp_file_path.c_str());
+
+        return Status::ERROR;
+    }
+
+    syslog(LOG_INFO, "moved note '%s' from spool ring to spool dir", note_name.c_str());
+
+    return Status::OK;
+}
+
+SendResult sendNote(const string& note_name, const string& note_label, int file_descr, const char* note_data, 
+        size_t note_size, ChecksumAlgorithm checksum_algorithm, const string& checksum_str) {
+    bool sock_was_kept_alive = sock_kept_alive;
+
+    SendResult send_result = transferNote(note_name, note_label, file_descr, note_data, note_size, checksum_algorithm, 
+        checksum_str);
+
+    //connection kept open since last batch may be dropped without notice (server restart, NAT timeout), 
+    //note is sent again over new one
+    if (send_result == SendResult::CONNECTION_ERROR && sock_was_kept_alive) {
+        syslog(LOG_INFO, "kept alive connection to server is broken, reconnecting");
+
+        closeSocket();
+        connectSocketLoop();
+
+        send_result = transferNote(note_name, note_label, file_descr, note_data, note_size, checksum_algorithm, 
+            checksum_str);
+    }
+
+    return send_result;
+}
+
+SendResult transferNote(const string& note_name, const string& note_label, int file_descr, const char* note_data, 
+        size_t note_size, ChecksumAlgorithm checksum_algorithm, const string& checksum_str) {
+    //server may keep part of large note from transfer broken before, then only chunks it doesn't have are sent
+    if (file_descr != -1 && srv_protocol_version >= 5 && note_size >= NOTE_PROTOCOL_RESUME_MIN_NOTE_LENGTH) {
+        vector<uint32_t> srv_chunk_crcs;
+        SendResult resume_result = queryNoteResume(note_name, note_label, note_size, checksum_algorithm, checksum_str, 
+            &srv_chunk_crcs);
+
+        if (resume_result != SendResult::SENT) {
+            return resume_result;
+        }
+
+        if (!srv_chunk_crcs.empty()) {
+            resume_result = sendNotePatch(note_name, note_label, file_descr, note_size, checksum_algorithm, checksum_str, 
+                srv_chunk_crcs);
+
+            if (resume_result != SendResult::SENT) {
+                return resume_result;
+            }
+
+            return receiveNoteStatus(note_name, note_label, note_size);
         }
+    }
 
-        long bytes_to_send = file_size;
-        bool file_error = false;
-        bool sock_error = false;
+    SendResult send_result = sendNoteFrame(note_name, note_label, file_descr, note_data, note_size, checksum_algorithm, 
+        checksum_str);
 
-        while (bytes_to_send > 0 && !file_error && !sock_error) {
-            int bytes_chunk = min(FILE_CONTENT_BUFFER_LENGTH, bytes_to_send);
+    if (send_result != SendResult::SENT) {
+        return send_result;
+    }
 
-            //read file chunk
-            f_stream.read(file_content_buf.data(), bytes_chunk);
+    return receiveNoteStatus(note_name, note_label, note_size);
+}
 
-            if (!f_stream.good()) {
-                file_error = true;
-                break;
+SendResult sendNoteFrame(const string& note_name, const string& note_label, int file_descr, const char* note_data, 
+        size_t note_size, ChecksumAlgorithm checksum_algorithm, const string& checksum_str) {
+    //name, size and checksum go in single send
+    string frame_header = note_name;
+
+    uint32_t note_size_network_byteroder = htonl(note_size);
+    frame_header.append(reinterpret_cast<char*>(&note_size_network_byteroder), sizeof(note_size_network_byteroder));
+
+    if (srv_protocol_version >= 2) {
+        frame_header.push_back(static_cast<char>(checksum_algorithm));
+        frame_header.push_back(static_cast<char>(checksum_str.size()));
+    }
+
+    frame_header.append(checksum_str);
+
+    //header is held back and goes out in the same segment with start of note content
+    if (sendAll(sock_descr, frame_header.c_str(), frame_header.size(), MSG_MORE) != Status::OK) {
+        syslog(LOG_ERR, "failed to send file info for '%s': '%s'", note_label.c_str(), strerror(errno));
+
+        return SendResult::CONNECTION_ERROR;
+    }
+
+    //send file content (without checksum trailer)
+
+    //failed read of file is seen here too - server is in the middle of reading file content, connection can't be reused
+    if (sendNoteContent(file_descr, note_data, 0, note_size) != Status::OK) {
+        syslog(LOG_ERR, "error while sending file chunk '%s': '%s'", note_label.c_str(), strerror(errno));
+
+        return SendResult::CONNECTION_ERROR;
+    }
+
+    syslog(LOG_INFO, "sent temp file '%s' of length '%li'", note_label.c_str(), note_size);
+
+    return SendResult::SENT;
+}
+
+int sendNoteContent(int file_descr, const char* note_data, size_t content_offset, size_t content_length) {
+    size_t bytes_to_send = content_length;
+    long file_offset = content_offset;
+
+    while (bytes_to_send > 0) {
+        //smaller chunks under pressure
+        size_t bytes_chunk = min(upload_throttle.chunkLength(FILE_CONTENT_CHUNK_LENGTH), bytes_to_send);
+        auto chunk_start_time = chrono::steady_clock::now();
+
+        //spool file goes from page cache straight to socket, ring note is in memory already
+        int chunk_res = note_data != nullptr 
+            ? sendAll(sock_descr, note_data + file_offset, bytes_chunk) 
+            : sendFileAll(sock_descr, file_descr, file_offset, bytes_chunk);
+
+        if (chunk_res != Status::OK) {
+            return Status::ERROR;
+        }
+
+        bytes_to_send -= bytes_chunk;
+        file_offset += bytes_chunk;
+
+        if (bytes_to_send > 0) {
+            upload_throttle.paceChunk(chrono::duration<double>(chrono::steady_clock::now() - chunk_start_time).count());
+        }
+    }
+
+    return Status::OK;
+}
+
+string buildResumeNoteInfo(const string& note_name, size_t note_size, ChecksumAlgorithm checksum_algorithm, 
+        const string& checksum_str) {
+    string note_info = note_name;
+
+    uint32_t note_size_network_byteroder = htonl(note_size);
+    note_info.append(reinterpret_cast<char*>(&note_size_network_byteroder), sizeof(note_size_network_byteroder));
+    note_info.push_back(static_cast<char>(checksum_algorithm));
+    note_info.push_back(static_cast<char>(checksum_str.size()));
+    note_info.append(checksum_str);
+
+    return note_info;
+}
+
+string buildControlFrameHeader(const string& frame_name, size_t payload_length) {
+    string frame_header = frame_name;
+    frame_header.resize(NOTE_PROTOCOL_FRAME_NAME_LENGTH, '\0');
+
+    uint32_t payload_length_network_byteroder = htonl(payload_length);
+    frame_header.append(reinterpret_cast<char*>(&payload_length_network_byteroder), 
+        sizeof(payload_length_network_byteroder));
+
+    return frame_header;
+}
+
+SendResult queryNoteResume(const string& note_name, const string& note_label, size_t note_size, 
+        ChecksumAlgorithm checksum_algorithm, const string& checksum_str, vector<uint32_t> *srv_chunk_crcs) {
+    string note_info = buildResumeNoteInfo(note_name, note_size, checksum_algorithm, checksum_str);
+    string resume_frame = buildControlFrameHeader(NOTE_PROTOCOL_RESUME_FRAME_NAME, note_info.size()) + note_info;
+
+    //status, then count of chunks server has
+    uint32_t resume_resp[2] = {0, 0};
+
+    if (sendAll(sock_descr, resume_frame.c_str(), resume_frame.size()) != Status::OK
+            || recvAll(sock_descr, reinterpret_cast<char*>(resume_resp), sizeof(resume_resp), nullptr) 
+                != sizeof(resume_resp)) {
+        syslog(LOG_ERR, "failed to query server for resume of '%s': '%s'", note_label.c_str(), strerror(errno));
+
+        return SendResult::CONNECTION_ERROR;
+    }
+
+    size_t note_chunks_num = (note_size + NOTE_PROTOCOL_RESUME_CHUNK_LENGTH - 1) / NOTE_PROTOCOL_RESUME_CHUNK_LENGTH;
+    size_t srv_chunks_num = ntohl(resume_resp[1]);
+
+    if (resume_resp[0] != static_cast<uint32_t>(ProcessingStatus::OK) || srv_chunks_num > note_chunks_num) {
+        syslog(LOG_ERR, "got invalid resume reply for '%s'", note_label.c_str());
+
+        return SendResult::CONNECTION_ERROR;
+    }
+
+    srv_chunk_crcs->resize(srv_chunks_num);
+
+    if (srv_chunks_num > 0 && recvAll(sock_descr, reinterpret_cast<char*>(srv_chunk_crcs->data()), 
+            srv_chunks_num * sizeof(uint32_t), nullptr) != static_cast<int>(srv_chunks_num * sizeof(uint32_t))) {
+        syslog(LOG_ERR, "failed to read resume reply for '%s': '%s'", note_label.c_str(), strerror(errno));
+
+        return SendResult::CONNECTION_ERROR;
+    }
+
+    for (uint32_t& chunk_crc : *srv_chunk_crcs) {
+        chunk_crc = ntohl(chunk_crc);
+    }
+
+    return SendResult::SENT;
+}
+
+SendResult sendNotePatch(const string& note_name, const string& note_label, int file_descr, size_t note_size, 
+        ChecksumAlgorithm checksum_algorithm, const string& checksum_str, const vector<uint32_t>& srv_chunk_crcs) {
+    size_t note_chunks_num = (note_size + NOTE_PROTOCOL_RESUME_CHUNK_LENGTH - 1) / NOTE_PROTOCOL_RESUME_CHUNK_LENGTH;
+    vector<uint32_t> chunk_idxs;
+    vector<char> chunk_buf(NOTE_PROTOCOL_RESUME_CHUNK_LENGTH);
+
+    //chunks server has are compared by crc, the rest are missing
+    for (size_t chunk_idx = 0; chunk_idx < note_chunks_num; chunk_idx++) {
+        if (chunk_idx < srv_chunk_crcs.size()) {
+            size_t chunk_offset = chunk_idx * NOTE_PROTOCOL_RESUME_CHUNK_LENGTH;
+            size_t chunk_length = min(NOTE_PROTOCOL_RESUME_CHUNK_LENGTH, note_size - chunk_offset);
+
+            //nothing is sent yet, connection goes on with next note
+            if (preadAll(file_descr, chunk_buf.data(), chunk_length, chunk_offset) != Status::OK) {
+                syslog(LOG_ERR, "error while reading file '%s': '%s'", note_label.c_str(), strerror(errno));
+
+                return SendResult::FILE_ERROR;
             }
 
-            //send file chunk
-            if (sendAll(sock_descr, file_content_buf.data(), bytes_chunk) != Status::OK) {
-                sock_error = true;
-                break;
+            uint32_t chunk_crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(chunk_buf.data()), 
+                chunk_length);
+
+            if (chunk_crc == srv_chunk_crcs[chunk_idx]) {
+                continue;
             }
+        }
+
+        chunk_idxs.push_back(chunk_idx);
+    }
+
+    string patch_payload = buildResumeNoteInfo(note_name, note_size, checksum_algorithm, checksum_str);
+
+    uint32_t chunks_num_network_byteroder = htonl(chunk_idxs.size());
+    patch_payload.append(reinterpret_cast<char*>(&chunks_num_network_byteroder), sizeof(chunks_num_network_byteroder));
+
+    for (uint32_t chunk_idx : chunk_idxs) {
+        uint32_t chunk_idx_network_byteroder = htonl(chunk_idx);
+        patch_payload.append(reinterpret_cast<char*>(&chunk_idx_network_byteroder), sizeof(chunk_idx_network_byteroder));
+    }
 
-            bytes_to_send -= bytes_chunk;
+    string patch_frame = buildControlFrameHeader(NOTE_PROTOCOL_PATCH_FRAME_NAME, patch_payload.size()) + patch_payload;
+
+    syslog(LOG_INFO, "resuming '%s', %lu of %lu chunks are sent", note_label.c_str(), 
+        static_cast<unsigned long>(chunk_idxs.size()), static_cast<unsigned long>(note_chunks_num));
+
+    if (sendAll(sock_descr, patch_frame.c_str(), patch_frame.size(), chunk_idxs.empty() ? 0 : MSG_MORE) != Status::OK) {
+        syslog(LOG_ERR, "failed to send patch of '%s': '%s'", note_label.c_str(), strerror(errno));
+
+        return SendResult::CONNECTION_ERROR;
+    }
+
+    for (uint32_t chunk_idx : chunk_idxs) {
+        size_t chunk_offset = chunk_idx * NOTE_PROTOCOL_RESUME_CHUNK_LENGTH;
+
+        if (sendNoteContent(file_descr, nullptr, chunk_offset, min(NOTE_PROTOCOL_RESUME_CHUNK_LENGTH, 
+                note_size - chunk_offset)) != Status::OK) {
+            syslog(LOG_ERR, "error while sending file chunk '%s': '%s'", note_label.c_str(), strerror(errno));
+
+            return SendResult::CONNECTION_ERROR;
         }
+    }
 
-        f_stream.close();
+    syslog(LOG_INFO, "sent patch of '%s' of length '%li'", note_label.c_str(), note_size);
 
-        if (file_error) {
-            syslog(LOG_ERR, "error while reading file '%s': '%s'", file_path.c_str(), strerror(errno));
+    return SendResult::SENT;
+}
 
-            continue;
+SendResult receiveNoteStatus(const string& note_name, const string& note_label, size_t note_size) {
+    int resp_code = -1;
+    int status_bytes_read = recvAll(sock_descr, reinterpret_cast<char*>(&resp_code), sizeof(resp_code), nullptr);
+
+    if (status_bytes_read <= 0) {
+        syslog(LOG_ERR, "error while reading request status for file '%s': '%s'", note_label.c_str(), strerror(errno));
+
+        return SendResult::CONNECTION_ERROR;
+    }
+
+    if (srv_protocol_version >= 4) {
+        char resp_note_name[NOTE_PROTOCOL_FRAME_NAME_LENGTH];
+
+        if (recvAll(sock_descr, resp_note_name, sizeof(resp_note_name), nullptr) != sizeof(resp_note_name)) {
+            syslog(LOG_ERR, "error while reading request status for file '%s': '%s'", note_label.c_str(), strerror(errno));
+
+            return SendResult::CONNECTION_ERROR;
         }
 
-        if (sock_error) {
-            syslog(LOG_ERR, "error while sending file chunk '%s': '%s'", file_path.c_str(), strerror(errno));
+        //statuses come in order notes were sent, anything else means client and server are out of sync
+        if (string(resp_note_name, sizeof(resp_note_name)) != note_name) {
+            syslog(LOG_ERR, "got status of '%.*s' while status of '%s' was expected", 
+                static_cast<int>(sizeof(resp_note_name)), resp_note_name, note_label.c_str());
 
-            break;
+            return SendResult::CONNECTION_ERROR;
         }
+    }
 
-        syslog(LOG_INFO, "sent temp file '%s' of length '%li'", file_path.c_str(), file_size);
+    sock_last_used_sec = time(0);
+    sock_kept_alive = false;
 
-        int resp_code = -1;
-        int status_bytes_read = recvAll(sock_descr, reinterpret_cast<char*>(&resp_code), sizeof(resp_code), nullptr);
+    if (resp_code == static_cast<int>(ProcessingStatus::OK)) {
+        syslog(LOG_INFO, "successfully processed/sent file '%s' of length '%li'", note_label.c_str(), note_size);
+    } else {
+        syslog(LOG_ERR, "failed to send temp file '%s' of length '%li'. Response status: '%i'", 
+            note_label.c_str(), note_size, resp_code);
 
-        if (status_bytes_read <= 0) {
-            syslog(LOG_ERR, "error while reading request status for file '%s': '%s'", file_path.c_str(), strerror(errno));
+        return SendResult::FILE_ERROR;
+    }
 
-            break;
+    return SendResult::SENT;
+}
+
+int readNoteChecksum(int file_descr, const string& file_path, size_t *note_size, ChecksumAlgorithm *algorithm, 
+        string *checksum_str, bool *has_md5_file) {
+    size_t trailer_length;
+
+    if (readChecksumTrailer(file_descr, *note_size, algorithm, checksum_str, &trailer_length) != Status::OK) {
+        syslog(LOG_ERR, "failed to read checksum trailer of '%s': '%s'", file_path.c_str(), strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    if (trailer_length > 0) {
+        //algorithm unknown here is fine as long as server knows it, otherwise note is re-checksummed with md5
+        size_t checksum_length = ChecksumCalculator::hexLength(*algorithm);
+
+        if (checksum_length != 0 && checksum_str->size() != checksum_length) {
+            syslog(LOG_ERR, "bad checksum in trailer of '%s'", file_path.c_str());
+
+            return Status::ERROR;
         }
 
-        if (resp_code == static_cast<int>(ProcessingStatus::OK)) {
-            syslog(LOG_INFO, "successfully processed/sent file '%s' of length '%li'", file_path.c_str(), file_size);
+        *note_size -= trailer_length;
 
-            deleteFile(file_path);
-            deleteFile(file_path + ".md5");
-        } else {
-            syslog(LOG_ERR, "failed to send temp file '%s' of length '%li'. Response status: '%i'", 
-                file_path.c_str(), file_size, resp_code);
+        return Status::OK;
+    }
+
+    //note written by older noter - checksum is in separate file
+    ifstream md5_f_stream(file_path + ".md5", ios::in | ios::binary);
+
+    if (!md5_f_stream.is_open() || !md5_f_stream.good()) {
+        syslog(LOG_ERR, "failed to open md5 file '%s': '%s'", file_path.c_str(), strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    *algorithm = ChecksumAlgorithm::MD5;
+    checksum_str->resize(MD5_FILE_CONTENT_LENGTH);
+
+    md5_f_stream.read(checksum_str->data(), MD5_FILE_CONTENT_LENGTH);
+
+    if (!md5_f_stream.good()) {
+        syslog(LOG_ERR, "failed to read md5 file for '%s': '%s'", file_path.c_str(), strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    *has_md5_file = true;
+
+    return Status::OK;
+}
+
+int convertNoteChecksumToMD5(int file_descr, const char* note_data, const string& file_path, size_t note_size, 
+        ChecksumAlgorithm *algorithm, string *checksum_str) {
+    syslog(LOG_DEBUG, "server doesn't support checksum '%s' of '%s', using md5", 
+        ChecksumCalculator::algorithmName(*algorithm), file_path.c_str());
+
+    //note is verified against its own checksum in the same pass, so md5 is never made up for corrupted note.
+    //Not possible if noterd is built without algorithm note was written with
+    unique_ptr<ChecksumCalculator> note_checksum = ChecksumCalculator::create(
+        *algorithm, 
+        static_cast<unsigned>(max(AppConfig::getLongValue(CONFIG_CHECKSUM_THREADS, 0L), 0L))
+    );
+    unique_ptr<ChecksumCalculator> md5_checksum = ChecksumCalculator::create(ChecksumAlgorithm::MD5);
+
+    vector<char> read_buf(note_data == nullptr ? min(CHECKSUM_READ_BUFFER_LENGTH, note_size) : 0);
+    size_t file_offset = 0;
+
+    while (file_offset < note_size) {
+        size_t bytes_chunk = note_data != nullptr ? note_size : min(read_buf.size(), note_size - file_offset);
+        const char* chunk_data = note_data != nullptr ? note_data + file_offset : read_buf.data();
+
+        if (note_data == nullptr && preadAll(file_descr, read_buf.data(), bytes_chunk, file_offset) != Status::OK) {
+            syslog(LOG_ERR, "error while reading file '%s': '%s'", file_path.c_str(), strerror(errno));
+
+            return Status::ERROR;
         }
+
+        if (note_checksum) {
+            note_checksum->update(chunk_data, bytes_chunk);
+        }
+
+        md5_checksum->update(chunk_data, bytes_chunk);
+
+        file_offset += bytes_chunk;
+    }
+
+    string note_checksum_str;
+
+    if (note_checksum && (note_checksum->hexDigest(&note_checksum_str) != Status::OK 
+            || note_checksum_str != *checksum_str)) {
+        syslog(LOG_ERR, "error: %s of '%s' doesnt match", ChecksumCalculator::algorithmName(*algorithm), file_path.c_str());
+
+        return Status::ERROR;
     }
 
-    //after attempt to send files - close socket until next heartbeat
-    closeSocket();
+    *algorithm = ChecksumAlgorithm::MD5;
+
+    if (md5_checksum->hexDigest(checksum_str) != Status::OK) {
+        syslog(LOG_ERR, "failed to calculate md5 of '%s'", file_path.c_str());
+
+        return Status::ERROR;
+    }
+
+    return Status::OK;
+}
+
+bool pipelineAllowed() {
+    //first note over kept alive connection waits for its status - it is sent again if connection turns out broken
+    return srv_protocol_version >= 4 && srv_pipeline_window > 1 && !sock_kept_alive;
+}
+
+SendResult receiveInFlightStatuses(size_t max_in_flight) {
+    SendResult res = SendResult::SENT;
+
+    while (in_flight_notes.size() > max_in_flight) {
+        const InFlightNote& note = in_flight_notes.front();
+        SendResult send_result = receiveNoteStatus(note.note_name, note.note_label, note.note_size);
+
+        if (send_result == SendResult::CONNECTION_ERROR || finishInFlightNote(note, send_result) != Status::OK) {
+            //notes left are not lost - spool files stay, ring records are not released, all are sent again later
+            syslog(LOG_ERR, "status of %lu notes sent to server is unknown", 
+                static_cast<unsigned long>(in_flight_notes.size()));
+
+            in_flight_notes.clear();
+            closeSocket();
+
+            return SendResult::CONNECTION_ERROR;
+        }
+
+        if (send_result != SendResult::SENT) {
+            res = send_result;
+        }
+
+        in_flight_notes.pop_front();
+    }
+
+    return res;
+}
+
+int finishInFlightNote(const InFlightNote& note, SendResult send_result) {
+    if (!note.from_ring) {
+        if (send_result == SendResult::SENT) {
+            unlink(note.file_path.c_str());
+
+            if (note.has_md5_file) {
+                unlink((note.file_path + ".md5").c_str());
+            }
+        }
+
+        return Status::OK;
+    }
+
+    //note server didn't take is moved to spool dir, ring space is not held by it
+    if (send_result == SendResult::FILE_ERROR && spillRingNote(note.note_name, note.note_data) != Status::OK) {
+        syslog(LOG_ERR, "failed to move note '%s' from spool ring to spool dir: '%s'", 
+            note.note_name.c_str(), strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    spool_ring.release(note.ring_next_position);
+
+    return Status::OK;
 }
 
 void connectSocketLoop() {
+    static BacklogCompressor backlog_compressor(OUT_FILES_TMP_DIR);
+    //all workers reconnect while server is down, backlog is recompressed by one of them
+    static mutex backlog_compressor_mutex;
+
     syslog(LOG_DEBUG, "opening socket to server");
 
-    while (connectSocket() == Status::ERROR) {
+    while (connectSocket() == Status::ERROR || negotiateProtocol() == Status::ERROR) {
+        closeSocket();
+
+        //server is down and spool keeps growing - time till reconnect is used to make queued notes smaller
+        time_t reconnect_time_sec = time(0) + SOCKET_RECONNECT_INTERVAL_SEC;
+
+        //slow compression would add to pressure of the host
+        if (!upload_throttle.underPressure()) {
+            unique_lock<mutex> backlog_lock(backlog_compressor_mutex, try_to_lock);
+
+            if (backlog_lock.owns_lock()) {
+                backlog_compressor.recompressBacklog(reconnect_time_sec);
+            }
+        }
+
+        time_t time_till_reconnect_sec = reconnect_time_sec - time(0);
+
+        if (time_till_reconnect_sec > 0) {
+            sleep(time_till_reconnect_sec);
+        }
+    }
+
+    sock_last_used_sec = time(0);
+    sock_kept_alive = false;
+
+    syslog(LOG_INFO, "connected to server, protocol v%u", srv_protocol_version);
+}
+
+void ensureConnected() {
+    struct pollfd sock_poll_descr = {sock_descr, POLLIN, 0};
+
+    //kept alive connection closed by server while it was idle, or after it rejected note. 
+    //Connection with notes in flight is readable for their statuses
+    if (sock_descr != -1 && in_flight_notes.empty() && poll(&sock_poll_descr, 1, 0) != 0) {
+        syslog(LOG_INFO, "server closed idle connection, reconnecting");
+
         closeSocket();
-        sleep(SOCKET_RECONNECT_INTERVAL_SEC);
     }
 
-    syslog(LOG_INFO, "connected to server");
+    if (sock_descr == -1) {
+        connectSocketLoop();
+    }
+}
+
+void releaseSocket() {
+    //older server or keep-alive off - connection is opened for every batch
+    if (srv_protocol_version < 3 || srv_keepalive_sec == 0) {
+        closeSocket();
+
+        return;
+    }
+
+    sock_kept_alive = sock_descr != -1;
+}
+
+int pingServer() {
+    string ping_frame = NOTE_PROTOCOL_PING_FRAME_NAME;
+    ping_frame.resize(NOTE_PROTOCOL_FRAME_NAME_LENGTH + sizeof(uint32_t), '\0');
+
+    int resp_code = -1;
+
+    if (sendAll(sock_descr, ping_frame.c_str(), ping_frame.size()) != Status::OK
+            || recvAll(sock_descr, reinterpret_cast<char*>(&resp_code), sizeof(resp_code), nullptr) != sizeof(resp_code)
+            || resp_code != static_cast<int>(ProcessingStatus::OK)) {
+        syslog(LOG_INFO, "ping of server failed, connection is reopened for next note: '%s'", strerror(errno));
+
+        closeSocket();
+
+        return Status::ERROR;
+    }
+
+    sock_last_used_sec = time(0);
+
+    return Status::OK;
 }
 
 int connectSocket() {
@@ -386,12 +1361,83 @@ int connectSocket() {
     return Status::OK;
 }
 
+int negotiateProtocol() {
+    srv_protocol_version = 1;
+    srv_checksum_algorithms = 1u << static_cast<uint8_t>(ChecksumAlgorithm::MD5);
+
+    if (legacy_srv_detected_time_sec != 0 && time(0) - legacy_srv_detected_time_sec < PROTOCOL_HELLO_RETRY_INTERVAL_SEC) {
+        return Status::OK;
+    }
+
+    //hello has size 0 so older server never takes it for note
+    string hello_frame = NOTE_PROTOCOL_HELLO_FRAME_NAME + to_string(NOTE_PROTOCOL_VERSION);
+    hello_frame.resize(NOTE_PROTOCOL_FRAME_NAME_LENGTH + sizeof(uint32_t), '\0');
+
+    if (sendAll(sock_descr, hello_frame.c_str(), hello_frame.size()) != Status::OK) {
+        syslog(LOG_ERR, "failed to send hello: '%s'", strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    int resp_code = -1;
+
+    if (recvAll(sock_descr, reinterpret_cast<char*>(&resp_code), sizeof(resp_code), nullptr) != sizeof(resp_code)) {
+        syslog(LOG_ERR, "failed to read hello response: '%s'", strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    if (resp_code != static_cast<int>(ProcessingStatus::OK)) {
+        //server closes connection after rejecting hello
+        syslog(LOG_INFO, "server doesn't support protocol negotiation, using protocol v1");
+
+        legacy_srv_detected_time_sec = time(0);
+
+        closeSocket();
+
+        return connectSocket();
+    }
+
+    uint32_t hello_resp[2];
+
+    if (recvAll(sock_descr, reinterpret_cast<char*>(hello_resp), sizeof(hello_resp), nullptr) != sizeof(hello_resp)) {
+        syslog(LOG_ERR, "failed to read hello response: '%s'", strerror(errno));
+
+        return Status::ERROR;
+    }
+
+    srv_protocol_version = min(NOTE_PROTOCOL_VERSION, ntohl(hello_resp[0]));
+    srv_checksum_algorithms = ntohl(hello_resp[1]);
+    legacy_srv_detected_time_sec = 0;
+
+    return Status::OK;
+}
+
+bool srvSupportsChecksum(ChecksumAlgorithm algorithm) {
+    //v1 frame has room for md5 only
+    if (srv_protocol_version < 2) {
+        return algorithm == ChecksumAlgorithm::MD5;
+    }
+
+    if (ChecksumCalculator::isTree(algorithm) 
+            && (srv_checksum_algorithms & (1u << ChecksumCalculator::CHECKSUM_TREE_SUPPORTED_BIT)) == 0) {
+        return false;
+    }
+
+    uint8_t algorithm_id = static_cast<uint8_t>(ChecksumCalculator::treeBase(algorithm));
+
+    return algorithm_id < ChecksumCalculator::CHECKSUM_TREE_SUPPORTED_BIT 
+        && (srv_checksum_algorithms & (1u << algorithm_id)) != 0;
+}
+
 void closeSocket() {
     if (sock_descr != -1) {
         shutdown(sock_descr, SHUT_RDWR);
+        close(sock_descr);
     }
 
     sock_descr = -1;
+    sock_kept_alive = false;
 }
 
 void registerSignalHandlers() {
@@ -404,5 +1450,8 @@ void registerSignalHandlers() {
 }
 
 void sigHandler(int sig_num) {
+    closeLocalListenSocket(local_listen_sock_descr);
+    closeSpoolWatch(spool_watch_descr);
+
     exit(sig_num);
 }
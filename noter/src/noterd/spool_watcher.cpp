@@ -0,0 +1,88 @@
+#include "spool_watcher.hpp"
+
+#include <sys/inotify.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <cstring>
+#include <string>
+#include <filesystem>
+#include <vector>
+
+#include "noter_utils.hpp"
+
+using namespace std;
+
+extern const string OUT_FILE_TMP_PREFIX;
+
+//room for at least 100 events with max name length
+const size_t SPOOL_EVENTS_BUFFER_LENGTH = 100 * (sizeof(struct inotify_event) + NAME_MAX + 1);
+
+
+int openSpoolWatch(const string& dir_path) {
+    int watch_descr = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (watch_descr == -1) {
+        syslog(LOG_ERR, "failed to init inotify: '%s'", strerror(errno));
+
+        return -1;
+    }
+
+    if (inotify_add_watch(watch_descr, dir_path.c_str(), IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) == -1) {
+        syslog(LOG_ERR, "failed to watch spool dir '%s': '%s'", dir_path.c_str(), strerror(errno));
+        close(watch_descr);
+
+        return -1;
+    }
+
+    return watch_descr;
+}
+
+void closeSpoolWatch(int watch_descr) {
+    if (watch_descr != -1) {
+        close(watch_descr);
+    }
+}
+
+int readSpoolEvents(int watch_descr, vector<string> *note_names, bool *scan_needed) {
+    alignas(struct inotify_event) char events_buf[SPOOL_EVENTS_BUFFER_LENGTH];
+
+    while (true) {
+        ssize_t bytes_read = read(watch_descr, events_buf, sizeof(events_buf));
+
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            //EAGAIN - no more pending events
+            return errno == EAGAIN || errno == EWOULDBLOCK ? Status::OK : Status::ERROR;
+        }
+
+        for (char* event_ptr = events_buf; event_ptr < events_buf + bytes_read; ) {
+            struct inotify_event* event = reinterpret_cast<struct inotify_event*>(event_ptr);
+            event_ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                *scan_needed = true;
+
+                continue;
+            }
+
+            if (event->len == 0 || (event->mask & IN_ISDIR)) {
+                continue;
+            }
+
+            string file_name(event->name);
+
+            //temp files are not published yet, checksum files are sent along with note
+            if (startsWith(file_name, OUT_FILE_TMP_PREFIX) || filesystem::path(file_name).extension().string() == ".md5") {
+                continue;
+            }
+
+            note_names->push_back(file_name);
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#include "upload_queue.hpp"
+
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+
+void UploadQueue::push(const string& note_name) {
+    {
+        lock_guard<mutex> queue_lock(mutex_);
+
+        if (!claimed_names_.insert(note_name).second) {
+            return;
+        }
+
+        queued_names_.push_back(note_name);
+    }
+
+    queue_cond_.notify_one();
+}
+
+void UploadQueue::claim(vector<string> *note_names, size_t max_notes, size_t workers_num, int timeout_ms) {
+    note_names->clear();
+
+    unique_lock<mutex> queue_lock(mutex_);
+
+    queue_cond_.wait_for(queue_lock, chrono::milliseconds(timeout_ms), [this]() { return !queued_names_.empty(); });
+
+    //one worker doesn't take whole queue while others are idle
+    size_t claim_num = min(max_notes, max<size_t>(queued_names_.size() / max<size_t>(workers_num, 1), 1));
+
+    while (!queued_names_.empty() && note_names->size() < claim_num) {
+        note_names->push_back(move(queued_names_.front()));
+        queued_names_.pop_front();
+    }
+}
+
+void UploadQueue::release(const vector<string>& note_names) {
+    lock_guard<mutex> queue_lock(mutex_);
+
+    for (const auto& note_name : note_names) {
+        claimed_names_.erase(note_name);
+    }
+}
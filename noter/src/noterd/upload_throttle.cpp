@@ -0,0 +1,249 @@
+#include "upload_throttle.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "noter_utils.hpp"
+#include "app_config.hpp"
+
+using namespace std;
+
+const string PRESSURE_DIR_PATH = "/proc/pressure/";
+
+//percent of time some tasks were stalled, 0 - pressure is ignored
+const long DEFAULT_PRESSURE_THROTTLE_PCT = 10L;
+const long DEFAULT_PRESSURE_PAUSE_PCT = 40L;
+//host may stay under pressure for good, notes must go anyway
+const long DEFAULT_PRESSURE_MAX_PAUSE_SEC = 300L;
+
+//1048576 = 1 meg, finer steps between pauses than 10 meg chunks of full speed
+const size_t THROTTLED_CHUNK_LENGTH = 1048576;
+//lowest share of time spent sending while throttled
+const double MIN_THROTTLED_DUTY = 0.1;
+//well below socket timeout of server
+const double MAX_CHUNK_PAUSE_SEC = 5.0;
+
+
+double PressureSample::highest() const {
+    return max({cpu_some_avg10, io_some_avg10, memory_some_avg10});
+}
+
+bool readPressure(const string& resource, double *some_avg10) {
+    FileDescriptorGuard pressure_descr(open((PRESSURE_DIR_PATH + resource).c_str(), O_RDONLY | O_CLOEXEC));
+
+    if (pressure_descr.get() == -1) {
+        return false;
+    }
+
+    //'some avg10=1.23 avg60=0.50 avg300=0.10 total=12345' is the first line
+    char pressure_buf[256];
+    ssize_t bytes_read = read(pressure_descr.get(), pressure_buf, sizeof(pressure_buf) - 1);
+
+    if (bytes_read <= 0) {
+        return false;
+    }
+
+    pressure_buf[bytes_read] = '\0';
+
+    return sscanf(pressure_buf, "some avg10=%lf", some_avg10) == 1;
+}
+
+const char* throttleStateName(ThrottleState state) {
+    switch (state) {
+        case ThrottleState::THROTTLED:
+            return "throttled";
+        case ThrottleState::PAUSED:
+            return "paused";
+        default:
+            return "full";
+    }
+}
+
+void UploadThrottle::init(const string& stats_file_path) {
+    stats_file_path_ = stats_file_path;
+
+    throttle_pct_ = max(AppConfig::getLongValue(CONFIG_PRESSURE_THROTTLE_PCT, DEFAULT_PRESSURE_THROTTLE_PCT), 0L);
+    pause_pct_ = max(AppConfig::getLongValue(CONFIG_PRESSURE_PAUSE_PCT, DEFAULT_PRESSURE_PAUSE_PCT), 0L);
+    max_pause_sec_ = max(AppConfig::getLongValue(CONFIG_PRESSURE_MAX_PAUSE_SEC, DEFAULT_PRESSURE_MAX_PAUSE_SEC), 0L);
+
+    //throttled range must not be empty
+    pause_pct_ = max(pause_pct_, throttle_pct_ + 1.0);
+
+    samplePressure();
+
+    if (!sample_.available) {
+        syslog(LOG_WARNING, "pressure stall information is not available, uploads are not throttled");
+    }
+}
+
+void UploadThrottle::samplePressure() {
+    lock_guard<mutex> throttle_lock(mutex_);
+    time_t curr_time_sec = time(0);
+
+    if (curr_time_sec == sampled_time_sec_) {
+        return;
+    }
+
+    sampled_time_sec_ = curr_time_sec;
+
+    PressureSample sample;
+    bool cpu_available = readPressure("cpu", &sample.cpu_some_avg10);
+    bool io_available = readPressure("io", &sample.io_some_avg10);
+    bool memory_available = readPressure("memory", &sample.memory_some_avg10);
+
+    sample.available = cpu_available || io_available || memory_available;
+    sample_ = sample;
+
+    ThrottleState state = ThrottleState::FULL;
+    double pressure_pct = sample_.highest();
+    duty_ = 1.0;
+
+    if (sample_.available && throttle_pct_ > 0 && pressure_pct >= throttle_pct_) {
+        if (pressure_pct >= pause_pct_) {
+            state = ThrottleState::PAUSED;
+            duty_ = MIN_THROTTLED_DUTY;
+        } else {
+            //the closer to pause threshold the longer pauses between chunks
+            state = ThrottleState::THROTTLED;
+            duty_ = max(1.0 - (pressure_pct - throttle_pct_) / (pause_pct_ - throttle_pct_), MIN_THROTTLED_DUTY);
+        }
+    }
+
+    if (state != state_) {
+        syslog(LOG_INFO, "uploads %s, pressure cpu %.2f%% io %.2f%% memory %.2f%%", throttleStateName(state),
+            sample_.cpu_some_avg10, sample_.io_some_avg10, sample_.memory_some_avg10);
+    }
+
+    state_ = state;
+
+    if (state_ != ThrottleState::PAUSED) {
+        max_pause_reached_ = false;
+    }
+
+    writeStatsLocked();
+}
+
+bool UploadThrottle::waitWhilePaused() {
+    samplePressure();
+
+    unique_lock<mutex> throttle_lock(mutex_);
+
+    //notes go on throttled till pressure drops below pause threshold again
+    if (state_ != ThrottleState::PAUSED || max_pause_reached_) {
+        return false;
+    }
+
+    time_t pause_start_sec = time(0);
+    paused_num_++;
+
+    //workers waiting along are released once the first of them reaches max pause
+    while (state_ == ThrottleState::PAUSED && !max_pause_reached_ && time(0) - pause_start_sec < max_pause_sec_) {
+        throttle_lock.unlock();
+
+        sleep(1);
+        samplePressure();
+
+        throttle_lock.lock();
+    }
+
+    paused_total_sec_ += time(0) - pause_start_sec;
+
+    if (state_ == ThrottleState::PAUSED && !max_pause_reached_) {
+        max_pause_reached_ = true;
+
+        syslog(LOG_WARNING, "host is under pressure for %li sec, uploads go on throttled", max_pause_sec_);
+    }
+
+    writeStatsLocked();
+
+    return true;
+}
+
+size_t UploadThrottle::chunkLength(size_t max_length) {
+    samplePressure();
+
+    lock_guard<mutex> throttle_lock(mutex_);
+
+    return state_ == ThrottleState::FULL ? max_length : min(max_length, THROTTLED_CHUNK_LENGTH);
+}
+
+void UploadThrottle::paceChunk(double chunk_elapsed_sec) {
+    double pause_sec;
+
+    {
+        lock_guard<mutex> throttle_lock(mutex_);
+
+        if (state_ == ThrottleState::FULL) {
+            return;
+        }
+
+        //chunk took duty share of time, the rest is slept
+        pause_sec = min(chunk_elapsed_sec * (1.0 / duty_ - 1.0), MAX_CHUNK_PAUSE_SEC);
+
+        throttled_chunks_++;
+        throttled_sleep_total_sec_ += pause_sec;
+    }
+
+    this_thread::sleep_for(chrono::duration<double>(pause_sec));
+}
+
+bool UploadThrottle::underPressure() {
+    samplePressure();
+
+    lock_guard<mutex> throttle_lock(mutex_);
+
+    return state_ != ThrottleState::FULL;
+}
+
+void UploadThrottle::writeStats() {
+    lock_guard<mutex> throttle_lock(mutex_);
+
+    writeStatsLocked();
+}
+
+void UploadThrottle::writeStatsLocked() {
+    if (stats_file_path_.empty()) {
+        return;
+    }
+
+    char stats_buf[1024];
+    int stats_length = snprintf(stats_buf, sizeof(stats_buf),
+        "psi_available=%d\n"
+        "cpu_some_avg10=%.2f\n"
+        "io_some_avg10=%.2f\n"
+        "memory_some_avg10=%.2f\n"
+        "throttle_pct=%.0f\n"
+        "pause_pct=%.0f\n"
+        "upload_state=%s\n"
+        "send_duty_pct=%.0f\n"
+        "paused_num=%lu\n"
+        "paused_total_sec=%lu\n"
+        "throttled_chunks=%lu\n"
+        "throttled_sleep_total_sec=%.1f\n"
+        "updated_sec=%ld\n",
+        sample_.available ? 1 : 0, sample_.cpu_some_avg10, sample_.io_some_avg10, sample_.memory_some_avg10,
+        throttle_pct_, pause_pct_, throttleStateName(state_), duty_ * 100.0, paused_num_, paused_total_sec_,
+        throttled_chunks_, throttled_sleep_total_sec_, static_cast<long>(sampled_time_sec_));
+
+    //readers never see half written stats
+    string stats_tmp_path = stats_file_path_ + ".tmp";
+    int stats_descr = open(stats_tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (stats_descr == -1) {
+        return;
+    }
+
+    int write_res = writeAll(stats_descr, stats_buf, min(stats_length, static_cast<int>(sizeof(stats_buf)) - 1));
+
+    if (close(stats_descr) != 0 || write_res != Status::OK || rename(stats_tmp_path.c_str(), stats_file_path_.c_str()) != 0) {
+        unlink(stats_tmp_path.c_str());
+    }
+}